@@ -0,0 +1,85 @@
+#include "fs/crc32c.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Measures CRC-32C throughput (crc32 instruction, if available, vs. lookup
+ * table), and the cost of verifying the checksum of every block read.
+ */
+
+#define BUFFER_LEN (1 << 20)
+#define ROUNDS 200
+#define FILE_SIZE 4096
+#define READS 20000
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static char buffer[BUFFER_LEN];
+
+static double read_file(bool verify, tfs_stats_t *stats) {
+    tfs_params params = tfs_default_params();
+    params.block_size = FILE_SIZE;
+    params.verify_checksums = verify;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, buffer, FILE_SIZE) == FILE_SIZE);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/f", 0);
+    assert(f != -1);
+    double start = now_ns();
+    for (int i = 0; i < READS; i++) {
+        assert(tfs_read(f, buffer, FILE_SIZE) == FILE_SIZE);
+        assert(tfs_close(f) != -1);
+        f = tfs_open("/f", 0);
+        assert(f != -1);
+    }
+    double elapsed = now_ns() - start;
+    assert(tfs_close(f) != -1);
+
+    tfs_get_stats(stats);
+    assert(tfs_destroy() != -1);
+    return elapsed;
+}
+
+int main() {
+    for (size_t i = 0; i < BUFFER_LEN; i++) {
+        buffer[i] = (char)(i * 131);
+    }
+
+    uint32_t sink = 0;
+    double start = now_ns();
+    for (int i = 0; i < ROUNDS; i++) {
+        sink ^= crc32c(buffer, BUFFER_LEN);
+    }
+    double fast_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < ROUNDS; i++) {
+        sink ^= crc32c_generic(buffer, BUFFER_LEN);
+    }
+    double table_ns = now_ns() - start;
+    assert(sink == 0); // both give the same result
+
+    tfs_stats_t stats;
+    double plain_ns = read_file(false, &stats);
+    double verify_ns = read_file(true, &stats);
+
+    double bytes = (double)BUFFER_LEN * ROUNDS;
+    printf("crc32c:              %10.1f MB/s\n", bytes / fast_ns * 1e3);
+    printf("crc32c (table):      %10.1f MB/s\n", bytes / table_ns * 1e3);
+    printf("read, no verify:     %10.1f ns/read\n", plain_ns / READS);
+    printf("read, verify:        %10.1f ns/read (checksums: %.1f MB/s)\n",
+           verify_ns / READS,
+           (double)stats.checksum_bytes / (double)stats.checksum_ns * 1e3);
+    return 0;
+}
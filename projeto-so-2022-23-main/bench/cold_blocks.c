@@ -0,0 +1,104 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Marks FILE_COUNT text files as cold, then reads them all back, and reports
+ * the compression ratio, the throughput of compressing and decompressing, and
+ * the resident memory of the process before and after marking the files cold.
+ */
+
+#define FILE_COUNT 2000
+#define FILE_SIZE 4096
+#define MAX_PATH_SIZE 32
+
+// resident memory of the process, from /proc/self/statm
+static size_t resident_bytes(void) {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    assert(statm != NULL);
+    size_t size, resident;
+    assert(fscanf(statm, "%zu %zu", &size, &resident) == 2);
+    assert(fclose(statm) == 0);
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// log-like text: repetitive, but not trivially so
+static void fill_text(char *buffer, size_t len, int seed) {
+    size_t used = 0;
+    for (unsigned line = 0; used < len; line++) {
+        char entry[128];
+        int n = snprintf(entry, sizeof(entry),
+                         "2022-11-%02u 12:%02u:%02u INFO worker-%d: request "
+                         "%u served in %u ms\n",
+                         1 + line % 28, line % 60, (line * 7) % 60, seed % 16,
+                         line * 31 + (unsigned)seed, (line * 13) % 250);
+        size_t to_copy = (size_t)n < len - used ? (size_t)n : len - used;
+        memcpy(buffer + used, entry, to_copy);
+        used += to_copy;
+    }
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 1;
+    params.max_open_files_count = 4;
+    params.block_size = FILE_SIZE > FILE_COUNT * 44 ? FILE_SIZE : FILE_COUNT * 44;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    char buffer[FILE_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/log-%d", i);
+        fill_text(buffer, sizeof(buffer), i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(tfs_close(f) != -1);
+    }
+
+    size_t resident_before = resident_bytes();
+    double start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/log-%d", i);
+        assert(tfs_mark_cold(path) != -1);
+    }
+    double compress_ns = now_ns() - start;
+    size_t resident_after = resident_bytes();
+
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    size_t raw = stats.cold_raw_bytes;
+    size_t stored = stats.cold_stored_bytes;
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/log-%d", i);
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(tfs_close(f) != -1);
+    }
+    tfs_get_stats(&stats);
+
+    printf("cold data:           %zu bytes in %zu bytes (ratio %.2f)\n", raw,
+           stored, (double)raw / (double)stored);
+    printf("mark cold:           %10.1f MB/s\n",
+           (double)raw / compress_ns * 1e3);
+    printf("decompression:       %10.1f MB/s\n",
+           (double)stats.decompressed_bytes / (double)stats.decompress_ns *
+               1e3);
+    printf("resident memory:     %zu KiB hot, %zu KiB cold\n",
+           resident_before / 1024, resident_after / 1024);
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
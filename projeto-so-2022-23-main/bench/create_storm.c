@@ -0,0 +1,55 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Creates CREATE_COUNT new files with TFS_O_CREAT, as fast as possible, and
+ * reports the create rate together with how many of the "does it already
+ * exist?" lookups were answered by the directory's Bloom filter.
+ */
+
+#define CREATE_COUNT 4000
+#define NAME_FORMAT "/tenant-%d-obj-%06d"
+#define MAX_PATH_SIZE 40
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = CREATE_COUNT + 1;
+    params.max_block_count = CREATE_COUNT + 1;
+    params.block_size = CREATE_COUNT * (MAX_FILE_NAME + sizeof(int));
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    double start = now_s();
+    for (int i = 0; i < CREATE_COUNT; i++) {
+        snprintf(path, sizeof(path), NAME_FORMAT, i % 42, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    double elapsed = now_s() - start;
+
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    size_t misses = stats.dir_bloom_negatives + stats.dir_bloom_false_positives;
+
+    printf("creates:                %d in %.3f s (%.0f creates/s)\n",
+           CREATE_COUNT, elapsed, CREATE_COUNT / elapsed);
+    printf("lookups:                %zu\n", stats.dir_lookups);
+    printf("bloom negatives:        %zu\n", stats.dir_bloom_negatives);
+    printf("bloom false positives:  %zu (%.2f%% of misses)\n",
+           stats.dir_bloom_false_positives,
+           misses ? 100.0 * (double)stats.dir_bloom_false_positives /
+                        (double)misses
+                  : 0.0);
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * THREAD_COUNT tenants each create, write, read and remove FILE_COUNT files,
+ * ROUNDS times: first all of them in the default instance, and then each one
+ * in an instance of its own. Reports the throughput of both.
+ */
+
+#define THREAD_COUNT 4
+#define FILE_COUNT 16
+#define ROUNDS 2000
+#define MAX_PATH_SIZE 32
+
+typedef struct {
+    tfs_ctx *ctx; // NULL for the default instance
+    int index;
+    pthread_t thread;
+} tenant_t;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int open_file(tenant_t const *t, char const *path, tfs_file_mode_t mode) {
+    return t->ctx ? tfs_ctx_open(t->ctx, path, mode) : tfs_open(path, mode);
+}
+
+static void *tenant_main(void *arg) {
+    tenant_t *t = arg;
+    char path[MAX_PATH_SIZE];
+    char buffer[MAX_PATH_SIZE];
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < FILE_COUNT; i++) {
+            snprintf(path, sizeof(path), "/t%d-%d", t->index, i);
+            int f = open_file(t, path, TFS_O_CREAT);
+            assert(f != -1);
+            if (t->ctx) {
+                assert(tfs_ctx_write(t->ctx, f, path, sizeof(path)) ==
+                       sizeof(path));
+                assert(tfs_ctx_close(t->ctx, f) != -1);
+            } else {
+                assert(tfs_write(f, path, sizeof(path)) == sizeof(path));
+                assert(tfs_close(f) != -1);
+            }
+        }
+        for (int i = 0; i < FILE_COUNT; i++) {
+            snprintf(path, sizeof(path), "/t%d-%d", t->index, i);
+            int f = open_file(t, path, 0);
+            assert(f != -1);
+            if (t->ctx) {
+                assert(tfs_ctx_read(t->ctx, f, buffer, sizeof(buffer)) ==
+                       sizeof(buffer));
+                assert(tfs_ctx_close(t->ctx, f) != -1);
+                assert(tfs_ctx_unlink(t->ctx, path) != -1);
+            } else {
+                assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+                assert(tfs_close(f) != -1);
+                assert(tfs_unlink(path) != -1);
+            }
+        }
+    }
+    return NULL;
+}
+
+static double run(tenant_t *tenants) {
+    double start = now_ns();
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_create(&tenants[i].thread, NULL, tenant_main,
+                              &tenants[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(tenants[i].thread, NULL) == 0);
+    }
+    double ops = (double)THREAD_COUNT * ROUNDS * FILE_COUNT * 2;
+    return ops / (now_ns() - start) * 1e9;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = THREAD_COUNT * FILE_COUNT + 1;
+    params.max_block_count = THREAD_COUNT * FILE_COUNT + 1;
+    params.max_open_files_count = THREAD_COUNT;
+    params.block_size = 4096;
+
+    tenant_t tenants[THREAD_COUNT];
+    assert(tfs_init(&params) != -1);
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        tenants[i] = (tenant_t){.ctx = NULL, .index = i};
+    }
+    double shared = run(tenants);
+    assert(tfs_destroy() != -1);
+
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        tenants[i].ctx = tfs_ctx_create(&params);
+        assert(tenants[i].ctx != NULL);
+    }
+    double separate = run(tenants);
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(tfs_ctx_destroy(tenants[i].ctx) != -1);
+    }
+
+    printf("shared instance:     %10.0f files/s\n", shared);
+    printf("one per tenant:      %10.0f files/s\n", separate);
+
+    return 0;
+}
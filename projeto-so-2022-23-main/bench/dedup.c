@@ -0,0 +1,70 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Writes FILE_COUNT files, a quarter of them with distinct contents and the
+ * rest copies of those, with and without dedup, and reports the write
+ * throughput, the dedup ratio and the hashing cost.
+ */
+
+#define FILE_COUNT 2000
+#define FILE_SIZE 4096
+#define DISTINCT (FILE_COUNT / 4)
+#define MAX_PATH_SIZE 32
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double write_files(bool dedup, tfs_stats_t *stats) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 1;
+    params.max_open_files_count = 4;
+    params.block_size = FILE_COUNT * 44;
+    params.dedup = dedup;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    char buffer[FILE_SIZE];
+    double start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        memset(buffer, 'a' + i % DISTINCT % 26, sizeof(buffer));
+        snprintf(buffer, sizeof(buffer), "template %d", i % DISTINCT);
+        snprintf(path, sizeof(path), "/f-%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(tfs_close(f) != -1);
+    }
+    double elapsed = now_ns() - start;
+
+    tfs_get_stats(stats);
+    assert(tfs_destroy() != -1);
+    return elapsed;
+}
+
+int main() {
+    tfs_stats_t stats;
+    double plain_ns = write_files(false, &stats);
+    double dedup_ns = write_files(true, &stats);
+    double bytes = (double)FILE_COUNT * FILE_SIZE;
+
+    printf("files written:       %d x %d bytes, %d distinct\n", FILE_COUNT,
+           FILE_SIZE, DISTINCT);
+    printf("without dedup:       %10.1f MB/s\n", bytes / plain_ns * 1e3);
+    printf("with dedup:          %10.1f MB/s\n", bytes / dedup_ns * 1e3);
+    printf("dedup ratio:         %zu of %zu blocks shared (%.2fx)\n",
+           stats.dedup_hits, stats.dedup_checks,
+           (double)stats.dedup_checks /
+               (double)(stats.dedup_checks - stats.dedup_hits));
+    printf("hashing:             %10.1f MB/s\n",
+           (double)stats.dedup_hashed_bytes / (double)stats.dedup_hash_ns *
+               1e3);
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Exports FILE_COUNT files of FILE_SIZE bytes with tfs_copy_to_external_fs,
+ * and compares it with reading them with tfs_read and writing them with
+ * fwrite, as a backup tool would.
+ */
+
+#define FILE_COUNT 64
+#define FILE_SIZE (4 << 20)
+#define MAX_PATH_SIZE 32
+
+char const *host_path = "bench/export.tmp";
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// the backup tool's way
+static void read_and_write(char const *path, char *buffer, size_t len) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    FILE *host = fopen(host_path, "w");
+    assert(host != NULL);
+    ssize_t n;
+    while ((n = tfs_read(f, buffer, len)) > 0) {
+        assert(fwrite(buffer, 1, (size_t)n, host) == n);
+    }
+    assert(n == 0);
+    assert(fclose(host) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 1;
+    params.block_size = FILE_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    char *buffer = malloc(FILE_SIZE);
+    assert(buffer != NULL);
+    memset(buffer, 'x', FILE_SIZE);
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f-%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, FILE_SIZE) == FILE_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+
+    double start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f-%d", i);
+        read_and_write(path, buffer, 64 * 1024);
+    }
+    double read_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f-%d", i);
+        assert(tfs_copy_to_external_fs(path, host_path) != -1);
+    }
+    double export_ns = now_ns() - start;
+
+    double bytes = (double)FILE_COUNT * FILE_SIZE;
+    printf("tfs_read + fwrite:   %10.1f MB/s\n", bytes / read_ns * 1e3);
+    printf("copy_to_external:    %10.1f MB/s\n", bytes / export_ns * 1e3);
+
+    free(buffer);
+    assert(tfs_destroy() != -1);
+    assert(remove(host_path) == 0);
+    return 0;
+}
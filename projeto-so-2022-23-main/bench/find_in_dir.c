@@ -0,0 +1,87 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Measures directory lookups (find_in_dir) in a directory with ENTRY_COUNT
+ * entries, both for names that exist and for names that don't, and compares
+ * them with a plain strncmp scan over the directory block.
+ */
+
+#define ENTRY_COUNT 4000
+#define LOOKUPS 20000
+#define NAME_FORMAT "/tenant-%d-obj-%06d"
+#define MAX_PATH_SIZE 40
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int plain_scan(dir_entry_t const *entries, size_t count,
+                      char const *name) {
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].d_inumber != -1 &&
+            strncmp(entries[i].d_name, name, MAX_FILE_NAME) == 0) {
+            return entries[i].d_inumber;
+        }
+    }
+    return -1;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = ENTRY_COUNT + 1;
+    params.max_block_count = ENTRY_COUNT + 1;
+    params.block_size = ENTRY_COUNT * sizeof(dir_entry_t);
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < ENTRY_COUNT; i++) {
+        snprintf(path, sizeof(path), NAME_FORMAT, i % 7, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    inode_t *root = inode_get(ROOT_DIR_INUM);
+    dir_entry_t const *entries =
+        data_block_get(inode_get_data_block(root));
+
+    // names of existing entries, spread over the whole directory
+    double start = now_ns();
+    for (int i = 0; i < LOOKUPS; i++) {
+        int n = (i * 7919) % ENTRY_COUNT;
+        snprintf(path, sizeof(path), NAME_FORMAT, n % 7, n);
+        assert(find_in_dir(root, path + 1) != -1);
+    }
+    double hit_ns = (now_ns() - start) / LOOKUPS;
+
+    start = now_ns();
+    for (int i = 0; i < LOOKUPS; i++) {
+        snprintf(path, sizeof(path), NAME_FORMAT, 99, i);
+        assert(find_in_dir(root, path + 1) == -1);
+    }
+    double miss_ns = (now_ns() - start) / LOOKUPS;
+
+    start = now_ns();
+    for (int i = 0; i < LOOKUPS; i++) {
+        snprintf(path, sizeof(path), NAME_FORMAT, 99, i);
+        assert(plain_scan(entries, ENTRY_COUNT, path + 1) == -1);
+    }
+    double plain_ns = (now_ns() - start) / LOOKUPS;
+
+    printf("directory entries:     %d\n", ENTRY_COUNT);
+    printf("find_in_dir (hit):     %10.1f ns/lookup\n", hit_ns);
+    printf("find_in_dir (miss):    %10.1f ns/lookup, %6.2f ns/entry\n",
+           miss_ns, miss_ns / ENTRY_COUNT);
+    printf("strncmp scan (miss):   %10.1f ns/lookup, %6.2f ns/entry\n",
+           plain_ns, plain_ns / ENTRY_COUNT);
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
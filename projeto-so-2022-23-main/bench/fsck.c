@@ -0,0 +1,61 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Checks a 2 GiB image (BLOCK_COUNT blocks of BLOCK_SIZE bytes) with FILE_COUNT
+ * files, hard links and clones, with different numbers of threads.
+ */
+
+#define BLOCK_SIZE (128 * 1024)
+#define BLOCK_COUNT (16 * 1024)
+#define INODE_COUNT (16 * 1024)
+#define FILE_COUNT 1500
+#define MAX_PATH_SIZE 32
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = INODE_COUNT;
+    params.max_block_count = BLOCK_COUNT;
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    char link[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f-%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, path, sizeof(path)) == sizeof(path));
+        assert(tfs_close(f) != -1);
+        if (i % 4 == 0) {
+            snprintf(link, sizeof(link), "/l-%d", i);
+            assert(tfs_link(path, link) != -1);
+        } else if (i % 4 == 1) {
+            snprintf(link, sizeof(link), "/c-%d", i);
+            assert(tfs_clone(path, link) != -1);
+        }
+    }
+
+    printf("image:               %d blocks of %d bytes, %d inodes\n",
+           BLOCK_COUNT, BLOCK_SIZE, INODE_COUNT);
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        tfs_fsck_report_t report;
+        double start = now_ns();
+        assert(tfs_fsck(&report, threads) == 0);
+        double elapsed = now_ns() - start;
+        printf("fsck, %d thread(s):   %10.2f ms (%zu inodes, %zu blocks)\n",
+               threads, elapsed / 1e6, report.inodes_checked,
+               report.blocks_checked);
+    }
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
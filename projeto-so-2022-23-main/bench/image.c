@@ -0,0 +1,107 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Fills TécnicoFS by importing FILE_COUNT host files of up to FILE_SIZE bytes
+ * with tfs_copy_from_external_fs, saves it as an image, and compares loading
+ * the image (with 1 to 8 threads) with importing the files again.
+ */
+
+#define FILE_COUNT 1024
+#define FILE_SIZE (128 << 10)
+#define MAX_PATH_SIZE 64
+
+char const *image_path = "bench/image.tmp";
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void host_path(char *path, int i) {
+    snprintf(path, MAX_PATH_SIZE, "bench/image-%d.tmp", i);
+}
+
+static void init(void) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 1;
+    params.block_size = FILE_SIZE;
+    assert(tfs_init(&params) != -1);
+}
+
+// the time to import all the host files
+static double import_all(void) {
+    char path[MAX_PATH_SIZE];
+    char name[MAX_PATH_SIZE];
+    double start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        host_path(path, i);
+        snprintf(name, sizeof(name), "/f%d", i);
+        assert(tfs_copy_from_external_fs(path, name) != -1);
+    }
+    return now_ns() - start;
+}
+
+int main() {
+    char *buffer = malloc(FILE_SIZE);
+    assert(buffer != NULL);
+    char path[MAX_PATH_SIZE];
+    size_t bytes = 0;
+    for (int i = 0; i < FILE_COUNT; i++) {
+        // half full on average, so that packing the blocks matters
+        size_t size = FILE_SIZE / 4 + (size_t)i * 7919 % (FILE_SIZE / 2);
+        memset(buffer, 'a' + i % 26, size);
+        host_path(path, i);
+        FILE *host = fopen(path, "w");
+        assert(host != NULL);
+        assert(fwrite(buffer, 1, size, host) == size);
+        assert(fclose(host) == 0);
+        bytes += size;
+    }
+
+    // the host files are in the page cache from here on
+    init();
+    import_all();
+    assert(tfs_destroy() != -1);
+
+    init();
+    double import_ns = import_all();
+    double start = now_ns();
+    assert(tfs_save_image(image_path) != -1);
+    double save_ns = now_ns() - start;
+    assert(tfs_destroy() != -1);
+
+    FILE *image = fopen(image_path, "r");
+    assert(image != NULL);
+    assert(fseek(image, 0, SEEK_END) == 0);
+    long image_size = ftell(image);
+    assert(fclose(image) == 0);
+
+    printf("%d files, %zu bytes; image of %ld bytes (%zu bytes of blocks)\n",
+           FILE_COUNT, bytes, image_size, (size_t)FILE_COUNT * FILE_SIZE);
+    printf("copy_from_external:  %8.2f ms\n", import_ns / 1e6);
+    printf("tfs_save_image:      %8.2f ms\n", save_ns / 1e6);
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        init();
+        start = now_ns();
+        assert(tfs_load_image(image_path, threads) != -1);
+        double load_ns = now_ns() - start;
+        assert(tfs_destroy() != -1);
+        printf("tfs_load_image (%d): %8.2f ms\n", threads, load_ns / 1e6);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        host_path(path, i);
+        assert(unlink(path) == 0);
+    }
+    assert(unlink(image_path) == 0);
+    free(buffer);
+    return 0;
+}
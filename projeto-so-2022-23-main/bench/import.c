@@ -0,0 +1,70 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Imports a FILE_SIZE host file ROUNDS times into a FS with FILE_SIZE blocks,
+ * and FILE_COUNT small files into a FS with the default block size, and
+ * reports the import throughput.
+ */
+
+#define FILE_SIZE (64 << 20)
+#define ROUNDS 8
+#define FILE_COUNT 2000
+
+char const *large_path = "bench/import_large.tmp";
+char const *small_path = "bench/import_small.tmp";
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void create_host_file(char const *path, size_t size) {
+    char *contents = malloc(size);
+    assert(contents != NULL);
+    for (size_t i = 0; i < size; i++) {
+        contents[i] = (char)('a' + i % 26);
+    }
+    FILE *host = fopen(path, "w");
+    assert(host != NULL);
+    assert(fwrite(contents, 1, size, host) == size);
+    assert(fclose(host) == 0);
+    free(contents);
+}
+
+int main() {
+    create_host_file(large_path, FILE_SIZE);
+    create_host_file(small_path, 1000);
+
+    tfs_params params = tfs_default_params();
+    params.block_size = FILE_SIZE;
+    params.max_block_count = 2;
+    assert(tfs_init(&params) != -1);
+    double start = now_ns();
+    for (int i = 0; i < ROUNDS; i++) {
+        assert(tfs_copy_from_external_fs(large_path, "/large") != -1);
+    }
+    double elapsed = now_ns() - start;
+    assert(tfs_destroy() != -1);
+    printf("large files:         %10.1f MB/s\n",
+           (double)FILE_SIZE * ROUNDS / elapsed * 1e3);
+
+    params = tfs_default_params();
+    assert(tfs_init(&params) != -1);
+    start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_copy_from_external_fs(small_path, "/small") != -1);
+    }
+    elapsed = now_ns() - start;
+    assert(tfs_destroy() != -1);
+    printf("small files:         %10.1f files/s\n", FILE_COUNT / elapsed * 1e9);
+
+    assert(remove(large_path) == 0);
+    assert(remove(small_path) == 0);
+    return 0;
+}
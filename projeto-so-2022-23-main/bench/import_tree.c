@@ -0,0 +1,95 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Imports a host tree of DIR_COUNT directories with FILE_COUNT files of
+ * FILE_SIZE bytes in total, one file at a time with tfs_copy_from_external_fs
+ * and with tfs_import_tree and different numbers of threads.
+ */
+
+#define ROOT "bench/import_tree.tmp"
+#define DIR_COUNT 20
+#define FILE_COUNT 5000
+#define FILE_SIZE 4096
+#define MAX_PATH_SIZE 64
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void host_path(char *path, int i) {
+    snprintf(path, MAX_PATH_SIZE, ROOT "/d%d/f%d", i % DIR_COUNT, i);
+}
+
+static void init_fs(void) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 1;
+    params.max_open_files_count = 16;
+    params.block_size = 256 * 1024;
+    assert(tfs_init(&params) != -1);
+}
+
+static void print_rates(char const *label, double elapsed_ns) {
+    printf("%-20s %10.0f files/s %8.1f MB/s\n", label,
+           FILE_COUNT / elapsed_ns * 1e9,
+           (double)FILE_COUNT * FILE_SIZE / elapsed_ns * 1e3);
+}
+
+int main() {
+    char path[MAX_PATH_SIZE];
+    char contents[FILE_SIZE];
+    memset(contents, 'x', sizeof(contents));
+    assert(mkdir(ROOT, 0755) == 0);
+    for (int i = 0; i < DIR_COUNT; i++) {
+        snprintf(path, sizeof(path), ROOT "/d%d", i);
+        assert(mkdir(path, 0755) == 0);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        host_path(path, i);
+        FILE *host = fopen(path, "w");
+        assert(host != NULL);
+        assert(fwrite(contents, 1, sizeof(contents), host) == sizeof(contents));
+        assert(fclose(host) == 0);
+    }
+
+    init_fs();
+    double start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        char name[MAX_PATH_SIZE];
+        host_path(path, i);
+        snprintf(name, sizeof(name), "/d%d_f%d", i % DIR_COUNT, i);
+        assert(tfs_copy_from_external_fs(path, name) != -1);
+    }
+    print_rates("one at a time:", now_ns() - start);
+    assert(tfs_destroy() != -1);
+
+    for (int threads = 1; threads <= 8; threads *= 2) {
+        init_fs();
+        tfs_import_report_t report;
+        assert(tfs_import_tree(ROOT, "/", threads, &report) == FILE_COUNT);
+        assert(report.bytes == (size_t)FILE_COUNT * FILE_SIZE);
+        char label[32];
+        snprintf(label, sizeof(label), "tree, %d thread(s):", threads);
+        print_rates(label, (double)report.elapsed_ns);
+        assert(tfs_destroy() != -1);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        host_path(path, i);
+        assert(unlink(path) == 0);
+    }
+    for (int i = 0; i < DIR_COUNT; i++) {
+        snprintf(path, sizeof(path), ROOT "/d%d", i);
+        assert(rmdir(path) == 0);
+    }
+    assert(rmdir(ROOT) == 0);
+    return 0;
+}
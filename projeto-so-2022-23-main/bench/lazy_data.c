@@ -0,0 +1,83 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Initializes TécnicoFS with room for 4 GiB of data, writes FILE_COUNT files
+ * to it and removes them again, and reports how long initializing took and
+ * how the resident memory followed the data stored.
+ */
+
+#define BLOCK_SIZE (256 << 10)
+#define BLOCK_COUNT 16384
+#define FILE_COUNT 1024
+#define MAX_PATH_SIZE 32
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// resident memory, in MB (Linux only)
+static double resident_mb(void) {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    assert(statm != NULL);
+    size_t pages, resident;
+    assert(fscanf(statm, "%zu %zu", &pages, &resident) == 2);
+    assert(fclose(statm) == 0);
+    return (double)resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+}
+
+int main(int argc, char **argv) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = BLOCK_COUNT;
+    params.block_size = BLOCK_SIZE;
+    params.huge_pages = argc > 1 && strcmp(argv[1], "huge") == 0;
+
+    char *buffer = malloc(BLOCK_SIZE);
+    assert(buffer != NULL);
+    memset(buffer, 'x', BLOCK_SIZE);
+    double base = resident_mb();
+
+    double start = now_ns();
+    assert(tfs_init(&params) != -1);
+    double init_ns = now_ns() - start;
+    double after_init = resident_mb();
+
+    char path[MAX_PATH_SIZE];
+    start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f-%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, BLOCK_SIZE) == BLOCK_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+    double write_ns = now_ns() - start;
+    double after_write = resident_mb();
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f-%d", i);
+        assert(tfs_unlink(path) != -1);
+    }
+    double after_unlink = resident_mb();
+
+    printf("capacity %d MB, %d MB written%s\n", BLOCK_COUNT / 4,
+           FILE_COUNT / 4, params.huge_pages ? " (huge pages)" : "");
+    printf("tfs_init:            %8.2f ms, resident +%7.1f MB\n",
+           init_ns / 1e6, after_init - base);
+    printf("after writing:       %8.2f ms, resident +%7.1f MB\n",
+           write_ns / 1e6, after_write - base);
+    printf("after removing:                 resident +%7.1f MB\n",
+           after_unlink - base);
+
+    assert(tfs_destroy() != -1);
+    free(buffer);
+    return 0;
+}
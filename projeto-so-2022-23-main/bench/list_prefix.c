@@ -0,0 +1,71 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Lists all names with a given prefix in a directory with ENTRY_COUNT
+ * entries spread over TENANTS prefixes, with and without the sorted
+ * directory index. The entries are hard links to a single file.
+ */
+
+#define ENTRY_COUNT 50000
+#define TENANTS 1000
+#define SCANS 200
+#define NAME_FORMAT "/tenant-%d-obj-%06d"
+#define MAX_PATH_SIZE 40
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int count_entry(tfs_dirent_t const *entry, void *arg) {
+    (void)entry;
+    (*(size_t *)arg)++;
+    return 0;
+}
+
+static void run(bool indexed) {
+    tfs_params params = tfs_default_params();
+    params.block_size = ENTRY_COUNT * (MAX_FILE_NAME + sizeof(int));
+    params.max_block_count = 4;
+    params.dir_prefix_index = indexed;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    snprintf(path, sizeof(path), NAME_FORMAT, 0, 0);
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    char target[MAX_PATH_SIZE];
+    snprintf(target, sizeof(target), "%s", path);
+    for (int i = 1; i < ENTRY_COUNT; i++) {
+        snprintf(path, sizeof(path), NAME_FORMAT, i % TENANTS, i);
+        assert(tfs_link(target, path) != -1);
+    }
+
+    size_t matches = 0;
+    double start = now_s();
+    for (int i = 0; i < SCANS; i++) {
+        char prefix[MAX_PATH_SIZE];
+        snprintf(prefix, sizeof(prefix), "tenant-%d-", (i * 37) % TENANTS);
+        assert(tfs_list_prefix("/", prefix, count_entry, &matches) > 0);
+    }
+    double elapsed = now_s() - start;
+
+    printf("%-10s %d entries: %8.1f us/prefix scan (%zu matches/scan)\n",
+           indexed ? "indexed" : "unindexed", ENTRY_COUNT,
+           elapsed * 1e6 / SCANS, matches / SCANS);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    run(false);
+    run(true);
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Imports FILE_COUNT host files of FILE_SIZE bytes by copying and by mapping
+ * them, then reads them all, and reports the time taken and how much the
+ * resident anonymous memory (i.e. not shared with the page cache) grew.
+ */
+
+#define FILE_COUNT 64
+#define FILE_SIZE (2 << 20)
+#define MAX_PATH_SIZE 64
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// resident anonymous memory, in MB (Linux only)
+static double anonymous_mb(void) {
+    FILE *statm = fopen("/proc/self/statm", "r");
+    assert(statm != NULL);
+    size_t pages, resident, file_backed;
+    assert(fscanf(statm, "%zu %zu %zu", &pages, &resident, &file_backed) == 3);
+    assert(fclose(statm) == 0);
+    return (double)(resident - file_backed) * (double)sysconf(_SC_PAGESIZE) /
+           (1 << 20);
+}
+
+static void host_path(char *path, int i) {
+    snprintf(path, MAX_PATH_SIZE, "bench/map_import-%d.tmp", i);
+}
+
+static void run(char const *label,
+                int (*import)(char const *, char const *), char *buffer) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 1;
+    params.block_size = FILE_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    char name[MAX_PATH_SIZE];
+    double rss = anonymous_mb();
+    double start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        host_path(path, i);
+        snprintf(name, sizeof(name), "/f%d", i);
+        assert(import(path, name) != -1);
+    }
+    double import_ns = now_ns() - start;
+
+    start = now_ns();
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(name, sizeof(name), "/f%d", i);
+        int f = tfs_open(name, 0);
+        assert(f != -1);
+        assert(tfs_read(f, buffer, FILE_SIZE) == FILE_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+    double read_ns = now_ns() - start;
+
+    printf("%-10s import %8.2f ms, read %8.2f ms, anonymous +%6.1f MB\n",
+           label, import_ns / 1e6, read_ns / 1e6, anonymous_mb() - rss);
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    char *buffer = malloc(FILE_SIZE);
+    assert(buffer != NULL);
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        memset(buffer, 'a' + i % 26, FILE_SIZE);
+        host_path(path, i);
+        FILE *host = fopen(path, "w");
+        assert(host != NULL);
+        assert(fwrite(buffer, 1, FILE_SIZE, host) == FILE_SIZE);
+        assert(fclose(host) == 0);
+    }
+
+    // the host files are in the page cache from here on
+    run("copy:", tfs_copy_from_external_fs, buffer);
+    run("map:", tfs_map_from_external_fs, buffer);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        host_path(path, i);
+        assert(unlink(path) == 0);
+    }
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,60 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Lists a directory with ENTRY_COUNT entries with tfs_readdir_batch.
+ * The entries are hard links to a single file, so that filling the directory
+ * doesn't need ENTRY_COUNT inodes.
+ */
+
+#define ENTRY_COUNT 100000
+#define BATCH_SIZE 512
+#define NAME_FORMAT "/tenant-%d-obj-%06d"
+#define MAX_PATH_SIZE 40
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = ENTRY_COUNT * (MAX_FILE_NAME + sizeof(int));
+    params.max_block_count = 4;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    snprintf(path, sizeof(path), NAME_FORMAT, 0, 0);
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    char target[MAX_PATH_SIZE];
+    snprintf(target, sizeof(target), "%s", path);
+    for (int i = 1; i < ENTRY_COUNT; i++) {
+        snprintf(path, sizeof(path), NAME_FORMAT, i % 42, i);
+        assert(tfs_link(target, path) != -1);
+    }
+
+    tfs_dirent_t entries[BATCH_SIZE];
+    double start = now_s();
+    int dh = tfs_opendir("/");
+    assert(dh != -1);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = tfs_readdir_batch(dh, entries, BATCH_SIZE)) > 0) {
+        total += (size_t)n;
+    }
+    assert(tfs_closedir(dh) != -1);
+    double elapsed = now_s() - start;
+
+    assert(total == ENTRY_COUNT);
+    printf("listed %zu entries in %.3f ms (%.1f ns/entry, batches of %d)\n",
+           total, elapsed * 1e3, elapsed * 1e9 / (double)total, BATCH_SIZE);
+
+    assert(tfs_destroy() != -1);
+    return 0;
+}
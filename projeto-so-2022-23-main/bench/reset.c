@@ -0,0 +1,71 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Runs ROUNDS rounds of a small workload (FILE_COUNT files) on a large FS,
+ * and compares emptying the FS between rounds with tfs_reset to doing it with
+ * tfs_destroy and tfs_init.
+ */
+
+#define ROUNDS 200
+#define FILE_COUNT 16
+#define MAX_PATH_SIZE 32
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void workload(void) {
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, path, sizeof(path)) == sizeof(path));
+        assert(tfs_close(f) != -1);
+    }
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 1 << 20;
+    params.max_block_count = 1 << 20;
+    params.max_open_files_count = 1 << 16;
+    params.block_size = 4096;
+
+    double destroy_ns = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        assert(tfs_init(&params) != -1);
+        workload();
+        double start = now_ns();
+        assert(tfs_destroy() != -1);
+        destroy_ns += now_ns() - start;
+    }
+    double init_ns = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        double start = now_ns();
+        assert(tfs_init(&params) != -1);
+        init_ns += now_ns() - start;
+        assert(tfs_destroy() != -1);
+    }
+
+    assert(tfs_init(&params) != -1);
+    double reset_ns = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        workload();
+        double start = now_ns();
+        assert(tfs_reset() != -1);
+        reset_ns += now_ns() - start;
+    }
+    assert(tfs_destroy() != -1);
+
+    printf("destroy + init:      %10.1f us\n",
+           (destroy_ns + init_ns) / ROUNDS / 1e3);
+    printf("reset:               %10.1f us\n", reset_ns / ROUNDS / 1e3);
+
+    return 0;
+}
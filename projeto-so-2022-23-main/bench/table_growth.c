@@ -0,0 +1,62 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Initializes and destroys TécnicoFS with room for MAX_INODES inodes and
+ * MAX_OPEN_FILES open files, and then times opening and closing FILE_COUNT
+ * files (the lookups through the inode and open file tables).
+ */
+
+#define MAX_INODES (1 << 20)
+#define MAX_OPEN_FILES (1 << 16)
+#define CYCLES 20
+#define FILE_COUNT 1000
+#define ROUNDS 100
+#define MAX_PATH_SIZE 32
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = MAX_INODES;
+    params.max_open_files_count = MAX_OPEN_FILES;
+    params.block_size = FILE_COUNT * 64;
+
+    double start = now_ns();
+    for (int i = 0; i < CYCLES; i++) {
+        assert(tfs_init(&params) != -1);
+        assert(tfs_destroy() != -1);
+    }
+    double cycle_ns = (now_ns() - start) / CYCLES;
+
+    assert(tfs_init(&params) != -1);
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    start = now_ns();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < FILE_COUNT; i++) {
+            snprintf(path, sizeof(path), "/f%d", i);
+            int f = tfs_open(path, 0);
+            assert(f != -1);
+            assert(tfs_close(f) != -1);
+        }
+    }
+    double open_ns = (now_ns() - start) / (ROUNDS * FILE_COUNT);
+    assert(tfs_destroy() != -1);
+
+    printf("tfs_init + tfs_destroy:  %10.3f ms\n", cycle_ns / 1e6);
+    printf("tfs_open + tfs_close:    %10.1f ns\n", open_ns);
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Exports FILE_COUNT files of FILE_SIZE bytes as a tar archive into a pipe,
+ * then imports the archive back from a pipe, and compares their throughput
+ * with just pushing the same bytes through a pipe.
+ */
+
+#define FILE_COUNT 32
+#define FILE_SIZE (4 << 20)
+#define MAX_PATH_SIZE 32
+#define PIPE_CHUNK (1 << 20)
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// the other end of the pipe: either collects everything it reads, or feeds
+// the whole buffer in
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t len;
+} pipe_end_t;
+
+static void *drain(void *arg) {
+    pipe_end_t *end = arg;
+    ssize_t n;
+    while ((n = read(end->fd, end->buffer + end->len, PIPE_CHUNK)) > 0) {
+        end->len += (size_t)n;
+    }
+    assert(n == 0);
+    return NULL;
+}
+
+static void *feed(void *arg) {
+    pipe_end_t *end = arg;
+    for (size_t done = 0; done < end->len;) {
+        size_t chunk = end->len - done < PIPE_CHUNK ? end->len - done
+                                                    : PIPE_CHUNK;
+        ssize_t n = write(end->fd, end->buffer + done, chunk);
+        assert(n > 0);
+        done += (size_t)n;
+    }
+    assert(close(end->fd) == 0);
+    return NULL;
+}
+
+static void init(void) {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_block_count = FILE_COUNT + 1;
+    params.block_size = FILE_SIZE;
+    assert(tfs_init(&params) != -1);
+}
+
+int main() {
+    init();
+    char *buffer = malloc(FILE_SIZE);
+    assert(buffer != NULL);
+    memset(buffer, 'x', FILE_SIZE);
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f-%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_write(f, buffer, FILE_SIZE) == FILE_SIZE);
+        assert(tfs_close(f) != -1);
+    }
+    free(buffer);
+
+    // room for the whole archive (headers and end marker included)
+    size_t capacity = (size_t)FILE_COUNT * (FILE_SIZE + 512) + PIPE_CHUNK;
+    pipe_end_t archive = {.buffer = malloc(capacity), .len = 0};
+    assert(archive.buffer != NULL);
+    memset(archive.buffer, 0, capacity);
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    archive.fd = fds[0];
+    pthread_t thread;
+    double start = now_ns();
+    assert(pthread_create(&thread, NULL, drain, &archive) == 0);
+    assert(tfs_export_tar(fds[1]) == FILE_COUNT);
+    assert(close(fds[1]) == 0);
+    assert(pthread_join(thread, NULL) == 0);
+    double export_ns = now_ns() - start;
+    assert(close(fds[0]) == 0);
+    assert(tfs_destroy() != -1);
+
+    init();
+    assert(pipe(fds) == 0);
+    pipe_end_t source = {.fd = fds[1], .buffer = archive.buffer,
+                         .len = archive.len};
+    start = now_ns();
+    assert(pthread_create(&thread, NULL, feed, &source) == 0);
+    assert(tfs_import_tar(fds[0]) == FILE_COUNT);
+    assert(pthread_join(thread, NULL) == 0);
+    double import_ns = now_ns() - start;
+    assert(close(fds[0]) == 0);
+    assert(tfs_destroy() != -1);
+
+    // the same bytes, straight through a pipe
+    assert(pipe(fds) == 0);
+    source.fd = fds[1];
+    pipe_end_t sink = {.fd = fds[0], .buffer = malloc(capacity), .len = 0};
+    assert(sink.buffer != NULL);
+    memset(sink.buffer, 0, capacity);
+    start = now_ns();
+    assert(pthread_create(&thread, NULL, feed, &source) == 0);
+    drain(&sink);
+    assert(pthread_join(thread, NULL) == 0);
+    double pipe_ns = now_ns() - start;
+    assert(close(fds[0]) == 0);
+    assert(sink.len == archive.len);
+
+    double bytes = (double)archive.len;
+    printf("pipe only:           %10.1f MB/s\n", bytes / pipe_ns * 1e3);
+    printf("tfs_export_tar:      %10.1f MB/s\n", bytes / export_ns * 1e3);
+    printf("tfs_import_tar:      %10.1f MB/s\n", bytes / import_ns * 1e3);
+
+    free(sink.buffer);
+    free(archive.buffer);
+    return 0;
+}
@@ -0,0 +1,240 @@
+#include "compress.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (65535)
+// run lengths of at least LZ_RUN_MASK continue in extra bytes after the token
+#define LZ_RUN_MASK (15)
+// the last LZ_LAST_LITERALS bytes are always literals, and no match starts in
+// the last LZ_MATCH_LIMIT bytes (as required by the LZ4 block format)
+#define LZ_LAST_LITERALS (5)
+#define LZ_MATCH_LIMIT (12)
+#define LZ_HASH_BITS (12)
+
+static inline uint32_t read32(uint8_t const *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline size_t min_size(size_t a, size_t b) { return a < b ? a : b; }
+
+/*
+ * Writes the part of a run length that doesn't fit in the token.
+ * Returns the new output position, or NULL if there is no space.
+ */
+static uint8_t *write_length(uint8_t *op, uint8_t const *oend, size_t len) {
+    for (len -= LZ_RUN_MASK; len >= UINT8_MAX; len -= UINT8_MAX) {
+        if (op == oend) {
+            return NULL;
+        }
+        *op++ = UINT8_MAX;
+    }
+    if (op == oend) {
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/*
+ * Reads the part of a run length that doesn't fit in the token.
+ * Returns false if the input ends first.
+ */
+static bool read_length(uint8_t const **ip, uint8_t const *iend, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip == iend) {
+            return false;
+        }
+        b = *(*ip)++;
+        *len += b;
+    } while (b == UINT8_MAX);
+    return true;
+}
+
+/*
+ * Writes a sequence: the literals, followed (unless it is the last sequence)
+ * by a match of match_len + LZ_MIN_MATCH bytes at the given offset.
+ * Returns the new output position, or NULL if there is no space.
+ */
+static uint8_t *write_sequence(uint8_t *op, uint8_t const *oend,
+                               uint8_t const *literals, size_t literal_len,
+                               size_t offset, size_t match_len, bool last) {
+    if (op == oend) {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)(min_size(literal_len, LZ_RUN_MASK) << 4);
+    if (literal_len >= LZ_RUN_MASK &&
+        (op = write_length(op, oend, literal_len)) == NULL) {
+        return NULL;
+    }
+    if ((size_t)(oend - op) < literal_len) {
+        return NULL;
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (last) {
+        return op;
+    }
+
+    if (oend - op < 2) {
+        return NULL;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    *token |= (uint8_t)min_size(match_len, LZ_RUN_MASK);
+    if (match_len >= LZ_RUN_MASK) {
+        op = write_length(op, oend, match_len);
+    }
+    return op;
+}
+
+/**
+ * Compress a buffer.
+ *
+ * Input:
+ *   - src: data to compress
+ *   - len: length of src
+ *   - dst: where to store the compressed data
+ *   - capacity: size of dst
+ *
+ * Returns the length of the compressed data, or 0 if it doesn't fit in
+ * capacity bytes (or len is 0).
+ */
+size_t lz_compress(void const *src, size_t len, void *dst, size_t capacity) {
+    uint8_t const *const base = src;
+    uint8_t const *const iend = base + len;
+    uint8_t const *ip = base;
+    uint8_t const *anchor = base; // start of the pending literals
+    uint8_t *op = dst;
+    uint8_t const *const oend = op + capacity;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (len > LZ_MATCH_LIMIT) {
+        // last position seen for each hash of 4 bytes
+        uint32_t table[1 << LZ_HASH_BITS];
+        memset(table, 0, sizeof(table));
+
+        uint8_t const *const mflimit = iend - LZ_MATCH_LIMIT;
+        uint8_t const *const mlimit = iend - LZ_LAST_LITERALS;
+        while (ip <= mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash32(seq);
+            uint8_t const *ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            // Extend the match as far as it goes
+            uint8_t const *match_start = ip;
+            size_t offset = (size_t)(ip - ref);
+            ip += LZ_MIN_MATCH;
+            ref += LZ_MIN_MATCH;
+            while (ip < mlimit && *ip == *ref) {
+                ip++;
+                ref++;
+            }
+
+            op = write_sequence(op, oend, anchor,
+                                (size_t)(match_start - anchor), offset,
+                                (size_t)(ip - match_start) - LZ_MIN_MATCH,
+                                false);
+            if (op == NULL) {
+                return 0;
+            }
+            anchor = ip;
+        }
+    }
+
+    op = write_sequence(op, oend, anchor, (size_t)(iend - anchor), 0, 0, true);
+    if (op == NULL) {
+        return 0;
+    }
+    return (size_t)(op - (uint8_t *)dst);
+}
+
+/**
+ * Decompress a buffer compressed with lz_compress.
+ *
+ * Input:
+ *   - src: compressed data
+ *   - len: length of src
+ *   - dst: where to store the decompressed data
+ *   - dst_len: exact length of the decompressed data
+ *
+ * Returns 0 if successful, -1 if the compressed data is malformed or doesn't
+ * decompress to dst_len bytes.
+ */
+int lz_decompress(void const *src, size_t len, void *dst, size_t dst_len) {
+    uint8_t const *ip = src;
+    uint8_t const *const iend = ip + len;
+    uint8_t *op = dst;
+    uint8_t *const oend = op + dst_len;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == LZ_RUN_MASK &&
+            !read_length(&ip, iend, &literal_len)) {
+            return -1;
+        }
+        if ((size_t)(iend - ip) < literal_len ||
+            (size_t)(oend - op) < literal_len) {
+            return -1;
+        }
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        if (ip == iend) {
+            break; // last sequence
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst)) {
+            return -1;
+        }
+
+        size_t match_len = token & LZ_RUN_MASK;
+        if (match_len == LZ_RUN_MASK && !read_length(&ip, iend, &match_len)) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if ((size_t)(oend - op) < match_len) {
+            return -1;
+        }
+
+        uint8_t const *ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            // overlapping match: repeats the last 'offset' bytes
+            for (size_t i = 0; i < match_len; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op == oend ? 0 : -1;
+}
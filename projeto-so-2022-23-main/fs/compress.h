@@ -0,0 +1,16 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+
+/*
+ * Fast LZ77 compressor for data blocks, in the LZ4 block format: a sequence
+ * of (literal run, back-reference) pairs, each one a token byte with both
+ * lengths, the literals, and a 2-byte offset into the already decoded data.
+ * It trades compression ratio for speed, decompression especially.
+ */
+
+size_t lz_compress(void const *src, size_t len, void *dst, size_t capacity);
+int lz_decompress(void const *src, size_t len, void *dst, size_t dst_len);
+
+#endif // COMPRESS_H
@@ -6,8 +6,21 @@
 
 #define MAX_FILE_NAME (40)
 
-#define BUFFER_SIZE (512)
+// Size of the host reads done when importing a file (files that need more
+// than one are read by a helper thread while the previous chunk is written)
+#define IMPORT_CHUNK_SIZE (1 << 20)
 
+// Number of files whose inodes and directory entries are allocated together by
+// tfs_import_tree
+#define IMPORT_BATCH_SIZE (64)
+
+// Maximum number of symbolic links followed when opening a file
+#define MAX_SYMLINK_HOPS (16)
+
+// Simulated storage access latency (can be overridden at build time, e.g.
+// EXTRA_CFLAGS=-DDELAY=0 to benchmark without it)
+#ifndef DELAY
 #define DELAY (5000)
+#endif
 
 #endif // CONFIG_H
@@ -0,0 +1,100 @@
+#include "crc32c.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HW
+#endif
+
+// reflected Castagnoli polynomial
+#define CRC32C_POLY (0x82f63b78u)
+
+// crc_table[k][b]: CRC of byte b followed by k zero bytes (slicing-by-8)
+static uint32_t crc_table[8][256];
+static bool use_hw;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc32c_setup(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        }
+        crc_table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc_table[k - 1][b];
+            crc_table[k][b] = (prev >> 8) ^ crc_table[0][prev & 0xff];
+        }
+    }
+
+#ifdef CRC32C_HW
+    use_hw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc32c_sw(uint32_t crc, uint8_t const *p, size_t len) {
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        v ^= crc;
+        crc = crc_table[7][v & 0xff] ^ crc_table[6][(v >> 8) & 0xff] ^
+              crc_table[5][(v >> 16) & 0xff] ^ crc_table[4][(v >> 24) & 0xff] ^
+              crc_table[3][(v >> 32) & 0xff] ^ crc_table[2][(v >> 40) & 0xff] ^
+              crc_table[1][(v >> 48) & 0xff] ^ crc_table[0][v >> 56];
+    }
+    for (; len > 0; len--, p++) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef CRC32C_HW
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_hw(uint32_t crc, uint8_t const *p, size_t len) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; len--, p++) {
+        crc = _mm_crc32_u8(crc, *p);
+    }
+    return crc;
+}
+#endif
+
+/**
+ * Compute the CRC-32C of a buffer.
+ *
+ * Input:
+ *   - data: the buffer
+ *   - len: length of the buffer
+ *
+ * Returns the checksum.
+ */
+uint32_t crc32c(void const *data, size_t len) {
+    pthread_once(&crc_once, crc32c_setup);
+
+#ifdef CRC32C_HW
+    if (use_hw) {
+        return ~crc32c_hw(~0u, data, len);
+    }
+#endif
+    return ~crc32c_sw(~0u, data, len);
+}
+
+/**
+ * Compute the CRC-32C of a buffer, always with the lookup table (e.g. to
+ * compare it with the crc32 instruction).
+ */
+uint32_t crc32c_generic(void const *data, size_t len) {
+    pthread_once(&crc_once, crc32c_setup);
+    return ~crc32c_sw(~0u, data, len);
+}
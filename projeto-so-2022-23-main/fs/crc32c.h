@@ -0,0 +1,15 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32C (Castagnoli), as used by iSCSI and ext4, computed with the SSE4.2
+ * crc32 instruction when the CPU has it, and with a lookup table otherwise.
+ */
+
+uint32_t crc32c(void const *data, size_t len);
+uint32_t crc32c_generic(void const *data, size_t len);
+
+#endif // CRC32C_H
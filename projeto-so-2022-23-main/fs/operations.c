@@ -1,11 +1,20 @@
 #include "operations.h"
 #include "config.h"
 #include "state.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "betterassert.h"
 
@@ -23,9 +32,8 @@ tfs_params tfs_default_params() {
     return params;
 }
 
-tfs_params params;
-
 int tfs_init(tfs_params const *params_ptr) {
+    tfs_params params;
     if (params_ptr != NULL) {
         params = *params_ptr;
     } else {
@@ -53,6 +61,10 @@ int tfs_destroy() {
     return 0;
 }
 
+int tfs_reset(void) { return state_reset(); }
+
+void tfs_get_stats(tfs_stats_t *stats) { state_get_stats(stats); }
+
 static bool valid_pathname(char const *name) {
     return name != NULL && strlen(name) > 1 && strlen(name) + 1 <= MAX_FILE_NAME && name[0] == '/';
 }
@@ -68,7 +80,7 @@ static bool valid_pathname(char const *name) {
  *   - root_inode: the root directory inode
  * Returns the inumber of the file, -1 if unsuccessful.
  */
-static int tfs_lookup(char const *name, inode_t const *root_inode) {
+static int tfs_lookup(char const *name, inode_t *root_inode) {
     // TODO: assert that root_inode is the root directory
     if (!valid_pathname(name)) {
         return -1;
@@ -80,6 +92,86 @@ static int tfs_lookup(char const *name, inode_t const *root_inode) {
     return find_in_dir(root_inode, name);
 }
 
+/**
+ * Reads the target path of a symbolic link.
+ *
+ * Input:
+ *   - inum: inumber of the symlink
+ *   - path: where to store the target path (MAX_FILE_NAME bytes)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Inode became invalid during the wait
+ *   - Inode is no longer a symlink
+ */
+static int read_symlink(int inum, char *path) {
+    inode_t *inode = inode_get(inum);
+
+    SCOPED_RWLOCK_R(inode->rwlock);
+    // Make sure that during the wait the inode hasnt become invalid
+    if (!is_inum_taken(inum) || inode_get_type(inode) != T_SYMLINK) {
+        return -1;
+    }
+
+    void *block = data_block_get(inode_get_data_block(inode));
+    if (block == NULL) {
+        return -1; // corrupted
+    }
+    size_t len = min(inode_get_size(inode), MAX_FILE_NAME);
+    memcpy(path, block, len);
+    path[MAX_FILE_NAME - 1] = '\0';
+    return 0;
+}
+
+/**
+ * Resolves a symbolic link, following chains of symlinks.
+ *
+ * Input:
+ *   - inum: inumber of the symlink
+ *   - path: where to store the last target path that was looked up
+ *     (MAX_FILE_NAME bytes), so that a dangling link can still be used to
+ *     create its target
+ *
+ * Returns the inumber of the file the link resolves to, or -1 if some target
+ * doesn't exist (path is set) or can't be resolved (path is empty).
+ *
+ * Possible errors:
+ *   - Dangling link
+ *   - More than MAX_SYMLINK_HOPS links followed (e.g. a loop of links)
+ */
+static int resolve_symlink(int inum, char *path) {
+    path[0] = '\0';
+
+    int cached = symlink_cache_get(inum);
+    if (cached != -1) {
+        return cached;
+    }
+
+    uint32_t generation = namespace_generation();
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    int link_inum = inum;
+    for (int hops = 0; hops < MAX_SYMLINK_HOPS; hops++) {
+        if (read_symlink(inum, path) == -1) {
+            path[0] = '\0';
+            return -1;
+        }
+
+        inum = tfs_lookup(path, root_dir_inode);
+        if (inum == -1) {
+            return -1; // dangling link
+        }
+
+        if (inode_get_type(inode_get(inum)) != T_SYMLINK) {
+            symlink_cache_set(link_inum, inum, generation);
+            return inum;
+        }
+    }
+
+    path[0] = '\0';
+    return -1; // too many levels of symbolic links
+}
+
 int tfs_open(char const *name, tfs_file_mode_t mode) {
     // Checks if the path name is valid
     if (!valid_pathname(name)) {
@@ -92,34 +184,32 @@ int tfs_open(char const *name, tfs_file_mode_t mode) {
     int inum = tfs_lookup(name, root_dir_inode);
     size_t offset;
 
+    char target[MAX_FILE_NAME];
+    if (inum >= 0 && inode_get_type(inode_get(inum)) == T_SYMLINK) {
+        inum = resolve_symlink(inum, target);
+        if (inum == -1) {
+            if (target[0] == '\0') {
+                return -1;
+            }
+            // Dangling link: open (and maybe create) its target instead
+            name = target;
+        }
+    }
+
     if (inum >= 0) {
         // The file already exists
         inode_t* inode = inode_get(inum);
         ALWAYS_ASSERT(inode != NULL,
                       "tfs_open: directory files must have an inode");
 
-        if(inode->i_node_type == T_SYMLINK){
-            SCOPED_RWLOCK_W(inode->rwlock);
-            // Make sure that during the wait the inode hasnt become invalid
-            if(!is_inum_taken(inum)) return -1;
-
-            void *block = data_block_get(inode->i_data_block);
-            char path[MAX_FILE_NAME];
-            memset(path,0,MAX_FILE_NAME);
-            memcpy(path, block, inode->i_size);
-
-            return tfs_open(path, mode);
-        }
         // Truncate (if requested)
         if (mode & TFS_O_TRUNC) {
-            if (inode->i_size > 0) {
-                data_block_free(inode->i_data_block);
-                inode->i_size = 0;
-            }
+            SCOPED_RWLOCK_W(inode->rwlock);
+            inode_truncate(inode);
         }
         // Determine initial offset
         if (mode & TFS_O_APPEND) {
-            offset = inode->i_size;
+            offset = inode_get_size(inode);
         } else {
             offset = 0;
         }
@@ -190,7 +280,7 @@ int tfs_sym_link(char const *target, char const *link_name) {
     if(!is_inum_taken(inum_sym)) return -1;
 
     // Determine how many bytes to write
-    size_t block_size = strlen(link_name)+1;
+    size_t block_size = strlen(target)+1;
     
     int bnum = data_block_alloc();
     if (bnum == -1) {
@@ -198,13 +288,14 @@ int tfs_sym_link(char const *target, char const *link_name) {
         return -1; // no space
     }
 
-    sym_inode->i_data_block = bnum;
+    inode_set_data_block(sym_inode, bnum);
 
-    void *block = data_block_get(sym_inode->i_data_block);
+    void *block = data_block_get_for_write(bnum);
 
     memcpy(block, target, block_size);
+    data_block_written(bnum);
 
-    sym_inode->i_size = block_size;
+    inode_set_size(sym_inode, block_size);
 
     int dir_entry = add_dir_entry(root_dir_inode,link_name+1,inum_sym);
 
@@ -244,7 +335,7 @@ int tfs_link(char const *target, char const *link_name) {
     // Make sure that during the wait the inode hasnt become invalid
     if(!is_inum_taken(inum)) return -1;
 
-    if(target_inode->i_node_type==T_SYMLINK){
+    if(inode_get_type(target_inode)==T_SYMLINK){
         return -1;
     }
     target_inode->hard_links ++;
@@ -257,26 +348,68 @@ int tfs_link(char const *target, char const *link_name) {
 
 int tfs_close(int fhandle) {
     open_file_entry_t *file = get_open_file_entry(fhandle);
-    SCOPED_LOCK(file->mtx);
     if (file == NULL) {
         return -1; // invalid fd
     }
+    SCOPED_LOCK(file->mtx);
 
+    if (file->of_snapshot) {
+        snapshot_release();
+    }
     file->of_inumber = -1;
     remove_from_open_file_table(fhandle);
 
     return 0;
 }
 
+/**
+ * Total length of the buffers of an iovec array.
+ *
+ * Returns the total length, or -1 if the array is invalid.
+ */
+static ssize_t iov_total_len(struct iovec const *iov, int iovcnt) {
+    if (iovcnt < 0 || (iovcnt > 0 && iov == NULL)) {
+        return -1;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len > (size_t)SSIZE_MAX - total) {
+            return -1; // overflow
+        }
+        total += iov[i].iov_len;
+    }
+    return (ssize_t)total;
+}
+
 ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
-    open_file_entry_t *file = get_open_file_entry(fhandle);
-    if (file == NULL) {
+    struct iovec iov = {.iov_base = (void *)buffer, .iov_len = to_write};
+    return tfs_writev(fhandle, &iov, 1);
+}
+
+/*
+ * Writes to an open file, deduplicating its block afterwards if requested
+ * (and enabled, see inode_dedup).
+ */
+static ssize_t file_writev(int fhandle, struct iovec const *iov, int iovcnt,
+                           bool dedup) {
+    ssize_t total = iov_total_len(iov, iovcnt);
+    if (total == -1) {
         return -1;
     }
+    size_t to_write = (size_t)total;
+
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || file->of_snapshot) {
+        return -1; // invalid or read-only handle
+    }
 
     //  From the open file table entry, we get the inode
     inode_t *inode = inode_get(file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_write: inode of open file deleted");
+    if (inode_get_type(inode) == T_DIRECTORY) {
+        return -1; // directory handle
+    }
     SCOPED_RWLOCK_W(inode->rwlock);
     // Make sure that during the wait the inode hasnt become invalid
     if(!is_inum_taken(file->of_inumber)) return -1;
@@ -288,33 +421,51 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t to_write) {
     }
 
     if (to_write > 0) {
-        if (inode->i_size == 0) {
-            // If empty file, allocate new block
-            int bnum = data_block_alloc();
-            if (bnum == -1) {
-                return -1; // no space
-            }
-
-            inode->i_data_block = bnum;
+        // Allocates the block of empty files, and copies shared blocks
+        void *block = inode_writable_block(inode);
+        if (block == NULL) {
+            return -1; // no space
         }
 
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_write: data block deleted mid-write");
-
-        // Perform the actual write
-        memcpy(block + file->of_offset, buffer, to_write);
+        // Perform the actual write, one buffer at a time
+        size_t written = 0;
+        for (int i = 0; written < to_write; i++) {
+            size_t len = min(iov[i].iov_len, to_write - written);
+            memcpy(block + file->of_offset + written, iov[i].iov_base, len);
+            written += len;
+        }
+        data_block_written(inode_get_data_block(inode));
 
         // The offset associated with the file handle is incremented accordingly
         file->of_offset += to_write;
-        if (file->of_offset > inode->i_size) {
-            inode->i_size = file->of_offset;
+        if (file->of_offset > inode_get_size(inode)) {
+            inode_set_size(inode, file->of_offset);
+        }
+
+        if (dedup) {
+            inode_dedup(inode);
         }
     }
 
     return (ssize_t)to_write;
 }
 
+ssize_t tfs_writev(int fhandle, struct iovec const *iov, int iovcnt) {
+    return file_writev(fhandle, iov, iovcnt, true);
+}
+
 ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
+    struct iovec iov = {.iov_base = buffer, .iov_len = len};
+    return tfs_readv(fhandle, &iov, 1);
+}
+
+ssize_t tfs_readv(int fhandle, struct iovec const *iov, int iovcnt) {
+    ssize_t total = iov_total_len(iov, iovcnt);
+    if (total == -1) {
+        return -1;
+    }
+    size_t len = (size_t)total;
+
     open_file_entry_t *file = get_open_file_entry(fhandle);
     if (file == NULL) {
         return -1;
@@ -323,121 +474,1841 @@ ssize_t tfs_read(int fhandle, void *buffer, size_t len) {
     // From the open file table entry, we get the inode
     inode_t* inode = inode_get(file->of_inumber);
     ALWAYS_ASSERT(inode != NULL, "tfs_read: inode of open file deleted");
+    if (inode_get_type(inode) == T_DIRECTORY) {
+        return -1; // directory handle
+    }
 
     SCOPED_RWLOCK_R(inode->rwlock);
 
-    size_t offset, to_read;
+    size_t offset, to_read, size;
+    int block_number;
     {
         SCOPED_LOCK(file->mtx);
-        // Make sure that during the wait the inode hasnt become invalid
-        if(!is_inum_taken(file->of_inumber)) return -1;
+        if (file->of_snapshot) {
+            // The file as of the snapshot
+            inode_type type;
+            if (snapshot_inode_get(file->of_inumber, &type, &size,
+                                   &block_number) == -1) {
+                return -1;
+            }
+        } else {
+            // Make sure that during the wait the inode hasnt become invalid
+            if(!is_inum_taken(file->of_inumber)) return -1;
+            size = inode_get_size(inode);
+            block_number = inode_get_data_block(inode);
+        }
         // Determine how many bytes to read
         offset = file->of_offset;
-        to_read = min(inode->i_size - file->of_offset, len);
+        to_read = min(size - file->of_offset, len);
         // The offset associated with the file handle is incremented accordingly
         file->of_offset += to_read;
     }
 
     if (to_read > 0) {
-        void *block = data_block_get(inode->i_data_block);
-        ALWAYS_ASSERT(block != NULL, "tfs_read: data block deleted mid-read");
+        void *block = data_block_get(block_number);
+        if (block == NULL) {
+            return -1; // corrupted
+        }
 
-        // Perform the actual read
-        memcpy(buffer, block + offset, to_read);
+        // Perform the actual read, one buffer at a time
+        size_t read = 0;
+        for (int i = 0; read < to_read; i++) {
+            size_t n = min(iov[i].iov_len, to_read - read);
+            memcpy(iov[i].iov_base, block + offset + read, n);
+            read += n;
+        }
     }
 
     return (ssize_t)to_read;
 }
 
-/**
- * Erases files and links
- *
- * Input:
- *   - target: file or link path to erase
- *
- * Returns 0 if successful, -1 otherwise.
- *
- * Possible errors:
- *   - File or link was not found in the directory
- *   - The file is opened
- *   - Inode became invalid during the wait
- */
-int tfs_unlink(char const *target) {
-    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
-    int inum = tfs_lookup(target, root_dir_inode);
-    if(inum == -1){
+int tfs_clone(char const *source, char const *dest) {
+    if (!valid_pathname(dest)) {
         return -1;
     }
-    if(is_file_open(inum)==true){
+
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    int src_inum = tfs_lookup(source, root_dir_inode);
+    if (src_inum >= 0 && inode_get_type(inode_get(src_inum)) == T_SYMLINK) {
+        char target[MAX_FILE_NAME];
+        src_inum = resolve_symlink(src_inum, target);
+    }
+    if (src_inum == -1 || tfs_lookup(dest, root_dir_inode) != -1) {
+        return -1; // no source, or destination already exists
+    }
+
+    int dst_inum = inode_create(T_FILE);
+    if (dst_inum == -1) {
+        return -1; // no space in inode table
+    }
+
+    {
+        inode_t *src = inode_get(src_inum);
+        inode_t *dst = inode_get(dst_inum);
+        // The clone isn't in any directory yet, so only the source's lock is
+        // needed
+        SCOPED_RWLOCK_R(src->rwlock);
+        // Make sure that during the wait the inode hasnt become invalid
+        if (!is_inum_taken(src_inum)) {
+            inode_delete(dst_inum);
+            return -1;
+        }
+
+        // Share the source's data block
+        if (inode_get_size(src) > 0) {
+            data_block_ref(inode_get_data_block(src));
+            inode_set_data_block(dst, inode_get_data_block(src));
+            inode_set_size(dst, inode_get_size(src));
+        }
+    }
+
+    if (add_dir_entry(root_dir_inode, dest + 1, dst_inum) == -1) {
+        inode_delete(dst_inum);
+        return -1; // no space in directory
+    }
+
+    return 0;
+}
+
+int tfs_mark_cold(char const *name) {
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    int inum = tfs_lookup(name, root_dir_inode);
+    if (inum >= 0 && inode_get_type(inode_get(inum)) == T_SYMLINK) {
+        char target[MAX_FILE_NAME];
+        inum = resolve_symlink(inum, target);
+    }
+    if (inum == -1) {
         return -1;
     }
+
     inode_t *inode = inode_get(inum);
+    if (inode_get_type(inode) != T_FILE) {
+        return -1;
+    }
 
     SCOPED_RWLOCK_W(inode->rwlock);
     // Make sure that during the wait the inode hasnt become invalid
-    if(!is_inum_taken(inum)) return -1;
-    
-    inode->hard_links--;
-
-    if(inode->hard_links == 0){
-        inode_delete(inum);
+    if (!is_inum_taken(inum)) {
+        return -1;
+    }
+    if (inode_get_size(inode) == 0) {
+        return 0; // nothing to compress
     }
 
-    int clear_dir = clear_dir_entry(root_dir_inode, target+1);
-    ALWAYS_ASSERT(clear_dir!=-1, "clear_dir_entry");
-    return 0;
+    return data_block_compress(inode_get_data_block(inode),
+                               inode_get_size(inode)) == -1
+               ? -1
+               : 0;
 }
 
 /**
- * Imports the contents of an external file to a file inside of TecnicoFS
- *
- * Input:
- *   - source_path: source file path
- *   - dest_path: destination file path
- *
- * Returns 0 if successful, -1 otherwise.
+ * Copies a range of bytes between two inodes, whose locks are already held
+ * (see tfs_copy_file_range).
  *
- * Possible errors:
- *   - Unvalid destination path name
- *   - Error opening or creating both files
- *   - Error writting the information
+ * Returns the number of bytes that were copied, or -1 in case of error.
  */
-int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
-    
-    char buffer[BUFFER_SIZE];
-    memset(buffer,0,BUFFER_SIZE);
-    FILE *source_file;
-    size_t bytes;
-    ssize_t write;
+static ssize_t copy_range_locked(int src_inum, size_t src_offset, int dst_inum,
+                                 size_t dst_offset, size_t len) {
+    // Make sure that during the wait the inodes havent become invalid
+    if (!is_inum_taken(src_inum) || !is_inum_taken(dst_inum)) {
+        return -1;
+    }
 
-    if(!valid_pathname(dest_path)){
+    inode_t *src = inode_get(src_inum);
+    inode_t *dst = inode_get(dst_inum);
+    size_t src_size = inode_get_size(src);
+    if (src_offset > src_size || dst_offset > inode_get_size(dst)) {
         return -1;
     }
 
-    source_file = fopen (source_path, "r");
-    if(source_file == NULL){
+    // Determine how many bytes to copy
+    size_t to_copy = min(len, src_size - src_offset);
+    to_copy = min(to_copy, state_block_size() - dst_offset);
+    if (to_copy == 0) {
+        return 0;
+    }
+
+    // Allocates the destination block if needed (or copies it if shared).
+    // That may free the block the source was read from, so within a file the
+    // source is the destination's new block, and otherwise the source block
+    // is held until the copy is done
+    char const *src_block;
+    char *dst_block;
+    int held = -1;
+    if (src_inum == dst_inum) {
+        dst_block = inode_writable_block(dst);
+        src_block = dst_block;
+    } else {
+        held = inode_get_data_block(src);
+        data_block_ref(held);
+        src_block = data_block_get(held);
+        dst_block = src_block != NULL ? inode_writable_block(dst) : NULL;
+    }
+    if (src_block == NULL || dst_block == NULL) {
+        if (held != -1) {
+            data_block_free(held);
+        }
+        return -1; // corrupted, or no space
+    }
+
+    // Block to block copy (the ranges may overlap if src == dst)
+    memmove(dst_block + dst_offset, src_block + src_offset, to_copy);
+    data_block_written(inode_get_data_block(dst));
+    if (held != -1) {
+        data_block_free(held);
+    }
+
+    if (dst_offset + to_copy > inode_get_size(dst)) {
+        inode_set_size(dst, dst_offset + to_copy);
+    }
+
+    return (ssize_t)to_copy;
+}
+
+ssize_t tfs_copy_file_range(int src_fhandle, size_t src_offset,
+                            int dst_fhandle, size_t dst_offset, size_t len) {
+    open_file_entry_t *src_file = get_open_file_entry(src_fhandle);
+    open_file_entry_t *dst_file = get_open_file_entry(dst_fhandle);
+    if (src_file == NULL || dst_file == NULL || src_file->of_snapshot ||
+        dst_file->of_snapshot) {
         return -1;
     }
 
-    int fhandle = tfs_open(dest_path, TFS_O_CREAT | TFS_O_TRUNC);
-    if(fhandle == -1){
-        ALWAYS_ASSERT(fclose(source_file) == 0, "fclose");
+    int src_inum = src_file->of_inumber;
+    int dst_inum = dst_file->of_inumber;
+    inode_t *src = inode_get(src_inum);
+    inode_t *dst = inode_get(dst_inum);
+    if (inode_get_type(src) == T_DIRECTORY ||
+        inode_get_type(dst) == T_DIRECTORY) {
+        return -1; // directory handle
+    }
+
+    if (src_inum == dst_inum) {
+        SCOPED_RWLOCK_W(dst->rwlock);
+        return copy_range_locked(src_inum, src_offset, dst_inum, dst_offset,
+                                 len);
+    }
+
+    // Lock both inodes in inumber order, so that concurrent copies in
+    // opposite directions can't deadlock
+    if (src_inum < dst_inum) {
+        pthread_rwlock_rdlock(&src->rwlock);
+        pthread_rwlock_wrlock(&dst->rwlock);
+    } else {
+        pthread_rwlock_wrlock(&dst->rwlock);
+        pthread_rwlock_rdlock(&src->rwlock);
+    }
+
+    ssize_t copied =
+        copy_range_locked(src_inum, src_offset, dst_inum, dst_offset, len);
+
+    pthread_rwlock_unlock(&src->rwlock);
+    pthread_rwlock_unlock(&dst->rwlock);
+    return copied;
+}
+
+int tfs_read_view(int fhandle, size_t offset, size_t len, tfs_view_t *view) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    if (file == NULL || file->of_snapshot || view == NULL) {
         return -1;
     }
 
-    bytes = fread(buffer, 1, BUFFER_SIZE, source_file);
-    while(bytes > 0){
-        write = tfs_write(fhandle, buffer, bytes);
-        if(write != bytes){
-                ALWAYS_ASSERT(fclose(source_file) == 0, "fclose");
-                ALWAYS_ASSERT(tfs_close(fhandle) == 0, "tfs_close"); 
-            return -1;
+    int inum = file->of_inumber;
+    inode_t *inode = inode_get(inum);
+    ALWAYS_ASSERT(inode != NULL, "tfs_read_view: inode of open file deleted");
+    if (inode_get_type(inode) == T_DIRECTORY) {
+        return -1; // directory handle
+    }
+
+    // The read lock is the lease: it is only released by tfs_release_view
+    pthread_rwlock_rdlock(&inode->rwlock);
+    // Make sure that during the wait the inode hasnt become invalid
+    if (!is_inum_taken(inum) || offset > inode_get_size(inode)) {
+        pthread_rwlock_unlock(&inode->rwlock);
+        return -1;
+    }
+
+    view->len = min(inode_get_size(inode) - offset, len);
+    view->data = NULL;
+    if (view->len > 0) {
+        void *block = data_block_get(inode_get_data_block(inode));
+        if (block == NULL) {
+            pthread_rwlock_unlock(&inode->rwlock);
+            return -1; // corrupted
         }
+        view->data = (char const *)block + offset;
+    }
+    view->v_inumber = inum;
+
+    return 0;
+}
 
-        bytes = fread(buffer, 1, BUFFER_SIZE, source_file);
+int tfs_release_view(tfs_view_t *view) {
+    if (view == NULL || view->v_inumber < 0) {
+        return -1;
     }
 
-    ALWAYS_ASSERT(fclose(source_file) == 0, "fclose");
-    ALWAYS_ASSERT(tfs_close(fhandle) == 0, "tfs_close"); 
+    pthread_rwlock_unlock(&inode_get(view->v_inumber)->rwlock);
+    view->data = NULL;
+    view->len = 0;
+    view->v_inumber = -1;
+    return 0;
+}
+
+int tfs_snapshot_create(void) { return snapshot_create(); }
+
+int tfs_snapshot_destroy(void) { return snapshot_destroy(); }
+
+/*
+ * Reads the target of a symlink, as of the snapshot, into path (which must
+ * have room for MAX_FILE_NAME bytes).
+ * Returns 0 if successful, -1 if the inode was not a symlink.
+ */
+static int read_snapshot_symlink(int inum, char *path) {
+    inode_t *inode = inode_get(inum);
+
+    SCOPED_RWLOCK_R(inode->rwlock);
+    inode_type type;
+    size_t size;
+    int block;
+    if (snapshot_inode_get(inum, &type, &size, &block) == -1 ||
+        type != T_SYMLINK) {
+        return -1;
+    }
+
+    void const *contents = data_block_get(block);
+    if (contents == NULL) {
+        return -1; // corrupted
+    }
+    memcpy(path, contents, min(size, MAX_FILE_NAME));
+    path[MAX_FILE_NAME - 1] = '\0';
     return 0;
-}
\ No newline at end of file
+}
+
+/*
+ * Looks for a file in the snapshot's namespace, following symlinks (as they
+ * were in the snapshot).
+ * Returns the file's inumber, or -1 if it did not exist.
+ */
+static int snapshot_lookup(char const *name) {
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    char path[MAX_FILE_NAME];
+
+    int inum = snapshot_find_in_dir(root_dir_inode, name + 1);
+    for (int hops = 0; inum != -1 && hops <= MAX_SYMLINK_HOPS; hops++) {
+        if (read_snapshot_symlink(inum, path) == -1) {
+            return inum; // not a symlink
+        }
+        if (!valid_pathname(path)) {
+            return -1;
+        }
+        inum = snapshot_find_in_dir(root_dir_inode, path + 1);
+    }
+    return -1; // missing, or too many levels of symbolic links
+}
+
+int tfs_snapshot_open(char const *name) {
+    if (!valid_pathname(name)) {
+        return -1;
+    }
+
+    // The snapshot can't be discarded while the handle is open
+    if (snapshot_acquire() == -1) {
+        return -1; // no snapshot
+    }
+
+    int inum = snapshot_lookup(name);
+    int fhandle = inum == -1 ? -1 : add_to_open_file_table(inum, 0);
+    if (fhandle == -1) {
+        snapshot_release();
+        return -1;
+    }
+
+    get_open_file_entry(fhandle)->of_snapshot = true;
+    return fhandle;
+}
+
+int tfs_opendir(char const *path) {
+    // Only the root directory exists
+    if (path == NULL || strcmp(path, "/") != 0) {
+        return -1;
+    }
+
+    // The offset of a directory handle is the directory slot where the next
+    // tfs_readdir_batch resumes
+    return add_to_open_file_table(ROOT_DIR_INUM, 0);
+}
+
+ssize_t tfs_readdir_batch(int dhandle, tfs_dirent_t *entries,
+                          size_t max_entries) {
+    open_file_entry_t *dir = get_open_file_entry(dhandle);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    inode_t *inode = inode_get(dir->of_inumber);
+    if (inode_get_type(inode) != T_DIRECTORY) {
+        return -1; // not a directory handle
+    }
+
+    SCOPED_LOCK(dir->mtx);
+    return (ssize_t)dir_read_entries(inode, &dir->of_offset, entries,
+                                     max_entries);
+}
+
+int tfs_closedir(int dhandle) {
+    open_file_entry_t *dir = get_open_file_entry(dhandle);
+    if (dir == NULL) {
+        return -1;
+    }
+
+    if (inode_get_type(inode_get(dir->of_inumber)) != T_DIRECTORY) {
+        return -1; // not a directory handle
+    }
+
+    return tfs_close(dhandle);
+}
+
+ssize_t tfs_list_prefix(char const *dir, char const *prefix,
+                        tfs_dirent_callback_t cb, void *arg) {
+    // Only the root directory exists
+    if (dir == NULL || strcmp(dir, "/") != 0 || prefix == NULL || cb == NULL) {
+        return -1;
+    }
+
+    return dir_list_prefix(inode_get(ROOT_DIR_INUM), prefix, cb, arg);
+}
+
+ssize_t tfs_fsck(tfs_fsck_report_t *report, int thread_count) {
+    if (report == NULL || thread_count <= 0) {
+        return -1;
+    }
+    return state_fsck(report, (size_t)thread_count);
+}
+
+/**
+ * Erases files and links
+ *
+ * Input:
+ *   - target: file or link path to erase
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - File or link was not found in the directory
+ *   - The file is opened
+ *   - Inode became invalid during the wait
+ */
+int tfs_unlink(char const *target) {
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    int inum = tfs_lookup(target, root_dir_inode);
+    if(inum == -1){
+        return -1;
+    }
+    if(is_file_open(inum)==true){
+        return -1;
+    }
+    inode_t *inode = inode_get(inum);
+
+    SCOPED_RWLOCK_W(inode->rwlock);
+    // Make sure that during the wait the inode hasnt become invalid
+    if(!is_inum_taken(inum)) return -1;
+
+    // Remove the name first: it can fail if the directory block has to be
+    // copied (it is shared with the snapshot) and there is no space
+    if (clear_dir_entry(root_dir_inode, target+1) == -1) {
+        return -1;
+    }
+
+    inode->hard_links--;
+
+    if(inode->hard_links == 0){
+        inode_delete(inum);
+    }
+    return 0;
+}
+
+/*
+ * Host file being imported, read one chunk at a time into two alternating
+ * buffers: while one is written to TecnicoFS, the other is being filled.
+ */
+typedef struct {
+    int fd;
+    size_t limit; // bytes to read at most
+    size_t chunk_size;
+    char *buffers[2];
+    size_t lens[2];
+    bool full[2];
+    bool last[2];
+    bool failed;
+    bool cancelled;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} import_t;
+
+/*
+ * Reads up to len bytes at the given offset, stopping short only at the end
+ * of the file. Returns the number of bytes read, or -1 on error.
+ */
+static ssize_t pread_full(int fd, char *buffer, size_t len, off_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, buffer + done, len - done, offset + (off_t)done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+static void *import_reader(void *arg) {
+    import_t *import = arg;
+    size_t offset = 0;
+    for (int i = 0;; i ^= 1) {
+        {
+            SCOPED_LOCK(import->mutex);
+            while (import->full[i] && !import->cancelled) {
+                pthread_cond_wait(&import->cond, &import->mutex);
+            }
+            if (import->cancelled) {
+                return NULL;
+            }
+        }
+
+        size_t len = min(import->chunk_size, import->limit - offset);
+        ssize_t n = pread_full(import->fd, import->buffers[i], len,
+                               (off_t)offset);
+        offset += n == -1 ? 0 : (size_t)n;
+        bool last = n == -1 || (size_t)n < len || offset == import->limit;
+
+        SCOPED_LOCK(import->mutex);
+        import->lens[i] = n == -1 ? 0 : (size_t)n;
+        import->failed = n == -1;
+        import->last[i] = last;
+        import->full[i] = true;
+        pthread_cond_broadcast(&import->cond);
+        if (last) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Copies the chunks read by import_reader to the (empty) file, in order. The
+ * file stays locked until the end, so the block is written, and its checksum
+ * computed, only once.
+ * Returns 0 if the whole file was written, -1 otherwise.
+ */
+static int import_writer(import_t *import, int inumber) {
+    inode_t *inode = inode_get(inumber);
+    SCOPED_RWLOCK_W(inode->rwlock);
+    if (!is_inum_taken(inumber)) {
+        return -1;
+    }
+
+    size_t block_size = state_block_size();
+    char *block = NULL;
+    size_t size = 0;
+    int result = -1;
+    for (int i = 0;; i ^= 1) {
+        size_t len;
+        bool last;
+        {
+            SCOPED_LOCK(import->mutex);
+            while (!import->full[i]) {
+                pthread_cond_wait(&import->cond, &import->mutex);
+            }
+            if (import->failed) {
+                break;
+            }
+            len = import->lens[i];
+            last = import->last[i];
+        }
+
+        if (len > 0) {
+            if (block == NULL) {
+                block = inode_writable_block(inode);
+                if (block == NULL) {
+                    break; // no space
+                }
+            }
+            size_t to_copy = min(len, block_size - size);
+            memcpy(block + size, import->buffers[i], to_copy);
+            size += to_copy;
+            if (to_copy < len) {
+                break; // larger than a block
+            }
+        }
+        if (last) {
+            result = 0;
+            break;
+        }
+
+        SCOPED_LOCK(import->mutex);
+        import->full[i] = false;
+        pthread_cond_broadcast(&import->cond);
+    }
+
+    if (block != NULL) {
+        data_block_written(inode_get_data_block(inode));
+        inode_set_size(inode, size);
+    }
+    return result;
+}
+
+/*
+ * Imports the contents of an open host file to an empty file (see
+ * tfs_copy_from_external_fs).
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int import_fd(int source_fd, int inumber) {
+    // One byte more than fits in a block is enough to tell that the file is
+    // too large (its first block_size bytes are still imported)
+    import_t import = {
+        .fd = source_fd,
+        .limit = state_block_size() + 1,
+    };
+    import.chunk_size = min(import.limit, (size_t)IMPORT_CHUNK_SIZE);
+    import.buffers[0] = malloc(2 * import.chunk_size);
+    ALWAYS_ASSERT(import.buffers[0] != NULL, "import_fd: malloc");
+    import.buffers[1] = import.buffers[0] + import.chunk_size;
+    ALWAYS_ASSERT(pthread_mutex_init(&import.mutex, NULL) == 0,
+                  "pthread_mutex_init");
+    ALWAYS_ASSERT(pthread_cond_init(&import.cond, NULL) == 0,
+                  "pthread_cond_init");
+
+    // Files that fit in a single chunk don't need the helper thread
+    int result;
+    if (import.limit <= import.chunk_size) {
+        import_reader(&import);
+        result = import_writer(&import, inumber);
+    } else {
+        pthread_t reader;
+        ALWAYS_ASSERT(
+            pthread_create(&reader, NULL, import_reader, &import) == 0,
+            "pthread_create");
+        result = import_writer(&import, inumber);
+        {
+            SCOPED_LOCK(import.mutex);
+            import.cancelled = true;
+            pthread_cond_broadcast(&import.cond);
+        }
+        ALWAYS_ASSERT(pthread_join(reader, NULL) == 0, "pthread_join");
+    }
+
+    // The file is only deduplicated once complete
+    if (result == 0) {
+        inode_t *inode = inode_get(inumber);
+        SCOPED_RWLOCK_W(inode->rwlock);
+        inode_dedup(inode);
+    }
+
+    ALWAYS_ASSERT(pthread_cond_destroy(&import.cond) == 0,
+                  "pthread_cond_destroy");
+    ALWAYS_ASSERT(pthread_mutex_destroy(&import.mutex) == 0,
+                  "pthread_mutex_destroy");
+    free(import.buffers[0]);
+    return result;
+}
+
+/**
+ * Imports the contents of an external file to a file inside of TecnicoFS
+ *
+ * Input:
+ *   - source_path: source file path
+ *   - dest_path: destination file path
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Unvalid destination path name
+ *   - Error opening or creating both files
+ *   - Error writting the information
+ */
+int tfs_copy_from_external_fs(char const *source_path, char const *dest_path) {
+    if(!valid_pathname(dest_path)){
+        return -1;
+    }
+
+    int source_fd = open(source_path, O_RDONLY);
+    if(source_fd == -1){
+        return -1;
+    }
+
+    int fhandle = tfs_open(dest_path, TFS_O_CREAT | TFS_O_TRUNC);
+    if(fhandle == -1){
+        ALWAYS_ASSERT(close(source_fd) == 0, "close");
+        return -1;
+    }
+
+    int result = import_fd(source_fd, get_open_file_entry(fhandle)->of_inumber);
+
+    ALWAYS_ASSERT(close(source_fd) == 0, "close");
+    ALWAYS_ASSERT(tfs_close(fhandle) == 0, "tfs_close"); 
+    return result;
+}
+
+int tfs_map_from_external_fs(char const *source_path, char const *dest_path) {
+    if (!valid_pathname(dest_path)) {
+        return -1;
+    }
+
+    int source_fd = open(source_path, O_RDONLY);
+    if (source_fd == -1) {
+        return -1;
+    }
+
+    // Only files that fit in a block can be mapped
+    struct stat st;
+    if (fstat(source_fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+        (size_t)st.st_size > state_block_size()) {
+        ALWAYS_ASSERT(close(source_fd) == 0, "close");
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+
+    int fhandle = tfs_open(dest_path, TFS_O_CREAT | TFS_O_TRUNC);
+    if (fhandle == -1) {
+        ALWAYS_ASSERT(close(source_fd) == 0, "close");
+        return -1;
+    }
+
+    int result = 0;
+    if (size > 0) {
+        // The mapping outlives the host file descriptor
+        int block_number = data_block_map(source_fd, size);
+        int inum = get_open_file_entry(fhandle)->of_inumber;
+        inode_t *inode = inode_get(inum);
+        SCOPED_RWLOCK_W(inode->rwlock);
+        if (block_number == -1) {
+            result = -1;
+        } else if (!is_inum_taken(inum) || inode_get_size(inode) > 0) {
+            data_block_free(block_number); // removed or written meanwhile
+            result = -1;
+        } else {
+            inode_set_data_block(inode, block_number);
+            inode_set_size(inode, size);
+        }
+    }
+
+    ALWAYS_ASSERT(close(source_fd) == 0, "close");
+    ALWAYS_ASSERT(tfs_close(fhandle) == 0, "tfs_close");
+    return result;
+}
+
+/*
+ * Writes the whole buffer to a host file, retrying after partial writes.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int write_full(int fd, char const *buffer, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, buffer + done, len - done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/*
+ * Writes the contents of an open file to a host file, straight from its data
+ * block, which stays read-locked only while it is being written.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int export_file(int fhandle, int fd) {
+    open_file_entry_t *file = get_open_file_entry(fhandle);
+    inode_t *inode = inode_get(file->of_inumber);
+    SCOPED_RWLOCK_R(inode->rwlock);
+    if (!is_inum_taken(file->of_inumber)) {
+        return -1;
+    }
+
+    size_t size = inode_get_size(inode);
+    if (size == 0) {
+        return 0;
+    }
+    char const *block = data_block_get(inode_get_data_block(inode));
+    if (block == NULL) {
+        return -1; // corrupted
+    }
+    return write_full(fd, block, size);
+}
+
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path) {
+    int fhandle = tfs_open(source_path, 0);
+    if (fhandle == -1) {
+        return -1;
+    }
+
+    int dest_fd = open(dest_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (dest_fd == -1) {
+        ALWAYS_ASSERT(tfs_close(fhandle) == 0, "tfs_close");
+        return -1;
+    }
+
+    int result = export_file(fhandle, dest_fd);
+    if (close(dest_fd) != 0) {
+        result = -1;
+    }
+    ALWAYS_ASSERT(tfs_close(fhandle) == 0, "tfs_close");
+    return result;
+}
+
+/*
+ * Host file to import with tfs_import_tree, and its name in TecnicoFS (its
+ * path relative to the imported directory, with '_' in place of '/').
+ */
+typedef struct {
+    char *host_path;
+    char name[MAX_FILE_NAME];
+    // the name fits, and no other file of the import has the same one
+    bool valid_name;
+    size_t size;
+} import_job_t;
+
+typedef struct import_worker {
+    tfs_ctx *ctx;
+    struct import_worker *workers;
+    size_t worker_count;
+    size_t index;
+    pthread_t thread;
+    import_job_t *jobs;
+    // jobs still to be done by this worker (others steal from the end)
+    pthread_mutex_t mutex;
+    size_t begin;
+    size_t end;
+    tfs_import_report_t report;
+} import_worker_t;
+
+typedef struct {
+    import_job_t *jobs;
+    size_t count;
+    size_t capacity;
+    size_t failed; // unreadable directories
+} import_job_list_t;
+
+static int import_job_add(import_job_list_t *list, char const *host_path,
+                          char const *relative_path, size_t size) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 64 : 2 * list->capacity;
+        import_job_t *jobs = realloc(list->jobs, capacity * sizeof(*jobs));
+        if (jobs == NULL) {
+            return -1;
+        }
+        list->jobs = jobs;
+        list->capacity = capacity;
+    }
+
+    import_job_t *job = &list->jobs[list->count];
+    job->host_path = strdup(host_path);
+    if (job->host_path == NULL) {
+        return -1;
+    }
+    // room for the leading '/' of its path, as in tar_tfs_path
+    job->valid_name = strlen(relative_path) + 2 <= MAX_FILE_NAME;
+    if (job->valid_name) {
+        size_t i = 0;
+        for (; relative_path[i] != '\0'; i++) {
+            job->name[i] = relative_path[i] == '/' ? '_' : relative_path[i];
+        }
+        job->name[i] = '\0';
+    }
+    job->size = size;
+    list->count++;
+    return 0;
+}
+
+/*
+ * Adds the regular files under a host directory to the list (symbolic links
+ * and other special files are skipped).
+ * Returns 0 if successful, -1 if out of memory.
+ */
+static int import_tree_walk(char const *path, size_t root_len,
+                            import_job_list_t *list) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        list->failed++;
+        return 0;
+    }
+
+    int result = 0;
+    struct dirent *entry;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 ||
+            strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        size_t len = strlen(path) + 1 + strlen(entry->d_name) + 1;
+        char *child = malloc(len);
+        if (child == NULL) {
+            result = -1;
+            break;
+        }
+        snprintf(child, len, "%s/%s", path, entry->d_name);
+
+        struct stat st;
+        if (lstat(child, &st) == -1) {
+            list->failed++;
+        } else if (S_ISDIR(st.st_mode)) {
+            result = import_tree_walk(child, root_len, list);
+        } else if (S_ISREG(st.st_mode)) {
+            result = import_job_add(list, child, child + root_len + 1,
+                                    (size_t)st.st_size);
+        }
+        free(child);
+    }
+
+    ALWAYS_ASSERT(closedir(dir) == 0, "closedir");
+    return result;
+}
+
+static int import_job_compare(void const *a, void const *b) {
+    import_job_t const *x = a;
+    import_job_t const *y = b;
+    if (x->valid_name != y->valid_name) {
+        return x->valid_name ? -1 : 1;
+    }
+    int c = x->valid_name ? strcmp(x->name, y->name) : 0;
+    return c != 0 ? c : strcmp(x->host_path, y->host_path);
+}
+
+/*
+ * Sorts the jobs by name, and leaves out all but the first (by host path) of
+ * the files with the same name.
+ */
+static void import_jobs_dedup_names(import_job_list_t *list) {
+    qsort(list->jobs, list->count, sizeof(import_job_t), import_job_compare);
+    for (size_t i = 1; i < list->count && list->jobs[i].valid_name; i++) {
+        if (strcmp(list->jobs[i].name, list->jobs[i - 1].name) == 0) {
+            list->jobs[i].valid_name = false;
+        }
+    }
+}
+
+/*
+ * Takes the next jobs of a worker, stealing half of the remaining jobs of
+ * another worker once it has none left.
+ * Returns the number of jobs taken (0 once all jobs are done).
+ */
+static size_t import_take(import_worker_t *w, size_t *first) {
+    for (;;) {
+        {
+            SCOPED_LOCK(w->mutex);
+            if (w->begin < w->end) {
+                size_t count = min(w->end - w->begin, (size_t)IMPORT_BATCH_SIZE);
+                *first = w->begin;
+                w->begin += count;
+                return count;
+            }
+        }
+
+        bool stolen = false;
+        for (size_t i = 1; i < w->worker_count && !stolen; i++) {
+            import_worker_t *victim =
+                &w->workers[(w->index + i) % w->worker_count];
+            size_t begin, end;
+            {
+                SCOPED_LOCK(victim->mutex);
+                size_t remaining = victim->end - victim->begin;
+                if (remaining == 0) {
+                    continue;
+                }
+                end = victim->end;
+                begin = end - (remaining + 1) / 2;
+                victim->end = begin;
+            }
+
+            SCOPED_LOCK(w->mutex);
+            w->begin = begin;
+            w->end = end;
+            stolen = true;
+        }
+        if (!stolen) {
+            return 0;
+        }
+    }
+}
+
+/*
+ * Imports a batch of files: new files get their inodes and directory entries
+ * allocated together, while existing files are overwritten one at a time.
+ */
+static void import_batch(import_worker_t *w, import_job_t *jobs, size_t count) {
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    import_job_t *new_jobs[IMPORT_BATCH_SIZE];
+    size_t new_count = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!jobs[i].valid_name) {
+            w->report.failed++; // name too long
+        } else if (find_in_dir(root_dir_inode, jobs[i].name) != -1) {
+            char path[MAX_FILE_NAME];
+            snprintf(path, sizeof(path), "/%s", jobs[i].name);
+            if (tfs_copy_from_external_fs(jobs[i].host_path, path) == 0) {
+                w->report.files++;
+                w->report.bytes += jobs[i].size;
+            } else {
+                w->report.failed++;
+            }
+        } else {
+            new_jobs[new_count++] = &jobs[i];
+        }
+    }
+
+    // The files are only named once their contents are in place
+    int inumbers[IMPORT_BATCH_SIZE];
+    size_t created = inode_create_batch(T_FILE, inumbers, new_count);
+    w->report.failed += new_count - created;
+    char const *names[IMPORT_BATCH_SIZE];
+    size_t sizes[IMPORT_BATCH_SIZE];
+    size_t ready = 0;
+    for (size_t i = 0; i < created; i++) {
+        int source_fd = open(new_jobs[i]->host_path, O_RDONLY);
+        int result = source_fd == -1 ? -1 : import_fd(source_fd, inumbers[i]);
+        if (source_fd != -1) {
+            ALWAYS_ASSERT(close(source_fd) == 0, "close");
+        }
+        if (result == -1) {
+            inode_delete(inumbers[i]);
+            w->report.failed++;
+            continue;
+        }
+        inumbers[ready] = inumbers[i];
+        names[ready] = new_jobs[i]->name;
+        sizes[ready] = new_jobs[i]->size;
+        ready++;
+    }
+
+    bool added[IMPORT_BATCH_SIZE];
+    ALWAYS_ASSERT(add_dir_entries(root_dir_inode, names, inumbers, added,
+                                  ready) != -1,
+                  "import_batch: root must be a directory");
+    for (size_t i = 0; i < ready; i++) {
+        if (added[i]) {
+            w->report.files++;
+            w->report.bytes += sizes[i];
+        } else {
+            inode_delete(inumbers[i]); // full directory, or a name clash
+            w->report.failed++;
+        }
+    }
+}
+
+static void *import_worker_main(void *arg) {
+    import_worker_t *w = arg;
+    SCOPED_CTX(w->ctx);
+    size_t first, count;
+    while ((count = import_take(w, &first)) > 0) {
+        import_batch(w, &w->jobs[first], count);
+    }
+    return NULL;
+}
+
+ssize_t tfs_import_tree(char const *host_dir, char const *tfs_dir,
+                        int thread_count, tfs_import_report_t *report) {
+    // Only the root directory exists
+    if (host_dir == NULL || tfs_dir == NULL || strcmp(tfs_dir, "/") != 0 ||
+        thread_count < 1) {
+        return -1;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct stat st;
+    if (stat(host_dir, &st) == -1 || !S_ISDIR(st.st_mode)) {
+        return -1;
+    }
+    import_job_list_t list = {0};
+    int result = import_tree_walk(host_dir, strlen(host_dir), &list);
+    if (result == 0) {
+        import_jobs_dedup_names(&list);
+    }
+
+    size_t worker_count = (size_t)thread_count;
+    import_worker_t *workers = calloc(worker_count, sizeof(import_worker_t));
+    if (result == 0 && workers != NULL) {
+        // Each worker starts with an equal share of the jobs
+        for (size_t i = 0; i < worker_count; i++) {
+            workers[i].ctx = state_current();
+            workers[i].workers = workers;
+            workers[i].worker_count = worker_count;
+            workers[i].index = i;
+            workers[i].jobs = list.jobs;
+            workers[i].begin = list.count * i / worker_count;
+            workers[i].end = list.count * (i + 1) / worker_count;
+            ALWAYS_ASSERT(pthread_mutex_init(&workers[i].mutex, NULL) == 0,
+                          "pthread_mutex_init");
+        }
+
+        // The calling thread is worker 0 (and if some threads can't be
+        // started, the others steal their jobs)
+        size_t started = 1;
+        for (; started < worker_count; started++) {
+            if (pthread_create(&workers[started].thread, NULL,
+                               import_worker_main, &workers[started]) != 0) {
+                break;
+            }
+        }
+        import_worker_main(&workers[0]);
+        for (size_t i = 1; i < started; i++) {
+            ALWAYS_ASSERT(pthread_join(workers[i].thread, NULL) == 0,
+                          "pthread_join");
+        }
+    }
+
+    tfs_import_report_t total = {.failed = list.failed};
+    for (size_t i = 0; workers != NULL && i < worker_count; i++) {
+        total.files += workers[i].report.files;
+        total.bytes += workers[i].report.bytes;
+        total.failed += workers[i].report.failed;
+        if (result == 0) {
+            ALWAYS_ASSERT(pthread_mutex_destroy(&workers[i].mutex) == 0,
+                          "pthread_mutex_destroy");
+        }
+    }
+    for (size_t i = 0; i < list.count; i++) {
+        free(list.jobs[i].host_path);
+    }
+    free(list.jobs);
+    free(workers);
+    if (result == -1 || workers == NULL) {
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    total.elapsed_ns = (size_t)(end.tv_sec - start.tv_sec) * 1000000000 +
+                       (size_t)end.tv_nsec - (size_t)start.tv_nsec;
+    if (report != NULL) {
+        *report = total;
+    }
+    return (ssize_t)total.files;
+}
+
+/*
+ * ustar archives (see tfs_import_tar and tfs_export_tar): a 512-byte header
+ * per entry, followed by its contents padded to a multiple of 512 bytes, and
+ * two zero blocks at the end.
+ */
+#define TAR_BLOCK_SIZE (512)
+
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} tar_header_t;
+
+_Static_assert(sizeof(tar_header_t) == TAR_BLOCK_SIZE, "tar_header_t size");
+
+static size_t tar_padding(size_t size) {
+    return (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+}
+
+static unsigned tar_checksum(tar_header_t const *header) {
+    unsigned char const *bytes = (unsigned char const *)header;
+    unsigned sum = 0;
+    for (size_t i = 0; i < sizeof(*header); i++) {
+        bool in_field = i >= offsetof(tar_header_t, checksum) &&
+                        i < offsetof(tar_header_t, checksum) +
+                                sizeof(header->checksum);
+        sum += in_field ? ' ' : bytes[i];
+    }
+    return sum;
+}
+
+/*
+ * Parses a numeric header field: octal, or base-256 (GNU) if the first byte
+ * has its top bit set.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int tar_number(char const *field, size_t len, size_t *value) {
+    unsigned char const *bytes = (unsigned char const *)field;
+    *value = 0;
+    if (bytes[0] & 0x80) {
+        for (size_t i = 0; i < len; i++) {
+            size_t byte = i == 0 ? (size_t)(bytes[0] & 0x7f) : bytes[i];
+            if (*value > (SIZE_MAX >> 8)) {
+                return -1;
+            }
+            *value = (*value << 8) | byte;
+        }
+        return 0;
+    }
+
+    size_t i = 0;
+    while (i < len && field[i] == ' ') {
+        i++;
+    }
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        if (*value > (SIZE_MAX >> 3)) {
+            return -1;
+        }
+        *value = (*value << 3) | (size_t)(field[i] - '0');
+    }
+    return i == len || field[i] == '\0' || field[i] == ' ' ? 0 : -1;
+}
+
+/*
+ * Reads up to len bytes, stopping short only at the end of the stream.
+ * Returns the number of bytes read, or -1 on error.
+ */
+static ssize_t read_full(int fd, void *buffer, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, (char *)buffer + done, len - done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+/*
+ * Discards the next len bytes of the stream.
+ * Returns 0 if successful, -1 otherwise (including a premature end).
+ */
+static int tar_skip(int fd, size_t len) {
+    char buffer[16 * TAR_BLOCK_SIZE];
+    while (len > 0) {
+        size_t chunk = min(len, sizeof(buffer));
+        if (read_full(fd, buffer, chunk) != chunk) {
+            return -1;
+        }
+        len -= chunk;
+    }
+    return 0;
+}
+
+/*
+ * Name of an archive member in TecnicoFS: its path, without a leading "./"
+ * or "/" nor a trailing "/", with '_' in place of the other '/' (as in
+ * tfs_import_tree).
+ * Returns true if the name fits.
+ */
+static bool tar_tfs_path(char const *prefix, size_t prefix_len,
+                         char const *name, size_t name_len,
+                         char path[MAX_FILE_NAME]) {
+    char full[sizeof(((tar_header_t *)0)->prefix) + 1 +
+              sizeof(((tar_header_t *)0)->name) + 1];
+    size_t plen = strnlen(prefix, prefix_len);
+    size_t nlen = strnlen(name, name_len);
+    size_t len = 0;
+    if (plen > 0) {
+        memcpy(full, prefix, plen);
+        full[plen] = '/';
+        len = plen + 1;
+    }
+    memcpy(full + len, name, nlen);
+    len += nlen;
+    full[len] = '\0';
+
+    char const *start = full;
+    while (strncmp(start, "./", 2) == 0 || start[0] == '/') {
+        start += start[0] == '/' ? 1 : 2;
+    }
+    size_t start_len = strlen(start);
+    while (start_len > 0 && start[start_len - 1] == '/') {
+        start_len--;
+    }
+    if (start_len == 0 || start_len + 2 > MAX_FILE_NAME) {
+        return false;
+    }
+
+    path[0] = '/';
+    for (size_t i = 0; i < start_len; i++) {
+        path[i + 1] = start[i] == '/' ? '_' : start[i];
+    }
+    path[start_len + 1] = '\0';
+    return true;
+}
+
+/*
+ * Reads the contents of a regular file member straight into the file's data
+ * block.
+ * Returns 0 if successful, 1 if the contents were skipped (no space), -1 if
+ * the stream ended or failed.
+ */
+static int tar_import_file(int fd, int fhandle, size_t size) {
+    int inum = get_open_file_entry(fhandle)->of_inumber;
+    inode_t *inode = inode_get(inum);
+    SCOPED_RWLOCK_W(inode->rwlock);
+    if (!is_inum_taken(inum)) {
+        return tar_skip(fd, size) == -1 ? -1 : 1;
+    }
+
+    if (size > 0) {
+        char *block = inode_writable_block(inode);
+        if (block == NULL) {
+            return tar_skip(fd, size) == -1 ? -1 : 1; // no space
+        }
+        ssize_t n = read_full(fd, block, size);
+        data_block_written(inode_get_data_block(inode));
+        if (n != size) {
+            return -1;
+        }
+        inode_set_size(inode, size);
+        inode_dedup(inode);
+    }
+    return 0;
+}
+
+// Symbolic and hard links are only created once their targets are in place
+typedef struct {
+    char path[MAX_FILE_NAME];
+    char target[MAX_FILE_NAME];
+    bool symbolic;
+} tar_link_t;
+
+ssize_t tfs_import_tar(int fd) {
+    tar_link_t *links = NULL;
+    size_t link_count = 0;
+    size_t link_capacity = 0;
+    size_t block_size = state_block_size();
+    ssize_t imported = 0;
+
+    for (;;) {
+        tar_header_t header;
+        ssize_t n = read_full(fd, &header, sizeof(header));
+        if (n == 0) {
+            break; // end of the stream, without the end-of-archive blocks
+        }
+        if (n != sizeof(header)) {
+            imported = -1;
+            break;
+        }
+
+        static tar_header_t const zero_header;
+        if (memcmp(&header, &zero_header, sizeof(header)) == 0) {
+            break; // end of the archive
+        }
+
+        size_t size, checksum;
+        if (tar_number(header.checksum, sizeof(header.checksum), &checksum) ==
+                -1 ||
+            checksum != tar_checksum(&header) ||
+            tar_number(header.size, sizeof(header.size), &size) == -1 ||
+            size > SIZE_MAX - TAR_BLOCK_SIZE) {
+            imported = -1; // not a tar header
+            break;
+        }
+        // Only regular files carry contents (for links, the size is
+        // ignored)
+        bool regular = header.typeflag == '0' || header.typeflag == '\0' ||
+                       header.typeflag == '7';
+        size_t data_len = header.typeflag == '1' || header.typeflag == '2'
+                              ? 0
+                              : size + tar_padding(size);
+
+        char path[MAX_FILE_NAME];
+        bool named = tar_tfs_path(header.prefix, sizeof(header.prefix),
+                                  header.name, sizeof(header.name), path);
+        if (regular && named && size <= block_size) {
+            int fhandle = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+            if (fhandle == -1) {
+                n = tar_skip(fd, data_len);
+            } else {
+                n = tar_import_file(fd, fhandle, size);
+                ALWAYS_ASSERT(tfs_close(fhandle) == 0, "tfs_close");
+                if (n == 1) {
+                    // no empty file is left in place of the skipped one
+                    tfs_unlink(path);
+                } else if (n == 0) {
+                    imported++;
+                }
+                if (n != -1) {
+                    n = tar_skip(fd, tar_padding(size));
+                }
+            }
+        } else if ((header.typeflag == '1' || header.typeflag == '2') &&
+                   named) {
+            if (link_count == link_capacity) {
+                link_capacity = link_capacity == 0 ? 16 : 2 * link_capacity;
+                tar_link_t *grown =
+                    realloc(links, link_capacity * sizeof(tar_link_t));
+                ALWAYS_ASSERT(grown != NULL, "tfs_import_tar: realloc");
+                links = grown;
+            }
+            tar_link_t *link = &links[link_count];
+            link->symbolic = header.typeflag == '2';
+            memcpy(link->path, path, sizeof(path));
+            if (tar_tfs_path("", 0, header.linkname, sizeof(header.linkname),
+                             link->target)) {
+                link_count++;
+            }
+            n = 0;
+        } else {
+            // directories are flattened; other types are not supported
+            n = tar_skip(fd, data_len);
+        }
+
+        if (n != 0) {
+            imported = -1; // the archive ended prematurely
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < link_count && imported != -1; i++) {
+        tar_link_t const *link = &links[i];
+        tfs_unlink(link->path); // replaces existing files, as for the others
+        if ((link->symbolic ? tfs_sym_link(link->target, link->path)
+                            : tfs_link(link->target, link->path)) == 0) {
+            imported++;
+        }
+    }
+    free(links);
+    return imported;
+}
+
+/*
+ * Writes the whole iovec array to a host file, retrying after partial writes.
+ * Returns 0 if successful, -1 otherwise.
+ */
+static int writev_full(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n == -1) {
+            return -1;
+        }
+        // Skip what was written
+        size_t written = (size_t)n;
+        while (iovcnt > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+static void tar_fill_header(tar_header_t *header, char const *name,
+                            char typeflag, size_t size, char const *linkname) {
+    memset(header, 0, sizeof(*header));
+    // names and link targets are at most MAX_FILE_NAME long, so they fit
+    memcpy(header->name, name, strnlen(name, sizeof(header->name)));
+    snprintf(header->mode, sizeof(header->mode), "%07o",
+             typeflag == '2' ? 0777 : 0644);
+    snprintf(header->uid, sizeof(header->uid), "%07o", 0);
+    snprintf(header->gid, sizeof(header->gid), "%07o", 0);
+    snprintf(header->size, sizeof(header->size), "%011zo", size);
+    snprintf(header->mtime, sizeof(header->mtime), "%011o", 0);
+    header->typeflag = typeflag;
+    if (linkname != NULL) {
+        memcpy(header->linkname, linkname,
+               strnlen(linkname, sizeof(header->linkname)));
+    }
+    memcpy(header->magic, "ustar", 6);
+    memcpy(header->version, "00", 2);
+    snprintf(header->checksum, sizeof(header->checksum), "%06o",
+             tar_checksum(header));
+    header->checksum[7] = ' ';
+}
+
+/*
+ * Writes a file's header and contents, straight from its data block, with a
+ * single writev.
+ * Returns 1 if the file was written, 0 if it is gone, or -1 on write error.
+ */
+static int tar_export_file(int fd, tfs_dirent_t const *entry) {
+    static char const zeros[TAR_BLOCK_SIZE];
+    inode_t *inode = inode_get(entry->d_inumber);
+    SCOPED_RWLOCK_R(inode->rwlock);
+    if (!is_inum_taken(entry->d_inumber) ||
+        inode_get_type(inode) != T_FILE) {
+        return 0;
+    }
+
+    size_t size = inode_get_size(inode);
+    char const *block = NULL;
+    if (size > 0) {
+        block = data_block_get(inode_get_data_block(inode));
+        if (block == NULL) {
+            return 0; // corrupted
+        }
+    }
+
+    tar_header_t header;
+    tar_fill_header(&header, entry->d_name, '0', size, NULL);
+    struct iovec iov[3] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = (void *)block, .iov_len = size},
+        {.iov_base = (void *)zeros, .iov_len = tar_padding(size)},
+    };
+    return writev_full(fd, iov, 3) == -1 ? -1 : 1;
+}
+
+/*
+ * Inode exported under a name, so that its other names become hard links.
+ */
+typedef struct {
+    int inumber;
+    char name[MAX_FILE_NAME];
+} tar_exported_t;
+
+ssize_t tfs_export_tar(int fd) {
+    inode_t *root_dir_inode = inode_get(ROOT_DIR_INUM);
+    tar_exported_t *exported = NULL;
+    size_t exported_count = 0;
+    size_t exported_capacity = 0;
+    ssize_t written = 0;
+
+    tfs_dirent_t entries[64];
+    size_t cursor = 0;
+    size_t count;
+    while (written != -1 &&
+           (count = dir_read_entries(root_dir_inode, &cursor, entries,
+                                     sizeof(entries) / sizeof(*entries))) >
+               0) {
+        for (size_t i = 0; i < count && written != -1; i++) {
+            tfs_dirent_t const *entry = &entries[i];
+            int result = 0;
+            if (entry->d_type == T_SYMLINK) {
+                char target[MAX_FILE_NAME];
+                if (read_symlink(entry->d_inumber, target) == 0) {
+                    tar_header_t header;
+                    // archives use relative names
+                    tar_fill_header(&header, entry->d_name, '2', 0,
+                                    target[0] == '/' ? target + 1 : target);
+                    result = write_full(fd, (char const *)&header,
+                                        sizeof(header)) == -1
+                                 ? -1
+                                 : 1;
+                }
+            } else if (entry->d_type == T_FILE) {
+                size_t j = 0;
+                while (j < exported_count &&
+                       exported[j].inumber != entry->d_inumber) {
+                    j++;
+                }
+                if (j < exported_count) {
+                    tar_header_t header;
+                    tar_fill_header(&header, entry->d_name, '1', 0,
+                                    exported[j].name);
+                    result = write_full(fd, (char const *)&header,
+                                        sizeof(header)) == -1
+                                 ? -1
+                                 : 1;
+                } else {
+                    result = tar_export_file(fd, entry);
+                    if (result == 1 && inode_get(entry->d_inumber)->hard_links >
+                                           1) {
+                        if (exported_count == exported_capacity) {
+                            exported_capacity = exported_capacity == 0
+                                                    ? 16
+                                                    : 2 * exported_capacity;
+                            tar_exported_t *grown =
+                                realloc(exported, exported_capacity *
+                                                      sizeof(tar_exported_t));
+                            ALWAYS_ASSERT(grown != NULL,
+                                          "tfs_export_tar: realloc");
+                            exported = grown;
+                        }
+                        exported[exported_count].inumber = entry->d_inumber;
+                        memcpy(exported[exported_count].name, entry->d_name,
+                               MAX_FILE_NAME);
+                        exported_count++;
+                    }
+                }
+            }
+            written = result == -1 ? -1 : written + result;
+        }
+    }
+    free(exported);
+
+    // End-of-archive marker
+    static char const end[2 * TAR_BLOCK_SIZE];
+    if (written != -1 && write_full(fd, end, sizeof(end)) == -1) {
+        written = -1;
+    }
+    return written;
+}
+
+int tfs_save_image(char const *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = state_save_image(fd);
+    if (close(fd) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+int tfs_load_image(char const *path, int thread_count) {
+    if (thread_count <= 0) {
+        return -1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    tfs_params image_params;
+    if (state_read_image_params(fd, &image_params) == -1) {
+        close(fd);
+        return -1; // not an image (the FS is left as it was)
+    }
+
+    // The image replaces the FS, with the parameters it was saved with
+    int result = -1;
+    if (tfs_destroy() == 0 && tfs_init(&image_params) == 0) {
+        result = state_load_image(fd, (size_t)thread_count);
+        if (result == -1) {
+            // leave an empty FS, rather than part of the image
+            ALWAYS_ASSERT(tfs_destroy() == 0 && tfs_init(&image_params) == 0,
+                          "tfs_load_image: failed to reinitialize");
+        }
+    }
+    close(fd);
+    return result;
+}
+
+/*
+ * Explicit instances: each function runs its counterpart on the given
+ * instance (see SCOPED_CTX)
+ */
+
+tfs_ctx *tfs_ctx_create(tfs_params const *params) {
+    tfs_ctx *ctx = state_ctx_new();
+    if (ctx == NULL) {
+        return NULL;
+    }
+    {
+        SCOPED_CTX(ctx);
+        if (tfs_init(params) == 0) {
+            return ctx;
+        }
+        state_destroy();
+    }
+    state_ctx_free(ctx);
+    return NULL;
+}
+
+int tfs_ctx_destroy(tfs_ctx *ctx) {
+    if (ctx == NULL) {
+        return -1;
+    }
+    {
+        SCOPED_CTX(ctx);
+        if (tfs_destroy() != 0) {
+            return -1;
+        }
+    }
+    state_ctx_free(ctx);
+    return 0;
+}
+
+int tfs_ctx_reset(tfs_ctx *ctx) {
+    SCOPED_CTX(ctx);
+    return tfs_reset();
+}
+
+void tfs_ctx_get_stats(tfs_ctx *ctx, tfs_stats_t *stats) {
+    SCOPED_CTX(ctx);
+    tfs_get_stats(stats);
+}
+
+int tfs_ctx_open(tfs_ctx *ctx, char const *name, tfs_file_mode_t mode) {
+    SCOPED_CTX(ctx);
+    return tfs_open(name, mode);
+}
+
+int tfs_ctx_sym_link(tfs_ctx *ctx, char const *target, char const *link_name) {
+    SCOPED_CTX(ctx);
+    return tfs_sym_link(target, link_name);
+}
+
+int tfs_ctx_link(tfs_ctx *ctx, char const *target_file, char const *link_name) {
+    SCOPED_CTX(ctx);
+    return tfs_link(target_file, link_name);
+}
+
+int tfs_ctx_close(tfs_ctx *ctx, int fhandle) {
+    SCOPED_CTX(ctx);
+    return tfs_close(fhandle);
+}
+
+ssize_t tfs_ctx_write(tfs_ctx *ctx, int fhandle, void const *buffer,
+                      size_t len) {
+    SCOPED_CTX(ctx);
+    return tfs_write(fhandle, buffer, len);
+}
+
+ssize_t tfs_ctx_read(tfs_ctx *ctx, int fhandle, void *buffer, size_t len) {
+    SCOPED_CTX(ctx);
+    return tfs_read(fhandle, buffer, len);
+}
+
+int tfs_ctx_opendir(tfs_ctx *ctx, char const *path) {
+    SCOPED_CTX(ctx);
+    return tfs_opendir(path);
+}
+
+ssize_t tfs_ctx_readdir_batch(tfs_ctx *ctx, int dhandle, tfs_dirent_t *entries,
+                              size_t max_entries) {
+    SCOPED_CTX(ctx);
+    return tfs_readdir_batch(dhandle, entries, max_entries);
+}
+
+int tfs_ctx_closedir(tfs_ctx *ctx, int dhandle) {
+    SCOPED_CTX(ctx);
+    return tfs_closedir(dhandle);
+}
+
+ssize_t tfs_ctx_list_prefix(tfs_ctx *ctx, char const *dir, char const *prefix,
+                            tfs_dirent_callback_t cb, void *arg) {
+    SCOPED_CTX(ctx);
+    return tfs_list_prefix(dir, prefix, cb, arg);
+}
+
+ssize_t tfs_ctx_writev(tfs_ctx *ctx, int fhandle, struct iovec const *iov,
+                       int iovcnt) {
+    SCOPED_CTX(ctx);
+    return tfs_writev(fhandle, iov, iovcnt);
+}
+
+ssize_t tfs_ctx_readv(tfs_ctx *ctx, int fhandle, struct iovec const *iov,
+                      int iovcnt) {
+    SCOPED_CTX(ctx);
+    return tfs_readv(fhandle, iov, iovcnt);
+}
+
+int tfs_ctx_clone(tfs_ctx *ctx, char const *source, char const *dest) {
+    SCOPED_CTX(ctx);
+    return tfs_clone(source, dest);
+}
+
+ssize_t tfs_ctx_copy_file_range(tfs_ctx *ctx, int src_fhandle,
+                                size_t src_offset, int dst_fhandle,
+                                size_t dst_offset, size_t len) {
+    SCOPED_CTX(ctx);
+    return tfs_copy_file_range(src_fhandle, src_offset, dst_fhandle,
+                               dst_offset, len);
+}
+
+int tfs_ctx_read_view(tfs_ctx *ctx, int fhandle, size_t offset, size_t len,
+                      tfs_view_t *view) {
+    SCOPED_CTX(ctx);
+    return tfs_read_view(fhandle, offset, len, view);
+}
+
+int tfs_ctx_release_view(tfs_ctx *ctx, tfs_view_t *view) {
+    SCOPED_CTX(ctx);
+    return tfs_release_view(view);
+}
+
+int tfs_ctx_snapshot_create(tfs_ctx *ctx) {
+    SCOPED_CTX(ctx);
+    return tfs_snapshot_create();
+}
+
+int tfs_ctx_snapshot_destroy(tfs_ctx *ctx) {
+    SCOPED_CTX(ctx);
+    return tfs_snapshot_destroy();
+}
+
+int tfs_ctx_snapshot_open(tfs_ctx *ctx, char const *name) {
+    SCOPED_CTX(ctx);
+    return tfs_snapshot_open(name);
+}
+
+int tfs_ctx_mark_cold(tfs_ctx *ctx, char const *name) {
+    SCOPED_CTX(ctx);
+    return tfs_mark_cold(name);
+}
+
+ssize_t tfs_ctx_fsck(tfs_ctx *ctx, tfs_fsck_report_t *report,
+                     int thread_count) {
+    SCOPED_CTX(ctx);
+    return tfs_fsck(report, thread_count);
+}
+
+int tfs_ctx_unlink(tfs_ctx *ctx, char const *target) {
+    SCOPED_CTX(ctx);
+    return tfs_unlink(target);
+}
+
+int tfs_ctx_copy_from_external_fs(tfs_ctx *ctx, char const *source_path,
+                                  char const *dest_path) {
+    SCOPED_CTX(ctx);
+    return tfs_copy_from_external_fs(source_path, dest_path);
+}
+
+int tfs_ctx_map_from_external_fs(tfs_ctx *ctx, char const *source_path,
+                                 char const *dest_path) {
+    SCOPED_CTX(ctx);
+    return tfs_map_from_external_fs(source_path, dest_path);
+}
+
+int tfs_ctx_copy_to_external_fs(tfs_ctx *ctx, char const *source_path,
+                                char const *dest_path) {
+    SCOPED_CTX(ctx);
+    return tfs_copy_to_external_fs(source_path, dest_path);
+}
+
+ssize_t tfs_ctx_import_tree(tfs_ctx *ctx, char const *host_dir,
+                            char const *tfs_dir, int thread_count,
+                            tfs_import_report_t *report) {
+    SCOPED_CTX(ctx);
+    return tfs_import_tree(host_dir, tfs_dir, thread_count, report);
+}
+
+ssize_t tfs_ctx_import_tar(tfs_ctx *ctx, int fd) {
+    SCOPED_CTX(ctx);
+    return tfs_import_tar(fd);
+}
+
+ssize_t tfs_ctx_export_tar(tfs_ctx *ctx, int fd) {
+    SCOPED_CTX(ctx);
+    return tfs_export_tar(fd);
+}
+
+int tfs_ctx_save_image(tfs_ctx *ctx, char const *path) {
+    SCOPED_CTX(ctx);
+    return tfs_save_image(path);
+}
+
+int tfs_ctx_load_image(tfs_ctx *ctx, char const *path, int thread_count) {
+    SCOPED_CTX(ctx);
+    return tfs_load_image(path, thread_count);
+}
@@ -2,7 +2,9 @@
 #define OPERATIONS_H
 
 #include "config.h"
+#include <stdbool.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 /**
  * TécnicoFS parameters.
@@ -13,6 +15,22 @@ typedef struct {
     size_t max_open_files_count;
 
     size_t block_size;
+
+    // keep a sorted name index in each directory, for tfs_list_prefix
+    bool dir_prefix_index;
+    // share the data blocks of files with identical contents (checked
+    // whenever a file is written to)
+    bool dedup;
+
+    // check each data block against its checksum whenever it is accessed
+    bool verify_checksums;
+    // blocks per second checked by the background scrubber (0 disables it)
+    size_t scrub_rate;
+
+    // back the data blocks with transparent huge pages, if the host allows
+    // it (only worth it for blocks of 2 MiB or more, as freeing smaller ones
+    // splits the huge pages)
+    bool huge_pages;
 } tfs_params;
 
 /**
@@ -32,6 +50,87 @@ int tfs_init(tfs_params const *params);
  */
 int tfs_destroy();
 
+/**
+ * Empty tecnicofs, leaving only the root directory, as if it had just been
+ * initialized with the same parameters. The allocations and locks of the
+ * current instance are reused, and only the state that was used since the
+ * last tfs_init or tfs_reset is cleared, which makes this much cheaper than
+ * tfs_destroy followed by tfs_init. Open file handles become invalid.
+ * Must not be called concurrently with other operations.
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_reset(void);
+
+/**
+ * Types of the files stored in TécnicoFS.
+ */
+typedef enum { T_FILE, T_DIRECTORY, T_SYMLINK } inode_type;
+
+/**
+ * Directory entry, as returned by tfs_readdir_batch.
+ */
+typedef struct {
+    char d_name[MAX_FILE_NAME];
+    int d_inumber;
+    inode_type d_type;
+} tfs_dirent_t;
+
+/**
+ * Callback used to visit directory entries.
+ * Returns 0 to continue visiting entries, anything else to stop.
+ */
+typedef int (*tfs_dirent_callback_t)(tfs_dirent_t const *entry, void *arg);
+
+/**
+ * TécnicoFS statistics, accumulated since tfs_init.
+ */
+typedef struct {
+    // directory lookups (find_in_dir)
+    size_t dir_lookups;
+    // lookups answered as "not found" by the directory's Bloom filter alone
+    size_t dir_bloom_negatives;
+    // lookups the Bloom filter let through that found nothing
+    size_t dir_bloom_false_positives;
+    // opens through a symlink answered by its resolved-target cache
+    size_t symlink_cache_hits;
+    // data blocks copied because they were shared with a clone (or with the
+    // snapshot)
+    size_t cow_copies;
+    // contents of the blocks currently stored compressed (see tfs_mark_cold),
+    // before and after compression
+    size_t cold_raw_bytes;
+    size_t cold_stored_bytes;
+    // bytes decompressed when cold blocks were accessed, and the time it took
+    size_t decompressed_bytes;
+    size_t decompress_ns;
+    // blocks written with dedup enabled, and how many of those were found to
+    // duplicate an existing block (and now share it)
+    size_t dedup_checks;
+    size_t dedup_hits;
+    // bytes hashed to look for duplicates, and the time it took
+    size_t dedup_hashed_bytes;
+    size_t dedup_hash_ns;
+    // bytes checksummed (when blocks are written, verified or scrubbed), and
+    // the time it took
+    size_t checksum_bytes;
+    size_t checksum_ns;
+    // blocks whose contents were found not to match their checksum
+    size_t checksum_errors;
+    // blocks checked by the scrubber
+    size_t scrubbed_blocks;
+    // contents of the host files currently mapped into the FS (see
+    // tfs_map_from_external_fs), and how many of them were copied on write
+    size_t mapped_bytes;
+    size_t mapped_copies;
+    // memory of freed blocks given back to the host (whole pages only)
+    size_t released_bytes;
+} tfs_stats_t;
+
+/**
+ * Obtain the current TécnicoFS statistics.
+ */
+void tfs_get_stats(tfs_stats_t *stats);
+
 /**
  * TécnicoFS file opening modes.
  */
@@ -113,6 +212,265 @@ ssize_t tfs_write(int fhandle, void const *buffer, size_t len);
  */
 ssize_t tfs_read(int fhandle, void *buffer, size_t len);
 
+/**
+ * Open a directory for listing.
+ *
+ * Input:
+ *   - path: absolute path name of the directory (only the root directory,
+ *     "/", is supported)
+ *
+ * Returns a directory handle if successful, -1 otherwise.
+ * The handle uses a slot of the open file table and must be released with
+ * tfs_closedir.
+ */
+int tfs_opendir(char const *path);
+
+/**
+ * Read the next batch of entries of an open directory.
+ *
+ * The directory is only locked during the call, so other threads may create
+ * and remove entries between calls: entries that exist for the whole listing
+ * are returned exactly once, while entries added or removed during it may or
+ * may not be returned.
+ *
+ * Input:
+ *   - dhandle: directory handle (obtained from a previous call to tfs_opendir)
+ *   - entries: destination array
+ *   - max_entries: capacity of the entries array
+ *
+ * Returns the number of entries stored in the array (0 once the whole
+ * directory was listed), or -1 in case of error.
+ */
+ssize_t tfs_readdir_batch(int dhandle, tfs_dirent_t *entries,
+                          size_t max_entries);
+
+/**
+ * Close a directory handle.
+ *
+ * Input:
+ *   - dhandle: directory handle (obtained from a previous call to tfs_opendir)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_closedir(int dhandle);
+
+/**
+ * Visit the entries of a directory whose name starts with a given prefix, in
+ * lexicographic order.
+ *
+ * With the dir_prefix_index parameter enabled, only the matching entries are
+ * visited; otherwise the whole directory is scanned (and entries are visited
+ * in directory order).
+ *
+ * The directory is read-locked while the callback runs, so the callback must
+ * not create or remove entries in it.
+ *
+ * Input:
+ *   - dir: absolute path name of the directory (only "/" is supported)
+ *   - prefix: name prefix, relative to the directory (e.g. "tenant-42-")
+ *   - cb: callback called for each matching entry
+ *   - arg: passed as-is to cb
+ *
+ * Returns the number of entries visited, or -1 in case of error.
+ */
+ssize_t tfs_list_prefix(char const *dir, char const *prefix,
+                        tfs_dirent_callback_t cb, void *arg);
+
+/**
+ * Write the contents of several buffers to an open file, starting at the
+ * current offset (gather write).
+ *
+ * The buffers are written in order, as if concatenated and written by a
+ * single tfs_write: the inode is locked, and the offset updated, only once
+ * for the whole vector.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - iov: array of buffers to write
+ *   - iovcnt: number of buffers in iov
+ *
+ * Returns the number of bytes that were written (can be lower than the total
+ * length of the buffers if the maximum file size is exceeded), or -1 in case
+ * of error.
+ */
+ssize_t tfs_writev(int fhandle, struct iovec const *iov, int iovcnt);
+
+/**
+ * Read from an open file into several buffers, starting at the current
+ * offset (scatter read).
+ *
+ * The buffers are filled in order, as if they were a single buffer given to
+ * tfs_read.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - iov: array of destination buffers
+ *   - iovcnt: number of buffers in iov
+ *
+ * Returns the number of bytes that were copied from the file to the buffers
+ * (can be lower than their total length if the file size was reached), or -1
+ * in case of error.
+ */
+ssize_t tfs_readv(int fhandle, struct iovec const *iov, int iovcnt);
+
+/**
+ * Clone a file: create a new file that shares the source's data blocks, which
+ * are only copied once either file is written to (copy-on-write).
+ *
+ * Input:
+ *   - source: absolute path name of the file to clone (symlinks are followed)
+ *   - dest: absolute path name of the new file (must not exist yet)
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_clone(char const *source, char const *dest);
+
+/**
+ * Copy a range of bytes between two open files, inside TécnicoFS (without
+ * going through user buffers).
+ *
+ * The handles' offsets are not used nor updated. Source and destination may
+ * be the same file (overlapping ranges are handled).
+ *
+ * Input:
+ *   - src_fhandle: file handle of the source file
+ *   - src_offset: offset in the source file of the first byte to copy
+ *   - dst_fhandle: file handle of the destination file
+ *   - dst_offset: offset in the destination file where the bytes are copied
+ *     to (at most the destination's current size)
+ *   - len: number of bytes to copy
+ *
+ * Returns the number of bytes that were copied (can be lower than 'len' if
+ * the end of the source file or the maximum file size is reached), or -1 in
+ * case of error.
+ */
+ssize_t tfs_copy_file_range(int src_fhandle, size_t src_offset,
+                            int dst_fhandle, size_t dst_offset, size_t len);
+
+/**
+ * Read-only view into the contents of a file.
+ */
+typedef struct {
+    // first byte of the view, pointing straight into the file's data block
+    void const *data;
+    // number of bytes that can be accessed through data
+    size_t len;
+    // inode the lease is held on (internal)
+    int v_inumber;
+} tfs_view_t;
+
+/**
+ * Obtain a view into the contents of an open file, without copying them.
+ *
+ * A read lease is held on the file until the view is released with
+ * tfs_release_view, by the same thread: meanwhile, writers (and unlinks) of
+ * the file wait, so the thread holding the view must not write to the file
+ * itself. The file handle's offset is not used nor updated.
+ *
+ * Input:
+ *   - fhandle: file handle (obtained from a previous call to tfs_open)
+ *   - offset: offset in the file of the first byte of the view
+ *   - len: length of the view (in bytes)
+ *   - view: where to store the view
+ *
+ * Returns 0 if successful (view->len can be lower than 'len' if the file size
+ * was reached), or -1 in case of error.
+ */
+int tfs_read_view(int fhandle, size_t offset, size_t len, tfs_view_t *view);
+
+/**
+ * Release a view obtained with tfs_read_view.
+ *
+ * Input:
+ *   - view: the view to release
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_release_view(tfs_view_t *view);
+
+/**
+ * Take a snapshot of the whole TécnicoFS.
+ *
+ * Taking the snapshot doesn't copy anything: files (and the directory) are
+ * copied on write afterwards, as they change. There can be only one snapshot
+ * at a time.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_snapshot_create(void);
+
+/**
+ * Discard the snapshot, freeing the data blocks only it was using.
+ *
+ * Returns 0 if successful, -1 otherwise (no snapshot, or there are still
+ * files open in it).
+ */
+int tfs_snapshot_destroy(void);
+
+/**
+ * Open a file as it was when the snapshot was taken.
+ *
+ * The snapshot is a read-only namespace: the handle can only be read (with
+ * tfs_read or tfs_readv) and closed (with tfs_close).
+ *
+ * Input:
+ *   - name: absolute path name, resolved in the snapshot (symlinks included)
+ *
+ * Returns file handle if successful, -1 otherwise.
+ */
+int tfs_snapshot_open(char const *name);
+
+/**
+ * Mark a file as cold, storing its contents compressed until it is next
+ * accessed.
+ *
+ * Input:
+ *   - name: absolute path name of the file (symlinks are followed)
+ *
+ * Returns 0 if successful (the contents may be left uncompressed, if they are
+ * shared with a clone or don't compress well), -1 otherwise.
+ */
+int tfs_mark_cold(char const *name);
+
+/**
+ * Results of a consistency check (see tfs_fsck).
+ */
+typedef struct {
+    size_t inodes_checked;
+    size_t blocks_checked;
+    // inodes with an invalid type, size or data block
+    size_t invalid_inodes;
+    // symlinks without a target
+    size_t empty_symlinks;
+    // directory entries naming free (or invalid) inodes
+    size_t dangling_entries;
+    // files and symlinks not named by any directory entry
+    size_t orphan_inodes;
+    // inodes whose hard link count doesn't match the entries naming them
+    size_t link_count_errors;
+    // blocks taken, but used by no inode
+    size_t leaked_blocks;
+    // blocks used by some inode, but free
+    size_t free_referenced_blocks;
+    // blocks whose reference count doesn't match the inodes using them
+    size_t refcount_errors;
+} tfs_fsck_report_t;
+
+/**
+ * Check the consistency of TécnicoFS: the inode table against the directory,
+ * and the block table against the inodes.
+ *
+ * TécnicoFS must not be in use meanwhile.
+ *
+ * Input:
+ *   - report: where to store the results
+ *   - thread_count: number of threads to split the work among
+ *
+ * Returns the number of inconsistencies found (0 if there are none), or -1 in
+ * case of error.
+ */
+ssize_t tfs_fsck(tfs_fsck_report_t *report, int thread_count);
+
 /**
  * Delete a link, or a file if the number of hard links reaches 0, that
  * exists in TécnicoFS.
@@ -137,4 +495,209 @@ int tfs_unlink(char const *target);
  */
 int tfs_copy_from_external_fs(char const *source_path, char const *dest_path);
 
+/**
+ * Import a file that exists in the OS' file system tree (outside TécnicoFS)
+ * without copying it: the TécnicoFS file is backed by a read-only mapping of
+ * the host file, so reads come straight from the OS' page cache. The contents
+ * are only copied into TécnicoFS the first time the file is written to.
+ *
+ * The host file must not be changed while it is mapped (i.e. until the
+ * TécnicoFS file, and any clones of it, are written to or deleted).
+ *
+ * Input:
+ *   - source_path: path name of the source file (from the OS' file system)
+ *   - dest_path: absolute path name of the destination file (in TécnicoFS),
+ *    which is created if needed, and overwritten if it already exists.
+ *
+ * Returns 0 if successful, -1 otherwise (e.g. the source file doesn't fit in
+ * a block).
+ */
+int tfs_map_from_external_fs(char const *source_path, char const *dest_path);
+
+/**
+ * Copy the contents of a file in TécnicoFS to a file in the OS' file system
+ * tree (outside TécnicoFS).
+ *
+ * Input:
+ *   - source_path: absolute path name of the source file (in TécnicoFS),
+ *    following symbolic links
+ *   - dest_path: path name of the destination file (in the OS' file system),
+ *    which is created if needed, and overwritten if it already exists.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_copy_to_external_fs(char const *source_path, char const *dest_path);
+
+/**
+ * Results of a tree import (see tfs_import_tree).
+ */
+typedef struct {
+    // files imported, and their total size
+    size_t files;
+    size_t bytes;
+    // files that couldn't be imported (including those whose names are too
+    // long, once flattened), and unreadable directories
+    size_t failed;
+    // time the import took, to compute files/s and MB/s
+    size_t elapsed_ns;
+} tfs_import_report_t;
+
+/**
+ * Copy the regular files under a directory of the OS' file system tree
+ * (outside TécnicoFS), recursively, to a directory of TécnicoFS, using
+ * several threads.
+ *
+ * TécnicoFS directories can't be nested, so each file is named after its path
+ * relative to host_dir, with '_' in place of '/' (e.g. "a/b.txt" becomes
+ * "a_b.txt"). Existing files are overwritten; of the files whose new names
+ * clash, only the first (by host path) is imported.
+ *
+ * Input:
+ *   - host_dir: path name of the source directory (in the OS' file system)
+ *   - tfs_dir: path name of the destination directory (in TécnicoFS)
+ *   - thread_count: number of threads to import the files with
+ *   - report: where to store the results (may be NULL)
+ *
+ * Returns the number of files imported, or -1 in case of error (e.g. host_dir
+ * is not a directory).
+ */
+ssize_t tfs_import_tree(char const *host_dir, char const *tfs_dir,
+                        int thread_count, tfs_import_report_t *report);
+
+/**
+ * Import the contents of a ustar archive, read from a host file descriptor
+ * (which may be a pipe), straight into TécnicoFS.
+ *
+ * Regular files, symbolic links and hard links are imported (links once all
+ * files are in place); directories are flattened as in tfs_import_tree, and
+ * other types of entries are skipped. Existing files are overwritten. Files
+ * larger than a block, or whose names are too long, are skipped.
+ *
+ * Input:
+ *   - fd: host file descriptor to read the archive from
+ *
+ * Returns the number of entries imported, or -1 if the archive is malformed
+ * or can't be read.
+ */
+ssize_t tfs_import_tar(int fd);
+
+/**
+ * Write all the files and links in TécnicoFS as a ustar archive to a host
+ * file descriptor (which may be a pipe), straight from their data blocks.
+ *
+ * Hard links to a file already in the archive are stored as such, and the
+ * targets of symbolic links are stored without the leading '/'.
+ *
+ * Input:
+ *   - fd: host file descriptor to write the archive to
+ *
+ * Returns the number of entries written, or -1 in case of a write error.
+ */
+ssize_t tfs_export_tar(int fd);
+
+/**
+ * Save the files and symbolic links in TécnicoFS, and its parameters, to a
+ * packed image on the host FS (see tfs_load_image).
+ *
+ * Free inodes and blocks are left out, blocks shared by several files are
+ * saved once, and each block only takes as many bytes as its contents.
+ * Snapshots and open files are not saved. TécnicoFS must not be in use
+ * meanwhile.
+ *
+ * Input:
+ *   - path: path of the image on the host FS
+ *
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_save_image(char const *path);
+
+/**
+ * Replace the contents of TécnicoFS with a packed image saved by
+ * tfs_save_image, reinitializing it with the parameters saved in the image.
+ *
+ * The image's table of contents is read first, and then its data blocks and
+ * inodes are loaded in parallel. TécnicoFS must be initialized, and not in
+ * use meanwhile.
+ *
+ * Input:
+ *   - path: path of the image on the host FS
+ *   - thread_count: number of threads to split the work among
+ *
+ * Returns 0 if successful, -1 otherwise (if the file is not an image,
+ * TécnicoFS is left as it was; if the image is malformed, it is left empty).
+ */
+int tfs_load_image(char const *path, int thread_count);
+
+/**
+ * Independent TécnicoFS instance. Each instance has tables, data blocks,
+ * locks and a background scrubber of its own, so operations on different
+ * instances never contend with each other (file handles are also per
+ * instance).
+ *
+ * The functions above operate on a default instance, set up by tfs_init. The
+ * tfs_ctx_* functions below take the instance explicitly, and otherwise
+ * behave exactly like their counterparts above.
+ */
+typedef struct tfs_ctx tfs_ctx;
+
+/**
+ * Create and initialize a new instance, optionally with a given
+ * configuration (see tfs_init).
+ * Returns the instance if successful, NULL otherwise.
+ */
+tfs_ctx *tfs_ctx_create(tfs_params const *params);
+
+/**
+ * Destroy an instance created with tfs_ctx_create (see tfs_destroy).
+ * Returns 0 if successful, -1 otherwise.
+ */
+int tfs_ctx_destroy(tfs_ctx *ctx);
+
+int tfs_ctx_reset(tfs_ctx *ctx);
+void tfs_ctx_get_stats(tfs_ctx *ctx, tfs_stats_t *stats);
+int tfs_ctx_open(tfs_ctx *ctx, char const *name, tfs_file_mode_t mode);
+int tfs_ctx_sym_link(tfs_ctx *ctx, char const *target, char const *link_name);
+int tfs_ctx_link(tfs_ctx *ctx, char const *target_file, char const *link_name);
+int tfs_ctx_close(tfs_ctx *ctx, int fhandle);
+ssize_t tfs_ctx_write(tfs_ctx *ctx, int fhandle, void const *buffer,
+                      size_t len);
+ssize_t tfs_ctx_read(tfs_ctx *ctx, int fhandle, void *buffer, size_t len);
+int tfs_ctx_opendir(tfs_ctx *ctx, char const *path);
+ssize_t tfs_ctx_readdir_batch(tfs_ctx *ctx, int dhandle, tfs_dirent_t *entries,
+                              size_t max_entries);
+int tfs_ctx_closedir(tfs_ctx *ctx, int dhandle);
+ssize_t tfs_ctx_list_prefix(tfs_ctx *ctx, char const *dir, char const *prefix,
+                            tfs_dirent_callback_t cb, void *arg);
+ssize_t tfs_ctx_writev(tfs_ctx *ctx, int fhandle, struct iovec const *iov,
+                       int iovcnt);
+ssize_t tfs_ctx_readv(tfs_ctx *ctx, int fhandle, struct iovec const *iov,
+                      int iovcnt);
+int tfs_ctx_clone(tfs_ctx *ctx, char const *source, char const *dest);
+ssize_t tfs_ctx_copy_file_range(tfs_ctx *ctx, int src_fhandle,
+                                size_t src_offset, int dst_fhandle,
+                                size_t dst_offset, size_t len);
+int tfs_ctx_read_view(tfs_ctx *ctx, int fhandle, size_t offset, size_t len,
+                      tfs_view_t *view);
+int tfs_ctx_release_view(tfs_ctx *ctx, tfs_view_t *view);
+int tfs_ctx_snapshot_create(tfs_ctx *ctx);
+int tfs_ctx_snapshot_destroy(tfs_ctx *ctx);
+int tfs_ctx_snapshot_open(tfs_ctx *ctx, char const *name);
+int tfs_ctx_mark_cold(tfs_ctx *ctx, char const *name);
+ssize_t tfs_ctx_fsck(tfs_ctx *ctx, tfs_fsck_report_t *report,
+                     int thread_count);
+int tfs_ctx_unlink(tfs_ctx *ctx, char const *target);
+int tfs_ctx_copy_from_external_fs(tfs_ctx *ctx, char const *source_path,
+                                  char const *dest_path);
+int tfs_ctx_map_from_external_fs(tfs_ctx *ctx, char const *source_path,
+                                 char const *dest_path);
+int tfs_ctx_copy_to_external_fs(tfs_ctx *ctx, char const *source_path,
+                                char const *dest_path);
+ssize_t tfs_ctx_import_tree(tfs_ctx *ctx, char const *host_dir,
+                            char const *tfs_dir, int thread_count,
+                            tfs_import_report_t *report);
+ssize_t tfs_ctx_import_tar(tfs_ctx *ctx, int fd);
+ssize_t tfs_ctx_export_tar(tfs_ctx *ctx, int fd);
+int tfs_ctx_save_image(tfs_ctx *ctx, char const *path);
+int tfs_ctx_load_image(tfs_ctx *ctx, char const *path, int thread_count);
+
 #endif // OPERATIONS_H
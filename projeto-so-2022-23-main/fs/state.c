@@ -1,55 +1,300 @@
+// MAP_ANONYMOUS, MAP_NORESERVE and madvise
+#define _DEFAULT_SOURCE
+
 #include "state.h"
 #include "betterassert.h"
+#include "compress.h"
+#include "crc32c.h"
 
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 /*
  * Persistent FS state
  * (in reality, it should be maintained in secondary memory;
  * for simplicity, this project maintains it in primary memory).
  */
-static tfs_params fs_params;
-
-// Inode table
-static inode_t *inode_table;
-static allocation_state_t *freeinode_ts;
-
-// Data blocks
-static char *fs_data; // # blocks * block size
-static allocation_state_t *free_blocks;
 
-// Put all table allocations in mutual exclusion
-pthread_rwlock_t file_table_alloc_rwlock;
-pthread_rwlock_t inode_alloc_rwlock;
-pthread_rwlock_t data_block_alloc_rwlock;
+// Per-directory lookup side structures (indexed by inumber, only set up for
+// directory inodes)
+typedef struct {
+    // one name-hash tag per directory entry slot (0 means the slot is empty),
+    // padded so that SIMD loads past the last slot stay in bounds
+    uint8_t *tags;
+    // counting Bloom filter over the names in the directory, so that lookups
+    // for names that don't exist rarely need to scan the directory
+    uint8_t *bloom;
+    // slots of the used entries, sorted by name (only kept if the
+    // dir_prefix_index parameter is set)
+    uint32_t *sorted;
+    size_t sorted_count;
+} dir_index_t;
+
+// Compressed contents of cold blocks, in a variable-size pool (data is NULL
+// for blocks kept uncompressed in the data block area); see
+// data_block_compress
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    // length of the original contents
+    size_t raw_len;
+} compressed_block_t;
+
+// Dedup index entry (only used if the dedup parameter is set): blocks whose
+// contents are indexed by their hash, chained per bucket (see inode_dedup)
+typedef struct {
+    uint64_t hash[2];
+    // length of the indexed contents (the rest of the block is unused)
+    size_t len;
+    // next block in the same bucket, or -1
+    int next;
+    bool indexed;
+} block_digest_t;
+
+// Host files mapped into the FS (see data_block_map). They are addressed as
+// blocks numbered from DATA_BLOCKS on, and shared and released like the
+// regular blocks; writing to one copies its contents into a regular block
+typedef struct {
+    char *data;
+    size_t len;
+    uint32_t refs;
+    size_t next_free; // next slot in the free list, while unmapped
+} mapped_block_t;
+
+#define NO_MAPPED_SLOT SIZE_MAX
+
+// Snapshot of the whole FS (at most one at a time). Taking it only starts a
+// new epoch: the state of each inode as of the snapshot is saved the first
+// time the inode changes afterwards (see snapshot_preserve), and the saved data
+// block stays referenced, so the live inode copies it on write from then on
+typedef struct {
+    allocation_state_t state;
+    inode_type type;
+    size_t size;
+    int data_block;
+} inode_snapshot_t;
+
+// Inode table, grown on demand in chunks of INODE_CHUNK_SIZE inodes: a chunk
+// is only allocated (and its locks initialized) when an inode in it is first
+// needed, and never moves afterwards, so inode_t pointers stay valid. Within
+// a chunk, the fields touched by lookups and bulk scans are kept in dense
+// parallel arrays, while the cold per-inode state (lock, link count) stays in
+// inodes. Use the INODE_* macros below to reach an inode's fields.
+#define INODE_CHUNK_SHIFT (8)
+#define INODE_CHUNK_SIZE ((size_t)1 << INODE_CHUNK_SHIFT)
+
+typedef struct {
+    inode_t inodes[INODE_CHUNK_SIZE];
+    allocation_state_t states[INODE_CHUNK_SIZE];
+    uint8_t types[INODE_CHUNK_SIZE];
+    size_t sizes[INODE_CHUNK_SIZE];
+    int data_blocks[INODE_CHUNK_SIZE];
+    // Resolved-target cache of symlink inodes: the final (non-symlink)
+    // inumber reached from each symlink, packed with the namespace generation
+    // at the time it was resolved (see symlink_cache_set)
+    uint64_t symlink_targets[INODE_CHUNK_SIZE];
+    // only set up for directory inodes
+    dir_index_t dir_indexes[INODE_CHUNK_SIZE];
+    // epoch in which each inode was last saved for the snapshot, and its
+    // state as of the snapshot
+    uint32_t snapshot_epochs[INODE_CHUNK_SIZE];
+    inode_snapshot_t snapshot_inodes[INODE_CHUNK_SIZE];
+} inode_chunk_t;
 
 /*
  * Volatile FS state
  */
-static open_file_entry_t *open_file_table;
-static allocation_state_t *free_open_file_entries;
+// Open file table, grown on demand in chunks like the inode table
+#define OPEN_FILE_CHUNK_SHIFT (6)
+#define OPEN_FILE_CHUNK_SIZE ((size_t)1 << OPEN_FILE_CHUNK_SHIFT)
 
+typedef struct {
+    open_file_entry_t entries[OPEN_FILE_CHUNK_SIZE];
+    allocation_state_t states[OPEN_FILE_CHUNK_SIZE];
+} open_file_chunk_t;
+
+/*
+ * FS instance: everything above, for one FS. Instances share nothing, so
+ * operations on different ones never contend for the same locks.
+ */
+struct tfs_ctx {
+    tfs_params params;
+
+    // Bumped whenever a directory entry or inode is removed, which
+    // invalidates every cached symlink resolution
+    uint32_t ns_generation;
+
+    // FS statistics (updated with relaxed atomic operations)
+    tfs_stats_t stats;
+
+    // Data blocks
+    // # blocks * block size, in an anonymous mapping whose pages are only
+    // committed when first written to (see data_block_area_map), and given
+    // back when the blocks in them are freed (see data_block_release)
+    char *data;
+    size_t data_len;
+    allocation_state_t *free_blocks;
+    // one past the highest block taken since the FS was initialized or
+    // reset, so that state_reset only goes over the blocks that were ever used
+    size_t block_high_water;
+    // number of inodes referencing each taken block (blocks are shared
+    // between clones, and copied on write)
+    uint32_t *block_refcounts;
+    compressed_block_t *compressed_blocks;
+    pthread_mutex_t compression_mutex;
+    block_digest_t *block_digests;
+    int *dedup_buckets;
+    size_t dedup_bucket_mask;
+    pthread_mutex_t dedup_mutex;
+    mapped_block_t *mapped_blocks; // INODE_TABLE_SIZE slots
+    // slots from mapped_high_water on have never been used; the ones below it
+    // that were unmapped are chained from mapped_free_head
+    size_t mapped_high_water;
+    size_t mapped_free_head;
+    pthread_mutex_t mapping_mutex;
+    // CRC-32C of the contents of each block, valid while the block's sequence
+    // number is even: it is odd while the block is being written to (see
+    // data_block_get_for_write and data_block_written), so that checks that
+    // don't hold the owner's lock (the scrubber's) can tell a changing block
+    // from a corrupted one
+    uint32_t *block_checksums;
+    uint32_t *block_seqs;
+
+    // Background scrubber, verifying the checksums of the taken blocks
+    pthread_t scrub_thread;
+    bool scrub_running;
+
+    bool snapshot_active;
+    uint32_t snapshot_epoch;
+    // inumbers saved in the current epoch, to release them without a full
+    // scan
+    int *snapshot_saved;
+    size_t snapshot_saved_count;
+    // number of open file handles into the snapshot
+    size_t snapshot_handles;
+    pthread_mutex_t snapshot_mutex;
+
+    // room for every chunk up to max_inode_count (only the pointers)
+    inode_chunk_t **inode_chunks;
+    // number of inodes in the allocated chunks (only grows while the FS is
+    // up)
+    size_t inode_capacity;
+
+    // Put all table allocations in mutual exclusion
+    pthread_rwlock_t file_table_alloc_rwlock;
+    pthread_rwlock_t inode_alloc_rwlock;
+    pthread_rwlock_t data_block_alloc_rwlock;
+
+    open_file_chunk_t **open_file_chunks;
+    size_t open_file_capacity;
+};
+
+// The instance used by the tfs_* functions without a context
+static tfs_ctx default_ctx;
+// The instance the calling thread operates on (see state_enter)
+static _Thread_local tfs_ctx *fs = &default_ctx;
+
+// Host page size (the same for every instance)
+static size_t page_size;
+
+#define STAT_ADD(field, value)                                                 \
+    __atomic_fetch_add(&fs->stats.field, (value), __ATOMIC_RELAXED)
+#define STAT_SUB(field, value)                                                 \
+    __atomic_fetch_sub(&fs->stats.field, (value), __ATOMIC_RELAXED)
+#define STAT_LOAD(dest, field)                                                 \
+    ((dest)->field = __atomic_load_n(&fs->stats.field, __ATOMIC_RELAXED))
+
+#define INODE_FIELD(field, inumber)                                            \
+    (fs->inode_chunks[(size_t)(inumber) >> INODE_CHUNK_SHIFT]                  \
+         ->field[(size_t)(inumber) & (INODE_CHUNK_SIZE - 1)])
+#define INODE(inumber) INODE_FIELD(inodes, inumber)
+#define INODE_STATE(inumber) INODE_FIELD(states, inumber)
+#define INODE_TYPE(inumber) INODE_FIELD(types, inumber)
+#define INODE_SIZE(inumber) INODE_FIELD(sizes, inumber)
+#define INODE_BLOCK(inumber) INODE_FIELD(data_blocks, inumber)
+#define SYMLINK_TARGET(inumber) INODE_FIELD(symlink_targets, inumber)
+#define DIR_INDEX(inumber) INODE_FIELD(dir_indexes, inumber)
+#define SNAPSHOT_EPOCH(inumber) INODE_FIELD(snapshot_epochs, inumber)
+#define SNAPSHOT_INODE(inumber) INODE_FIELD(snapshot_inodes, inumber)
+
+#define OPEN_FILE_FIELD(field, fhandle)                                        \
+    (fs->open_file_chunks[(size_t)(fhandle) >> OPEN_FILE_CHUNK_SHIFT]          \
+         ->field[(size_t)(fhandle) & (OPEN_FILE_CHUNK_SIZE - 1)])
+#define OPEN_FILE(fhandle) OPEN_FILE_FIELD(entries, fhandle)
+#define OPEN_FILE_STATE(fhandle) OPEN_FILE_FIELD(states, fhandle)
 // Convenience macros
-#define INODE_TABLE_SIZE (fs_params.max_inode_count)
-#define DATA_BLOCKS (fs_params.max_block_count)
-#define MAX_OPEN_FILES (fs_params.max_open_files_count)
-#define BLOCK_SIZE (fs_params.block_size)
+#define INODE_TABLE_SIZE (fs->params.max_inode_count)
+#define DATA_BLOCKS (fs->params.max_block_count)
+#define MAX_OPEN_FILES (fs->params.max_open_files_count)
+#define BLOCK_SIZE (fs->params.block_size)
 #define MAX_DIR_ENTRIES (BLOCK_SIZE / sizeof(dir_entry_t))
 
+// The scrubber checks blocks in batches, every SCRUB_TICK_NS
+#define SCRUB_TICK_NS (10000000)
+// Alignment of the data block area in the huge_pages mode
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+// Cold blocks are only kept compressed if that saves at least 1/8 of them
+#define COLD_MIN_SAVING (8)
+
+// Number of tags compared per instruction when searching a directory
+#if defined(__AVX2__)
+#define TAG_GROUP (32)
+#else
+#define TAG_GROUP (16)
+#endif
+#define DIR_TAGS_SIZE                                                          \
+    ((MAX_DIR_ENTRIES + TAG_GROUP - 1) / TAG_GROUP * TAG_GROUP + TAG_GROUP)
+
+// Bloom filter geometry: at least BLOOM_COUNTERS_PER_ENTRY counters per
+// directory entry slot (rounded up to a power of two), BLOOM_PROBES probes per
+// name; this keeps the false positive rate of a full directory around 3%
+#define BLOOM_COUNTERS_PER_ENTRY (8)
+#define BLOOM_PROBES (3)
+#define BLOOM_COUNTER_MAX (UINT8_MAX)
+
+// Only the inodes in allocated chunks are valid
 static inline bool valid_inumber(int inumber) {
-    return inumber >= 0 && inumber < INODE_TABLE_SIZE;
+    return inumber >= 0 &&
+           inumber < __atomic_load_n(&fs->inode_capacity, __ATOMIC_ACQUIRE);
 }
 
 static inline bool valid_block_number(int block_number) {
     return block_number >= 0 && block_number < DATA_BLOCKS;
 }
 
+static inline bool mapped_block_number(int block_number) {
+    return block_number >= DATA_BLOCKS &&
+           block_number < DATA_BLOCKS + INODE_TABLE_SIZE;
+}
+
+static inline mapped_block_t *mapped_block(int block_number) {
+    return &fs->mapped_blocks[(size_t)block_number - DATA_BLOCKS];
+}
+
 static inline bool valid_file_handle(int file_handle) {
-    return file_handle >= 0 && file_handle < MAX_OPEN_FILES;
+    return file_handle >= 0 &&
+           file_handle <
+               __atomic_load_n(&fs->open_file_capacity, __ATOMIC_ACQUIRE);
+}
+
+static inline size_t chunk_count(size_t entries, size_t chunk_size) {
+    return (entries + chunk_size - 1) / chunk_size;
 }
 
 size_t state_block_size(void) { return BLOCK_SIZE; }
@@ -88,6 +333,349 @@ static void insert_delay(void) {
     }
 }
 
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * Checks the contents of a block against its checksum.
+ * Returns false only if they don't match; blocks that are being written to
+ * (or that change during the check) are assumed to be fine.
+ */
+static bool data_block_verify(int block_number) {
+    uint32_t seq = __atomic_load_n(&fs->block_seqs[block_number], __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+        return true;
+    }
+
+    double start = now_ns();
+    uint32_t checksum =
+        crc32c(&fs->data[(size_t)block_number * BLOCK_SIZE], BLOCK_SIZE);
+    STAT_ADD(checksum_ns, (size_t)(now_ns() - start));
+    STAT_ADD(checksum_bytes, BLOCK_SIZE);
+
+    uint32_t expected =
+        __atomic_load_n(&fs->block_checksums[block_number], __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&fs->block_seqs[block_number], __ATOMIC_RELAXED) != seq ||
+        checksum == expected) {
+        return true;
+    }
+
+    STAT_ADD(checksum_errors, 1);
+    return false;
+}
+
+/*
+ * Body of the scrubber thread: verifies the taken blocks, round-robin, at
+ * scrub_rate blocks per second.
+ */
+static void *scrub_main(void *arg) {
+    fs = arg;
+
+    // wake up every SCRUB_TICK_NS (at most), to check a batch of blocks
+    size_t batch = fs->params.scrub_rate * SCRUB_TICK_NS / 1000000000;
+    if (batch == 0) {
+        batch = 1;
+    }
+    long period_ns = (long)(batch * 1000000000 / fs->params.scrub_rate);
+    struct timespec period = {.tv_sec = period_ns / 1000000000,
+                              .tv_nsec = period_ns % 1000000000};
+
+    size_t next = 0;
+    while (__atomic_load_n(&fs->scrub_running, __ATOMIC_ACQUIRE)) {
+        for (size_t i = 0; i < batch; i++) {
+            if (__atomic_load_n(&fs->free_blocks[next], __ATOMIC_RELAXED) ==
+                TAKEN) {
+                data_block_verify((int)next);
+                STAT_ADD(scrubbed_blocks, 1);
+            }
+            next = (next + 1) % DATA_BLOCKS;
+        }
+        nanosleep(&period, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * Hash a directory entry name (FNV-1a, 64 bits).
+ *
+ * Only the first MAX_FILE_NAME characters are considered, matching the
+ * comparisons done by the directory functions.
+ */
+static uint64_t name_hash(char const *name) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < MAX_FILE_NAME && name[i] != '\0'; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Compute the (never zero) tag stored for a name in a directory's tag array.
+ */
+static uint8_t name_tag(char const *name) {
+    uint8_t tag = (uint8_t)(name_hash(name) >> 56);
+    return tag == 0 ? 1 : tag;
+}
+
+/**
+ * Compare TAG_GROUP consecutive tags against a given tag.
+ *
+ * Returns a bit mask with bit i set if tags[i] == tag.
+ */
+static inline uint32_t tag_match_mask(uint8_t const *tags, uint8_t tag) {
+#if defined(__AVX2__)
+    __m256i group = _mm256_loadu_si256((__m256i const *)tags);
+    __m256i eq = _mm256_cmpeq_epi8(group, _mm256_set1_epi8((char)tag));
+    return (uint32_t)_mm256_movemask_epi8(eq);
+#elif defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((__m128i const *)tags);
+    __m128i eq = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag));
+    return (uint32_t)_mm_movemask_epi8(eq);
+#else
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < TAG_GROUP; i++) {
+        mask |= (uint32_t)(tags[i] == tag) << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Find the first slot in [from, count) of a tag array holding a given tag.
+ *
+ * Returns the slot index, or count if there is no such slot.
+ */
+static size_t tag_find(uint8_t const *tags, size_t from, size_t count,
+                       uint8_t tag) {
+    for (size_t i = from; i < count; i += TAG_GROUP) {
+        uint32_t mask = tag_match_mask(tags + i, tag);
+        if (mask != 0) {
+            size_t found = i + (size_t)__builtin_ctz(mask);
+            return found < count ? found : count;
+        }
+    }
+    return count;
+}
+
+/**
+ * Number of counters in each directory's Bloom filter (a power of two).
+ */
+static size_t bloom_size(void) {
+    size_t size = 64;
+    while (size < MAX_DIR_ENTRIES * BLOOM_COUNTERS_PER_ENTRY) {
+        size <<= 1;
+    }
+    return size;
+}
+
+/**
+ * Compute the BLOOM_PROBES counter positions of a name (double hashing).
+ */
+static void bloom_probes(char const *name, size_t probes[BLOOM_PROBES]) {
+    uint64_t hash = name_hash(name);
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash >> 32) | 1;
+    size_t mask = bloom_size() - 1;
+    for (size_t i = 0; i < BLOOM_PROBES; i++) {
+        probes[i] = (size_t)(h1 + i * h2) & mask;
+    }
+}
+
+/**
+ * Add a name to a directory's Bloom filter.
+ * Saturated counters are never changed again, since their true value is lost.
+ */
+static void bloom_add(uint8_t *bloom, char const *name) {
+    size_t probes[BLOOM_PROBES];
+    bloom_probes(name, probes);
+    for (size_t i = 0; i < BLOOM_PROBES; i++) {
+        if (bloom[probes[i]] < BLOOM_COUNTER_MAX) {
+            bloom[probes[i]]++;
+        }
+    }
+}
+
+/**
+ * Remove a name (previously added with bloom_add) from a Bloom filter.
+ */
+static void bloom_remove(uint8_t *bloom, char const *name) {
+    size_t probes[BLOOM_PROBES];
+    bloom_probes(name, probes);
+    for (size_t i = 0; i < BLOOM_PROBES; i++) {
+        if (bloom[probes[i]] < BLOOM_COUNTER_MAX) {
+            bloom[probes[i]]--;
+        }
+    }
+}
+
+/**
+ * Check whether a name may be in a directory's Bloom filter.
+ *
+ * Returns false only if the name is definitely not in the directory.
+ */
+static bool bloom_may_contain(uint8_t const *bloom, char const *name) {
+    size_t probes[BLOOM_PROBES];
+    bloom_probes(name, probes);
+    for (size_t i = 0; i < BLOOM_PROBES; i++) {
+        if (bloom[probes[i]] == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Find the first position of a directory's sorted index whose name is not
+ * lexicographically smaller than a given name.
+ */
+static size_t sorted_lower_bound(dir_index_t const *index,
+                                 dir_entry_t const *dir_entry,
+                                 char const *name) {
+    size_t lo = 0, hi = index->sorted_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (strncmp(dir_entry[index->sorted[mid]].d_name, name,
+                    MAX_FILE_NAME) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * Insert the (already filled) directory slot into the sorted index.
+ */
+static void sorted_insert(dir_index_t *index, dir_entry_t const *dir_entry,
+                          size_t slot) {
+    size_t pos = sorted_lower_bound(index, dir_entry, dir_entry[slot].d_name);
+    memmove(&index->sorted[pos + 1], &index->sorted[pos],
+            (index->sorted_count - pos) * sizeof(uint32_t));
+    index->sorted[pos] = (uint32_t)slot;
+    index->sorted_count++;
+}
+
+/**
+ * Remove the (still filled) directory slot from the sorted index.
+ */
+static void sorted_remove(dir_index_t *index, dir_entry_t const *dir_entry,
+                          size_t slot) {
+    // Entries with the same name (if any) are next to each other
+    size_t pos = sorted_lower_bound(index, dir_entry, dir_entry[slot].d_name);
+    while (pos < index->sorted_count && index->sorted[pos] != slot) {
+        pos++;
+    }
+    ALWAYS_ASSERT(pos < index->sorted_count,
+                  "sorted_remove: slot missing from the sorted index");
+
+    memmove(&index->sorted[pos], &index->sorted[pos + 1],
+            (index->sorted_count - pos - 1) * sizeof(uint32_t));
+    index->sorted_count--;
+}
+
+/*
+ * Maps the area holding the data blocks. Only address space is reserved: the
+ * pages are committed when first written to, so memory use follows the blocks
+ * in use rather than max_block_count. With the huge_pages parameter, the area
+ * is aligned so that it can be backed by transparent huge pages.
+ * Returns NULL if the area could not be mapped.
+ */
+static char *data_block_area_map(void) {
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    fs->data_len = DATA_BLOCKS * BLOCK_SIZE;
+    size_t slack = 0;
+    if (fs->params.huge_pages) {
+        fs->data_len = (fs->data_len + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE *
+                      HUGE_PAGE_SIZE;
+        slack = HUGE_PAGE_SIZE;
+    }
+
+    char *area = mmap(NULL, fs->data_len + slack, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED) {
+        return NULL;
+    }
+    if (fs->params.huge_pages) {
+        size_t head = (HUGE_PAGE_SIZE - (uintptr_t)area % HUGE_PAGE_SIZE) %
+                      HUGE_PAGE_SIZE;
+        if (head > 0) {
+            ALWAYS_ASSERT(munmap(area, head) == 0, "munmap");
+        }
+        if (slack > head) {
+            ALWAYS_ASSERT(munmap(area + head + fs->data_len, slack - head) == 0,
+                          "munmap");
+        }
+        area += head;
+#ifdef MADV_HUGEPAGE
+        // only a hint: transparent huge pages may be disabled
+        madvise(area, fs->data_len, MADV_HUGEPAGE);
+#endif
+    }
+    return area;
+}
+
+/**
+ * Allocate a new instance, still to be initialized (see state_init).
+ * Returns the instance, or NULL if the allocation failed.
+ */
+tfs_ctx *state_ctx_new(void) { return calloc(1, sizeof(tfs_ctx)); }
+
+/**
+ * Free an instance allocated with state_ctx_new, once destroyed (see
+ * state_destroy).
+ */
+void state_ctx_free(tfs_ctx *ctx) {
+    ALWAYS_ASSERT(ctx != &default_ctx, "state_ctx_free: default instance");
+    ALWAYS_ASSERT(ctx->inode_chunks == NULL, "state_ctx_free: still in use");
+    free(ctx);
+}
+
+/**
+ * Returns the instance the calling thread operates on.
+ */
+tfs_ctx *state_current(void) { return fs; }
+
+/**
+ * Makes the calling thread operate on the given instance.
+ * Returns the instance it operated on before.
+ */
+tfs_ctx *state_enter(tfs_ctx *ctx) {
+    tfs_ctx *prev = fs;
+    fs = ctx;
+    return prev;
+}
+
+/**
+ * Makes the calling thread operate on the instance returned by state_enter
+ * again (the cleanup function of SCOPED_CTX).
+ */
+void state_leave(tfs_ctx **prev) { fs = *prev; }
+
+/* Starts the scrubber, if enabled. Returns 0 if successful, -1 otherwise. */
+static int scrub_start(void) {
+    fs->scrub_running = fs->params.scrub_rate > 0;
+    if (fs->scrub_running &&
+        pthread_create(&fs->scrub_thread, NULL, scrub_main, fs) != 0) {
+        fs->scrub_running = false;
+        return -1;
+    }
+    return 0;
+}
+
+/* Stops the scrubber, if running, and waits for it. */
+static void scrub_stop(void) {
+    if (fs->scrub_running) {
+        __atomic_store_n(&fs->scrub_running, false, __ATOMIC_RELEASE);
+        ALWAYS_ASSERT(pthread_join(fs->scrub_thread, NULL) == 0, "pthread_join");
+    }
+}
+
 /**
  * Initialize FS state.
  *
@@ -101,83 +689,412 @@ static void insert_delay(void) {
  *   - malloc failure when allocating TFS structures.
  */
 int state_init(tfs_params params) {
-    fs_params = params;
-
-    if (inode_table != NULL) {
+    if (fs->inode_chunks != NULL) {
         return -1; // already initialized
     }
-
-    inode_table = malloc(INODE_TABLE_SIZE * sizeof(inode_t));
-    freeinode_ts = malloc(INODE_TABLE_SIZE * sizeof(allocation_state_t));
-    fs_data = malloc(DATA_BLOCKS * BLOCK_SIZE);
-    free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
-    open_file_table = malloc(MAX_OPEN_FILES * sizeof(open_file_entry_t));
-    free_open_file_entries =
-        malloc(MAX_OPEN_FILES * sizeof(allocation_state_t));
-
-    if (!inode_table || !freeinode_ts || !fs_data || !free_blocks ||
-        !open_file_table || !free_open_file_entries) {
+    fs->params = params;
+
+    // The inode and open file tables start empty (see inode_table_grow and
+    // open_file_table_grow)
+    fs->inode_chunks = calloc(chunk_count(INODE_TABLE_SIZE, INODE_CHUNK_SIZE),
+                          sizeof(inode_chunk_t *));
+    fs->inode_capacity = 0;
+    fs->open_file_chunks =
+        calloc(chunk_count(MAX_OPEN_FILES, OPEN_FILE_CHUNK_SIZE),
+               sizeof(open_file_chunk_t *));
+    fs->open_file_capacity = 0;
+    fs->data = data_block_area_map();
+    fs->free_blocks = malloc(DATA_BLOCKS * sizeof(allocation_state_t));
+    fs->block_refcounts = malloc(DATA_BLOCKS * sizeof(uint32_t));
+    fs->compressed_blocks = calloc(DATA_BLOCKS, sizeof(compressed_block_t));
+    fs->block_digests = calloc(DATA_BLOCKS, sizeof(block_digest_t));
+    fs->block_checksums = calloc(DATA_BLOCKS, sizeof(uint32_t));
+    fs->block_seqs = calloc(DATA_BLOCKS, sizeof(uint32_t));
+    fs->mapped_blocks = calloc(INODE_TABLE_SIZE, sizeof(mapped_block_t));
+    fs->dedup_bucket_mask = 1;
+    while (fs->dedup_bucket_mask < DATA_BLOCKS) {
+        fs->dedup_bucket_mask <<= 1;
+    }
+    fs->dedup_buckets = malloc(fs->dedup_bucket_mask * sizeof(int));
+    fs->dedup_bucket_mask--;
+    fs->snapshot_saved = malloc(INODE_TABLE_SIZE * sizeof(int));
+
+    if (!fs->inode_chunks || !fs->open_file_chunks || !fs->data || !fs->free_blocks ||
+        !fs->block_refcounts || !fs->compressed_blocks || !fs->block_digests ||
+        !fs->dedup_buckets || !fs->block_checksums || !fs->block_seqs || !fs->mapped_blocks ||
+        !fs->snapshot_saved) {
         return -1; // allocation failed
     }
+    fs->ns_generation = 0;
+    fs->block_high_water = 0;
+    fs->mapped_high_water = 0;
+    fs->mapped_free_head = NO_MAPPED_SLOT;
+
+    for (size_t i = 0; i < DATA_BLOCKS; i++) {
+        fs->free_blocks[i] = FREE;
+        fs->block_refcounts[i] = 0;
+    }
+    for (size_t i = 0; i <= fs->dedup_bucket_mask; i++) {
+        fs->dedup_buckets[i] = -1;
+    }
 
-    for(int i=0;i<INODE_TABLE_SIZE;i++)
-        pthread_rwlock_init(&inode_table[i].rwlock, NULL);
+    pthread_rwlock_init(&fs->file_table_alloc_rwlock, NULL);
+    pthread_rwlock_init(&fs->inode_alloc_rwlock, NULL);
+    pthread_rwlock_init(&fs->data_block_alloc_rwlock, NULL);
+    pthread_mutex_init(&fs->compression_mutex, NULL);
+    pthread_mutex_init(&fs->dedup_mutex, NULL);
+    pthread_mutex_init(&fs->mapping_mutex, NULL);
 
-    for(int i=0;i<MAX_OPEN_FILES;i++)
-        pthread_mutex_init(&open_file_table[i].mtx, NULL);
-    
+    fs->snapshot_active = false;
+    fs->snapshot_epoch = 0;
+    fs->snapshot_saved_count = 0;
+    fs->snapshot_handles = 0;
+    pthread_mutex_init(&fs->snapshot_mutex, NULL);
+
+    memset(&fs->stats, 0, sizeof(fs->stats));
 
-    for (size_t i = 0; i < INODE_TABLE_SIZE; i++) {
-        freeinode_ts[i] = FREE;
+    return scrub_start();
+}
+
+/**
+ * Destroy FS state.
+ *
+ * Returns 0 if succesful, -1 otherwise.
+ */
+int state_destroy(void) {
+    scrub_stop();
+
+    for (size_t c = 0; c < chunk_count(fs->inode_capacity, INODE_CHUNK_SIZE);
+         c++) {
+        inode_chunk_t *chunk = fs->inode_chunks[c];
+        for (size_t i = 0; i < INODE_CHUNK_SIZE; i++) {
+            pthread_rwlock_destroy(&chunk->inodes[i].rwlock);
+            free(chunk->dir_indexes[i].tags);
+            free(chunk->dir_indexes[i].bloom);
+            free(chunk->dir_indexes[i].sorted);
+        }
+        free(chunk);
     }
+    free(fs->inode_chunks);
 
+    for (size_t c = 0;
+         c < chunk_count(fs->open_file_capacity, OPEN_FILE_CHUNK_SIZE); c++) {
+        open_file_chunk_t *chunk = fs->open_file_chunks[c];
+        for (size_t i = 0; i < OPEN_FILE_CHUNK_SIZE; i++) {
+            pthread_mutex_destroy(&chunk->entries[i].mtx);
+        }
+        free(chunk);
+    }
+    free(fs->open_file_chunks);
+
+    pthread_rwlock_destroy(&fs->file_table_alloc_rwlock);
+    pthread_rwlock_destroy(&fs->inode_alloc_rwlock);
+    pthread_rwlock_destroy(&fs->data_block_alloc_rwlock);
+    pthread_mutex_destroy(&fs->snapshot_mutex);
+    pthread_mutex_destroy(&fs->compression_mutex);
+    pthread_mutex_destroy(&fs->dedup_mutex);
+    pthread_mutex_destroy(&fs->mapping_mutex);
+
+    if (fs->data != NULL) {
+        ALWAYS_ASSERT(munmap(fs->data, fs->data_len) == 0, "munmap");
+    }
+    free(fs->free_blocks);
+    free(fs->block_refcounts);
     for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        free_blocks[i] = FREE;
+        free(fs->compressed_blocks[i].data);
     }
-
-    for (size_t i = 0; i < MAX_OPEN_FILES; i++) {
-        free_open_file_entries[i] = FREE;
+    free(fs->compressed_blocks);
+    free(fs->block_digests);
+    free(fs->dedup_buckets);
+    free(fs->block_checksums);
+    free(fs->block_seqs);
+    for (size_t i = 0; i < fs->mapped_high_water; i++) {
+        if (fs->mapped_blocks[i].data != NULL) {
+            ALWAYS_ASSERT(munmap(fs->mapped_blocks[i].data, fs->mapped_blocks[i].len) ==
+                              0,
+                          "munmap");
+        }
     }
-
-    pthread_rwlock_init(&file_table_alloc_rwlock, NULL);
-    pthread_rwlock_init(&inode_alloc_rwlock, NULL);
-    pthread_rwlock_init(&data_block_alloc_rwlock, NULL);
+    free(fs->mapped_blocks);
+    free(fs->snapshot_saved);
+
+    fs->inode_chunks = NULL;
+    fs->inode_capacity = 0;
+    fs->open_file_chunks = NULL;
+    fs->open_file_capacity = 0;
+    fs->data = NULL;
+    fs->free_blocks = NULL;
+    fs->block_refcounts = NULL;
+    fs->compressed_blocks = NULL;
+    fs->block_digests = NULL;
+    fs->dedup_buckets = NULL;
+    fs->block_checksums = NULL;
+    fs->block_seqs = NULL;
+    fs->mapped_blocks = NULL;
+    fs->snapshot_saved = NULL;
 
     return 0;
 }
 
 /**
- * Destroy FS state.
+ * Empty the FS state, down to an empty root directory, keeping the
+ * allocations and locks (see tfs_reset).
  *
- * Returns 0 if succesful, -1 otherwise.
+ * Returns 0 if successful, -1 otherwise.
  */
-int state_destroy(void) {
+int state_reset(void) {
+    if (fs->inode_chunks == NULL || fs->inode_capacity == 0 ||
+        INODE_STATE(ROOT_DIR_INUM) != TAKEN) {
+        return -1; // not initialized
+    }
+
+    // nothing else may touch the blocks while they are reset
+    scrub_stop();
+
+    for (size_t h = 0; h < fs->open_file_capacity; h++) {
+        OPEN_FILE_STATE(h) = FREE;
+    }
+
+    // The saved inodes need no cleanup: their blocks are freed below, and the
+    // epoch of the next snapshot won't match theirs
+    fs->snapshot_active = false;
+    fs->snapshot_saved_count = 0;
+    fs->snapshot_handles = 0;
+
+    // Only the allocated chunks can hold taken inodes; their locks and the
+    // root directory's index are kept
+    for (size_t i = ROOT_DIR_INUM + 1; i < fs->inode_capacity; i++) {
+        if (INODE_STATE(i) == FREE) {
+            continue;
+        }
+        if (INODE_TYPE(i) == T_DIRECTORY) {
+            free(DIR_INDEX(i).tags);
+            free(DIR_INDEX(i).bloom);
+            free(DIR_INDEX(i).sorted);
+            DIR_INDEX(i).tags = NULL;
+            DIR_INDEX(i).bloom = NULL;
+            DIR_INDEX(i).sorted = NULL;
+        }
+        INODE_STATE(i) = FREE;
+    }
+    __atomic_fetch_add(&fs->ns_generation, 1, __ATOMIC_RELEASE);
+
+    // Only the blocks up to the high water mark were ever taken, and their
+    // pages are given back in a single call
+    size_t root_block = (size_t)INODE_BLOCK(ROOT_DIR_INUM);
+    for (size_t b = 0; b < fs->block_high_water; b++) {
+        free(fs->compressed_blocks[b].data);
+        fs->compressed_blocks[b].data = NULL;
+        if (fs->block_digests[b].indexed) {
+            fs->dedup_buckets[fs->block_digests[b].hash[0] & fs->dedup_bucket_mask] = -1;
+            fs->block_digests[b].indexed = false;
+        }
+        __atomic_store_n(&fs->free_blocks[b], FREE, __ATOMIC_RELAXED);
+        fs->block_refcounts[b] = 0;
+    }
+    size_t used = (fs->block_high_water * BLOCK_SIZE + page_size - 1) / page_size *
+                  page_size;
+    if (used > fs->data_len) {
+        used = fs->data_len;
+    }
+    if (used > 0) {
+        ALWAYS_ASSERT(madvise(fs->data, used, MADV_DONTNEED) == 0, "madvise");
+    }
+    fs->block_high_water = root_block + 1;
+
+    for (size_t i = 0; i < fs->mapped_high_water; i++) {
+        if (fs->mapped_blocks[i].data != NULL) {
+            ALWAYS_ASSERT(munmap(fs->mapped_blocks[i].data, fs->mapped_blocks[i].len) ==
+                              0,
+                          "munmap");
+            fs->mapped_blocks[i].data = NULL;
+        }
+    }
+    fs->mapped_high_water = 0;
+    fs->mapped_free_head = NO_MAPPED_SLOT;
+
+    // The root directory keeps its inode and block, emptied as by
+    // inode_create
+    __atomic_store_n(&fs->free_blocks[root_block], TAKEN, __ATOMIC_RELAXED);
+    fs->block_refcounts[root_block] = 1;
+    INODE(ROOT_DIR_INUM).hard_links = 1;
+    INODE_SIZE(ROOT_DIR_INUM) = BLOCK_SIZE;
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get_for_write((int)root_block);
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        dir_entry[i].d_inumber = -1;
+    }
+    data_block_written((int)root_block);
+    dir_index_t *index = &DIR_INDEX(ROOT_DIR_INUM);
+    memset(index->tags, 0, DIR_TAGS_SIZE);
+    memset(index->bloom, 0, bloom_size());
+    index->sorted_count = 0;
 
-    for(int i=0;i<INODE_TABLE_SIZE;i++)
-      pthread_rwlock_destroy(&inode_table[i].rwlock);
+    memset(&fs->stats, 0, sizeof(fs->stats));
 
-    for(int i=0;i<MAX_OPEN_FILES;i++)
-        pthread_mutex_destroy(&open_file_table[i].mtx);
+    return scrub_start();
+}
 
-    pthread_rwlock_destroy(&file_table_alloc_rwlock);
-    pthread_rwlock_destroy(&inode_alloc_rwlock);
-    pthread_rwlock_destroy(&data_block_alloc_rwlock);
+static inline uint64_t read64(uint8_t const *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
 
-    free(inode_table);
-    free(freeinode_ts);
-    free(fs_data);
-    free(free_blocks);
-    free(open_file_table);
-    free(free_open_file_entries);
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
 
-    inode_table = NULL;
-    freeinode_ts = NULL;
-    fs_data = NULL;
-    free_blocks = NULL;
-    open_file_table = NULL;
-    free_open_file_entries = NULL;
+static inline uint64_t fmix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
 
-    return 0;
+/*
+ * 128-bit hash of the contents of a block, 16 bytes per step over two
+ * independent lanes (after MurmurHash3's x64 128-bit variant).
+ */
+static void block_hash128(uint8_t const *data, size_t len, uint64_t hash[2]) {
+    uint64_t const c1 = 0x87c37b91114253d5ULL;
+    uint64_t const c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = len;
+    uint64_t h2 = len;
+
+    size_t i = 0;
+    uint8_t tail[16];
+    while (i < len) {
+        uint8_t const *p = data + i;
+        if (len - i < sizeof(tail)) {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, p, len - i);
+            p = tail;
+        }
+        i += sizeof(tail);
+
+        h1 ^= rotl64(read64(p) * c1, 31) * c2;
+        h1 = (rotl64(h1, 27) + h2) * 5 + 0x52dce729;
+        h2 ^= rotl64(read64(p + 8) * c2, 33) * c1;
+        h2 = (rotl64(h2, 31) + h1) * 5 + 0x38495ab5;
+    }
+
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    hash[0] = h1;
+    hash[1] = h2;
+}
+
+/*
+ * Takes a reference to a block, unless it is being freed (no references
+ * left). Returns whether it did.
+ */
+static bool data_block_tryref(int block_number) {
+    uint32_t refs =
+        __atomic_load_n(&fs->block_refcounts[block_number], __ATOMIC_RELAXED);
+    do {
+        if (refs == 0) {
+            return false;
+        }
+    } while (!__atomic_compare_exchange_n(&fs->block_refcounts[block_number],
+                                          &refs, refs + 1, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return true;
+}
+
+/*
+ * Removes a block from the dedup index, if it is there: it is about to be
+ * changed (or freed), so no other file may start sharing it.
+ */
+static void dedup_unindex(int block_number) {
+    block_digest_t *digest = &fs->block_digests[block_number];
+    if (!__atomic_load_n(&digest->indexed, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    SCOPED_LOCK(fs->dedup_mutex);
+    int *link = &fs->dedup_buckets[digest->hash[0] & fs->dedup_bucket_mask];
+    while (*link != block_number) {
+        ALWAYS_ASSERT(*link != -1, "dedup_unindex: indexed block not found");
+        link = &fs->block_digests[*link].next;
+    }
+    *link = digest->next;
+    __atomic_store_n(&digest->indexed, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * Save the state of an inode into the snapshot, if there is one and the inode
+ * wasn't saved yet, before it is changed.
+ *
+ * The caller must hold the inode's write lock (or, for an inode that is about
+ * to be allocated, the inode table's allocation lock).
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+static void snapshot_preserve(int inumber) {
+    if (!__atomic_load_n(&fs->snapshot_active, __ATOMIC_ACQUIRE) ||
+        __atomic_load_n(&SNAPSHOT_EPOCH(inumber), __ATOMIC_RELAXED) ==
+            __atomic_load_n(&fs->snapshot_epoch, __ATOMIC_RELAXED)) {
+        return; // no snapshot, or already saved
+    }
+
+    SCOPED_LOCK(fs->snapshot_mutex);
+    if (!fs->snapshot_active || SNAPSHOT_EPOCH(inumber) == fs->snapshot_epoch) {
+        return;
+    }
+
+    inode_snapshot_t *saved = &SNAPSHOT_INODE(inumber);
+    saved->state = INODE_STATE(inumber);
+    saved->type = (inode_type)INODE_TYPE(inumber);
+    saved->size = INODE_SIZE(inumber);
+    saved->data_block = INODE_BLOCK(inumber);
+    if (saved->state == TAKEN && saved->size > 0) {
+        // the block is now shared with the snapshot
+        data_block_ref(saved->data_block);
+    }
+
+    fs->snapshot_saved[fs->snapshot_saved_count++] = inumber;
+    __atomic_store_n(&SNAPSHOT_EPOCH(inumber), fs->snapshot_epoch,
+                     __ATOMIC_RELEASE);
+}
+
+/*
+ * Allocates the next chunk of the inode table, unless the table already holds
+ * max_inode_count inodes. The caller must hold inode_alloc_rwlock for writing.
+ * Returns false if the table can't grow.
+ */
+static bool inode_table_grow(void) {
+    size_t capacity = fs->inode_capacity;
+    if (capacity >= INODE_TABLE_SIZE) {
+        return false;
+    }
+    inode_chunk_t *chunk = calloc(1, sizeof(inode_chunk_t));
+    if (chunk == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < INODE_CHUNK_SIZE; i++) {
+        pthread_rwlock_init(&chunk->inodes[i].rwlock, NULL);
+        chunk->inodes[i].i_inumber = (int)(capacity + i);
+        chunk->states[i] = FREE;
+        chunk->types[i] = T_FILE;
+        chunk->data_blocks[i] = -1;
+        chunk->symlink_targets[i] = UINT64_MAX;
+    }
+    fs->inode_chunks[capacity >> INODE_CHUNK_SHIFT] = chunk;
+    // the chunk must be in place before its inodes are valid
+    size_t grown = capacity + INODE_CHUNK_SIZE;
+    __atomic_store_n(&fs->inode_capacity,
+                     grown < INODE_TABLE_SIZE ? grown : INODE_TABLE_SIZE,
+                     __ATOMIC_RELEASE);
+    return true;
 }
 
 /**
@@ -190,33 +1107,81 @@ int state_destroy(void) {
  *   - No free slots in inode table.
  */
 static int inode_alloc(void) {
-    pthread_rwlock_rdlock(&inode_alloc_rwlock);
-    for (size_t inumber = 0; inumber < INODE_TABLE_SIZE; inumber++) {
+    pthread_rwlock_rdlock(&fs->inode_alloc_rwlock);
+    size_t inumber = 0;
+    for (; inumber < fs->inode_capacity; inumber++) {
         if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
             insert_delay(); // simulate storage access delay (to freeinode_ts)
         }
 
         // Finds first free entry in inode table
-        if (freeinode_ts[inumber] == FREE) {
-            pthread_rwlock_unlock(&inode_alloc_rwlock);
-            pthread_rwlock_wrlock(&inode_alloc_rwlock);
+        if (INODE_STATE(inumber) == FREE) {
+            pthread_rwlock_unlock(&fs->inode_alloc_rwlock);
+            pthread_rwlock_wrlock(&fs->inode_alloc_rwlock);
 
             // Ensure it is still free
-            if(freeinode_ts[inumber] == TAKEN){
-                pthread_rwlock_unlock(&inode_alloc_rwlock);
-                pthread_rwlock_rdlock(&inode_alloc_rwlock);
+            if(INODE_STATE(inumber) == TAKEN){
+                pthread_rwlock_unlock(&fs->inode_alloc_rwlock);
+                pthread_rwlock_rdlock(&fs->inode_alloc_rwlock);
                 continue;
             }
             //  Found a free entry, so takes it for the new inode
-            freeinode_ts[inumber] = TAKEN;
-            pthread_rwlock_unlock(&inode_alloc_rwlock);
+            snapshot_preserve((int)inumber);
+            INODE_STATE(inumber) = TAKEN;
+            pthread_rwlock_unlock(&fs->inode_alloc_rwlock);
             return (int)inumber;
         }
     }
-    pthread_rwlock_unlock(&inode_alloc_rwlock);
+    pthread_rwlock_unlock(&fs->inode_alloc_rwlock);
+
+    // No free inodes in the allocated chunks, so the table grows (unless
+    // another thread grew it meanwhile)
+    SCOPED_RWLOCK_W(fs->inode_alloc_rwlock);
+    for (;; inumber++) {
+        if (inumber == fs->inode_capacity && !inode_table_grow()) {
+            return -1; // no free inodes
+        }
+        if (INODE_STATE(inumber) == FREE) {
+            snapshot_preserve((int)inumber);
+            INODE_STATE(inumber) = TAKEN;
+            return (int)inumber;
+        }
+    }
+}
 
-    // no free inodes
-    return -1;
+/*
+ * Like inode_alloc, for up to count inodes at once (the table is scanned only
+ * once). Returns the number of inodes allocated.
+ */
+static size_t inode_alloc_batch(int *inumbers, size_t count) {
+    SCOPED_RWLOCK_W(fs->inode_alloc_rwlock);
+    size_t allocated = 0;
+    for (size_t inumber = 0; allocated < count; inumber++) {
+        if (inumber == fs->inode_capacity && !inode_table_grow()) {
+            break; // no free inodes
+        }
+        if ((inumber * sizeof(allocation_state_t) % BLOCK_SIZE) == 0) {
+            insert_delay(); // simulate storage access delay (to freeinode_ts)
+        }
+
+        if (INODE_STATE(inumber) == FREE) {
+            snapshot_preserve((int)inumber);
+            INODE_STATE(inumber) = TAKEN;
+            inumbers[allocated++] = (int)inumber;
+        }
+    }
+    return allocated;
+}
+
+/*
+ * Initializes the fields shared by all types of a newly allocated inode.
+ */
+static void inode_init(int inumber, inode_type i_type) {
+    INODE(inumber).hard_links = 1;
+    INODE_TYPE(inumber) = (uint8_t)i_type;
+    INODE_SIZE(inumber) = 0;
+    INODE_BLOCK(inumber) = -1;
+    __atomic_store_n(&SYMLINK_TARGET(inumber), UINT64_MAX, __ATOMIC_RELAXED);
 }
 
 /**
@@ -242,15 +1207,12 @@ int inode_create(inode_type i_type) {
         return -1; // no free slots in inode table
     }
 
-    inode_t *inode = &inode_table[inumber];
+    inode_t *inode = &INODE(inumber);
 
     SCOPED_RWLOCK_W(inode->rwlock);
 
-    inode->hard_links = 1;
-    inode->i_node_type = i_type;
-    inode->i_size = 0;
-    inode->i_data_block = -1;
-    
+    inode_init(inumber, i_type);
+
     insert_delay(); // simulate storage access delay (to inode)
     
     switch (i_type) {
@@ -264,16 +1226,29 @@ int inode_create(inode_type i_type) {
             return -1;
         }
 
-        inode->i_size = BLOCK_SIZE;
-        inode->i_data_block = b;
-
-        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(b);
-        ALWAYS_ASSERT(dir_entry != NULL,
-                      "inode_create: data block freed while in use");
+        INODE_SIZE(inumber) = BLOCK_SIZE;
+        INODE_BLOCK(inumber) = b;
 
+        dir_entry_t *dir_entry = (dir_entry_t *)data_block_get_for_write(b);
         for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
             dir_entry[i].d_inumber = -1;
         }
+        data_block_written(b);
+
+        DIR_INDEX(inumber).tags = calloc(DIR_TAGS_SIZE, sizeof(uint8_t));
+        DIR_INDEX(inumber).bloom = calloc(bloom_size(), sizeof(uint8_t));
+        DIR_INDEX(inumber).sorted_count = 0;
+        if (fs->params.dir_prefix_index) {
+            DIR_INDEX(inumber).sorted =
+                malloc(MAX_DIR_ENTRIES * sizeof(uint32_t));
+        }
+        if (DIR_INDEX(inumber).tags == NULL ||
+            DIR_INDEX(inumber).bloom == NULL ||
+            (fs->params.dir_prefix_index &&
+             DIR_INDEX(inumber).sorted == NULL)) {
+            inode_delete(inumber);
+            return -1;
+        }
     } break;
     case T_FILE :
         break;
@@ -287,28 +1262,67 @@ int inode_create(inode_type i_type) {
 }
 
 /**
- * Delete an inode.
+ * Create up to count new files or symlinks (not directories) in the inode
+ * table, looking for free inodes only once.
  *
  * Input:
- *   - inumber: inode's number
+ *   - i_type: the type of the nodes (file or symlink)
+ *   - inumbers: where to store the inumbers of the new inodes
+ *   - count: number of inodes to create
+ *
+ * Returns the number of inodes created (fewer than count if the inode table
+ * is full).
  */
-void inode_delete(int inumber) {
-    // simulate storage access delay (to inode and freeinode_ts)
-    insert_delay();
+size_t inode_create_batch(inode_type i_type, int *inumbers, size_t count) {
+    ALWAYS_ASSERT(i_type != T_DIRECTORY,
+                  "inode_create_batch: directories are not supported");
+
+    size_t created = inode_alloc_batch(inumbers, count);
+    for (size_t i = 0; i < created; i++) {
+        SCOPED_RWLOCK_W(INODE(inumbers[i]).rwlock);
+        inode_init(inumbers[i], i_type);
+    }
+
+    insert_delay(); // simulate storage access delay (to the inodes)
+    return created;
+}
+
+/**
+ * Delete an inode.
+ *
+ * The caller must hold the inode's write lock, or otherwise be its only user
+ * (e.g. an inode that was just created and is not yet in any directory).
+ *
+ * Input:
+ *   - inumber: inode's number
+ */
+void inode_delete(int inumber) {
+    // simulate storage access delay (to inode and freeinode_ts)
+    insert_delay();
     insert_delay();
 
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_delete: invalid inumber");
 
-    SCOPED_RWLOCK_W(inode_table[inumber].rwlock);
-
-    ALWAYS_ASSERT(freeinode_ts[inumber] == TAKEN,
+    ALWAYS_ASSERT(INODE_STATE(inumber) == TAKEN,
                   "inode_delete: inode already freed");
 
-    if (inode_table[inumber].i_size > 0) {
-        data_block_free(inode_table[inumber].i_data_block);
+    __atomic_fetch_add(&fs->ns_generation, 1, __ATOMIC_RELEASE);
+    snapshot_preserve(inumber);
+
+    if (INODE_SIZE(inumber) > 0) {
+        data_block_free(INODE_BLOCK(inumber));
     }
 
-    freeinode_ts[inumber] = FREE;
+    if (INODE_TYPE(inumber) == T_DIRECTORY) {
+        free(DIR_INDEX(inumber).tags);
+        free(DIR_INDEX(inumber).bloom);
+        free(DIR_INDEX(inumber).sorted);
+        DIR_INDEX(inumber).tags = NULL;
+        DIR_INDEX(inumber).bloom = NULL;
+        DIR_INDEX(inumber).sorted = NULL;
+    }
+
+    INODE_STATE(inumber) = FREE;
 }
 
 /**
@@ -323,7 +1337,295 @@ inode_t *inode_get(int inumber) {
     ALWAYS_ASSERT(valid_inumber(inumber), "inode_get: invalid inumber");
 
     insert_delay(); // simulate storage access delay to inode
-    return &inode_table[inumber];
+    return &INODE(inumber);
+}
+
+/**
+ * Accessors for the hot inode fields.
+ *
+ * Input:
+ *   - inode: inode handle obtained from inode_get
+ *
+ * The caller is responsible for holding the inode's lock as needed, exactly
+ * as if the fields were accessed directly.
+ */
+inode_type inode_get_type(inode_t const *inode) {
+    return (inode_type)INODE_TYPE(inode->i_inumber);
+}
+
+size_t inode_get_size(inode_t const *inode) {
+    return INODE_SIZE(inode->i_inumber);
+}
+
+void inode_set_size(inode_t *inode, size_t size) {
+    snapshot_preserve(inode->i_inumber);
+    INODE_SIZE(inode->i_inumber) = size;
+}
+
+int inode_get_data_block(inode_t const *inode) {
+    return INODE_BLOCK(inode->i_inumber);
+}
+
+void inode_set_data_block(inode_t *inode, int block_number) {
+    snapshot_preserve(inode->i_inumber);
+    INODE_BLOCK(inode->i_inumber) = block_number;
+}
+
+/**
+ * Obtain the data block of a file, ready to be written to.
+ *
+ * Empty files get a new block. If the block is shared with other inodes
+ * (clones) or with the snapshot, or is a mapped host file, it is first copied,
+ * so that writing to it doesn't affect them.
+ * The caller must hold the inode's write lock, and call data_block_written
+ * once done writing.
+ *
+ * Input:
+ *   - inode: file inode
+ *
+ * Returns a pointer to the first byte of the block, or NULL if no data block
+ * could be allocated.
+ */
+void *inode_writable_block(inode_t *inode) {
+    int inumber = inode->i_inumber;
+    snapshot_preserve(inumber);
+
+    if (INODE_SIZE(inumber) == 0) {
+        // If empty file, allocate new block
+        int bnum = data_block_alloc();
+        if (bnum == -1) {
+            return NULL; // no space
+        }
+        INODE_BLOCK(inumber) = bnum;
+        return data_block_get_for_write(bnum);
+    }
+
+    int shared = INODE_BLOCK(inumber);
+    bool mapped = mapped_block_number(shared);
+    if (fs->params.dedup && !mapped && data_block_refcount(shared) == 1) {
+        // About to be written in place, so it can't be shared from now on
+        dedup_unindex(shared);
+    }
+    if (mapped || data_block_refcount(shared) > 1) {
+        // Copy on write
+        void const *contents = data_block_get(shared);
+        if (contents == NULL) {
+            return NULL; // corrupted
+        }
+        int bnum = data_block_alloc();
+        if (bnum == -1) {
+            return NULL; // no space
+        }
+        void *block = data_block_get_for_write(bnum);
+        memcpy(block, contents, INODE_SIZE(inumber));
+        INODE_BLOCK(inumber) = bnum;
+        data_block_free(shared);
+        STAT_ADD(cow_copies, 1);
+        if (mapped) {
+            STAT_ADD(mapped_copies, 1);
+        }
+        return block;
+    }
+
+    return data_block_get_for_write(shared);
+}
+
+/**
+ * Truncate a file to size 0, releasing its data block.
+ *
+ * The caller must hold the inode's write lock.
+ *
+ * Input:
+ *   - inode: file inode
+ */
+void inode_truncate(inode_t *inode) {
+    int inumber = inode->i_inumber;
+    if (INODE_SIZE(inumber) > 0) {
+        snapshot_preserve(inumber);
+        data_block_free(INODE_BLOCK(inumber));
+        INODE_SIZE(inumber) = 0;
+    }
+}
+
+/**
+ * Deduplicate the data block of a file that was just written to.
+ *
+ * If another block with the same contents is in the dedup index, the file
+ * starts sharing it (and releases its own); otherwise, the file's block is
+ * added to the index. Does nothing unless the dedup parameter is set. The
+ * caller must hold the inode's write lock.
+ *
+ * Input:
+ *   - inode: file inode
+ */
+void inode_dedup(inode_t *inode) {
+    int inumber = inode->i_inumber;
+    size_t len = INODE_SIZE(inumber);
+    if (!fs->params.dedup || len == 0) {
+        return;
+    }
+
+    int own = INODE_BLOCK(inumber);
+    if (mapped_block_number(own) ||
+        __atomic_load_n(&fs->block_digests[own].indexed, __ATOMIC_ACQUIRE)) {
+        return; // mapped, or unchanged since it was indexed
+    }
+
+    uint8_t const *contents = data_block_get(own);
+    if (contents == NULL) {
+        return; // corrupted
+    }
+    double start = now_ns();
+    uint64_t hash[2];
+    block_hash128(contents, len, hash);
+    STAT_ADD(dedup_hash_ns, (size_t)(now_ns() - start));
+    STAT_ADD(dedup_hashed_bytes, len);
+    STAT_ADD(dedup_checks, 1);
+
+    int shared = -1;
+    {
+        SCOPED_LOCK(fs->dedup_mutex);
+        int *bucket = &fs->dedup_buckets[hash[0] & fs->dedup_bucket_mask];
+        for (int b = *bucket; b != -1; b = fs->block_digests[b].next) {
+            block_digest_t const *digest = &fs->block_digests[b];
+            if (digest->len != len || digest->hash[0] != hash[0] ||
+                digest->hash[1] != hash[1]) {
+                continue;
+            }
+            void const *candidate = data_block_get(b);
+            if (candidate != NULL && memcmp(candidate, contents, len) == 0 &&
+                data_block_tryref(b)) {
+                shared = b;
+                break;
+            }
+        }
+
+        if (shared == -1) {
+            block_digest_t *digest = &fs->block_digests[own];
+            digest->hash[0] = hash[0];
+            digest->hash[1] = hash[1];
+            digest->len = len;
+            digest->next = *bucket;
+            *bucket = own;
+            __atomic_store_n(&digest->indexed, true, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    snapshot_preserve(inumber);
+    INODE_BLOCK(inumber) = shared;
+    data_block_free(own);
+    STAT_ADD(dedup_hits, 1);
+}
+
+/**
+ * Scan the whole inode table and summarize its contents.
+ *
+ * Only the dense allocation, type and size arrays are touched, so the scan
+ * never loads the (much larger) inode locks.
+ *
+ * Input:
+ *   - stats: where to store the result
+ */
+void inode_table_stats(inode_table_stats_t *stats) {
+    size_t per_type[3] = {0, 0, 0};
+    size_t bytes = 0;
+
+    pthread_rwlock_rdlock(&fs->inode_alloc_rwlock);
+    for (size_t i = 0; i < fs->inode_capacity; i++) {
+        if (INODE_STATE(i) == TAKEN) {
+            per_type[INODE_TYPE(i)]++;
+            bytes += INODE_SIZE(i);
+        }
+    }
+    pthread_rwlock_unlock(&fs->inode_alloc_rwlock);
+
+    stats->files = per_type[T_FILE];
+    stats->directories = per_type[T_DIRECTORY];
+    stats->symlinks = per_type[T_SYMLINK];
+    stats->bytes = bytes;
+}
+
+/**
+ * Obtain the current namespace generation.
+ *
+ * A symlink resolution that started at a given generation is still valid as
+ * long as the generation doesn't change.
+ */
+uint32_t namespace_generation(void) {
+    return __atomic_load_n(&fs->ns_generation, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Obtain the cached resolution of a symlink.
+ *
+ * Input:
+ *   - inumber: symlink's inumber
+ *
+ * Returns the inumber of the file the symlink resolves to, or -1 if there is
+ * no valid cached resolution.
+ */
+int symlink_cache_get(int inumber) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "symlink_cache_get: invalid inumber");
+
+    uint64_t cached =
+        __atomic_load_n(&SYMLINK_TARGET(inumber), __ATOMIC_ACQUIRE);
+    if (cached == UINT64_MAX || (uint32_t)cached != namespace_generation()) {
+        return -1;
+    }
+
+    STAT_ADD(symlink_cache_hits, 1);
+    return (int)(cached >> 32);
+}
+
+/**
+ * Cache the resolution of a symlink.
+ *
+ * Input:
+ *   - inumber: symlink's inumber
+ *   - target_inumber: inumber of the file the symlink resolved to
+ *   - generation: namespace generation read *before* starting the resolution
+ */
+void symlink_cache_set(int inumber, int target_inumber, uint32_t generation) {
+    ALWAYS_ASSERT(valid_inumber(inumber), "symlink_cache_set: invalid inumber");
+
+    uint64_t cached = ((uint64_t)(uint32_t)target_inumber << 32) | generation;
+    __atomic_store_n(&SYMLINK_TARGET(inumber), cached, __ATOMIC_RELEASE);
+}
+
+/*
+ * find_in_dir, for callers that already hold the directory's lock.
+ */
+static int dir_find_locked(inode_t *inode, char const *sub_name) {
+    STAT_ADD(dir_lookups, 1);
+    if (!bloom_may_contain(DIR_INDEX(inode->i_inumber).bloom, sub_name)) {
+        STAT_ADD(dir_bloom_negatives, 1);
+        return -1; // entry not found
+    }
+
+    // Scans the tag array first; the directory block is only accessed (and
+    // names only compared) for slots whose tag matches the target name
+    uint8_t const *tags = DIR_INDEX(inode->i_inumber).tags;
+    uint8_t tag = name_tag(sub_name);
+    dir_entry_t *dir_entry = NULL;
+    for (size_t i = tag_find(tags, 0, MAX_DIR_ENTRIES, tag);
+         i < MAX_DIR_ENTRIES; i = tag_find(tags, i + 1, MAX_DIR_ENTRIES, tag)) {
+        if (dir_entry == NULL) {
+            // Locates the block containing the entries of the directory
+            dir_entry =
+                (dir_entry_t *)data_block_get(inode_get_data_block(inode));
+            ALWAYS_ASSERT(dir_entry != NULL,
+                          "find_in_dir: directory inode must have a data block");
+        }
+
+        if ((dir_entry[i].d_inumber != -1) &&
+            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
+            return dir_entry[i].d_inumber;
+        }
+    }
+
+    STAT_ADD(dir_bloom_false_positives, 1);
+    return -1; // entry not found
 }
 
 /**
@@ -341,19 +1643,39 @@ inode_t *inode_get(int inumber) {
  */
 int clear_dir_entry(inode_t *inode, char const *sub_name) {
     insert_delay();
-    if (inode->i_node_type != T_DIRECTORY) {
+    if (inode_get_type(inode) != T_DIRECTORY) {
         return -1; // not a directory
     }
 
+    SCOPED_RWLOCK_W(inode->rwlock);
+
     // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(inode_get_data_block(inode));
     ALWAYS_ASSERT(dir_entry != NULL,
                   "clear_dir_entry: directory must have a data block");
 
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+    // Only slots whose tag matches can hold the name
+    uint8_t *tags = DIR_INDEX(inode->i_inumber).tags;
+    uint8_t tag = name_tag(sub_name);
+    for (size_t i = tag_find(tags, 0, MAX_DIR_ENTRIES, tag);
+         i < MAX_DIR_ENTRIES; i = tag_find(tags, i + 1, MAX_DIR_ENTRIES, tag)) {
         if (!strcmp(dir_entry[i].d_name, sub_name)) {
+            // the block may be shared with the snapshot
+            dir_entry = (dir_entry_t *)inode_writable_block(inode);
+            if (dir_entry == NULL) {
+                return -1; // no space to copy the directory
+            }
+            bloom_remove(DIR_INDEX(inode->i_inumber).bloom,
+                         dir_entry[i].d_name);
+            if (DIR_INDEX(inode->i_inumber).sorted != NULL) {
+                sorted_remove(&DIR_INDEX(inode->i_inumber), dir_entry, i);
+            }
             dir_entry[i].d_inumber = -1;
             memset(dir_entry[i].d_name, 0, MAX_FILE_NAME);
+            data_block_written(inode_get_data_block(inode));
+            tags[i] = 0;
+            __atomic_fetch_add(&fs->ns_generation, 1, __ATOMIC_RELEASE);
             return 0;
         }
     }
@@ -381,28 +1703,102 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
     }
 
     insert_delay(); // simulate storage access delay to inode with inumber
-    if (inode->i_node_type != T_DIRECTORY) {
+    if (inode_get_type(inode) != T_DIRECTORY) {
         return -1; // not a directory
     }
 
     SCOPED_RWLOCK_W(inode->rwlock);
 
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "add_dir_entry: directory must have a data block");
+    // Finds and fills the first empty entry (empty slots have a zero tag)
+    uint8_t *tags = DIR_INDEX(inode->i_inumber).tags;
+    size_t i = tag_find(tags, 0, MAX_DIR_ENTRIES, 0);
+    if (i == MAX_DIR_ENTRIES) {
+        return -1; // no space for entry
+    }
 
-    // Finds and fills the first empty entry
-    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
-        if (dir_entry[i].d_inumber == -1) {
-            dir_entry[i].d_inumber = sub_inumber;
-            strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
-            dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
-            return 0;
+    // Locates the block containing the entries of the directory (copying it,
+    // if it is shared with the snapshot)
+    dir_entry_t *dir_entry = (dir_entry_t *)inode_writable_block(inode);
+    if (dir_entry == NULL) {
+        return -1; // no space to copy the directory
+    }
+
+    dir_entry[i].d_inumber = sub_inumber;
+    strncpy(dir_entry[i].d_name, sub_name, MAX_FILE_NAME - 1);
+    dir_entry[i].d_name[MAX_FILE_NAME - 1] = '\0';
+    data_block_written(inode_get_data_block(inode));
+    tags[i] = name_tag(dir_entry[i].d_name);
+    bloom_add(DIR_INDEX(inode->i_inumber).bloom, dir_entry[i].d_name);
+    if (DIR_INDEX(inode->i_inumber).sorted != NULL) {
+        sorted_insert(&DIR_INDEX(inode->i_inumber), dir_entry, i);
+    }
+    return 0;
+}
+
+/**
+ * Store several entries in a directory at once, writing its block only once.
+ * Names that are invalid or already in the directory are skipped.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_names: sub file names
+ *   - sub_inumbers: inumbers of the sub inodes
+ *   - added: where to store whether each entry was added
+ *   - count: number of entries
+ *
+ * Returns the number of entries added (fewer than count if some were skipped
+ * or the directory became full), or -1 if inode is not a directory inode.
+ */
+ssize_t add_dir_entries(inode_t *inode, char const *const *sub_names,
+                        int const *sub_inumbers, bool *added, size_t count) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode_get_type(inode) != T_DIRECTORY) {
+        return -1; // not a directory
+    }
+
+    SCOPED_RWLOCK_W(inode->rwlock);
+
+    uint8_t *tags = DIR_INDEX(inode->i_inumber).tags;
+    dir_entry_t *dir_entry = NULL;
+    size_t slot = 0;
+    size_t added_count = 0;
+    for (size_t e = 0; e < count; e++) {
+        added[e] = false;
+        size_t len = strlen(sub_names[e]);
+        if (len == 0 || len > MAX_FILE_NAME - 1 ||
+            dir_find_locked(inode, sub_names[e]) != -1) {
+            continue; // invalid or existing sub_name
         }
+
+        // Empty slots are taken in order, so the search resumes where the
+        // previous one stopped
+        slot = tag_find(tags, slot, MAX_DIR_ENTRIES, 0);
+        if (slot == MAX_DIR_ENTRIES) {
+            break; // no space for more entries
+        }
+        if (dir_entry == NULL) {
+            dir_entry = (dir_entry_t *)inode_writable_block(inode);
+            if (dir_entry == NULL) {
+                return 0; // no space to copy the directory
+            }
+        }
+
+        dir_entry[slot].d_inumber = sub_inumbers[e];
+        strncpy(dir_entry[slot].d_name, sub_names[e], MAX_FILE_NAME - 1);
+        dir_entry[slot].d_name[MAX_FILE_NAME - 1] = '\0';
+        tags[slot] = name_tag(dir_entry[slot].d_name);
+        bloom_add(DIR_INDEX(inode->i_inumber).bloom, dir_entry[slot].d_name);
+        if (DIR_INDEX(inode->i_inumber).sorted != NULL) {
+            sorted_insert(&DIR_INDEX(inode->i_inumber), dir_entry, slot);
+        }
+        added[e] = true;
+        added_count++;
     }
 
-    return -1; // no space for entry
+    if (dir_entry != NULL) {
+        data_block_written(inode_get_data_block(inode));
+    }
+    return (ssize_t)added_count;
 }
 
 /**
@@ -418,131 +1814,1653 @@ int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber) {
  *   - inode is not a directory inode.
  *   - Directory does not contain a file named sub_name.
  */
-int find_in_dir(inode_t const *inode, char const *sub_name) {
+int find_in_dir(inode_t *inode, char const *sub_name) {
     ALWAYS_ASSERT(inode != NULL, "find_in_dir: inode must be non-NULL");
     ALWAYS_ASSERT(sub_name != NULL, "find_in_dir: sub_name must be non-NULL");
 
     insert_delay(); // simulate storage access delay to inode with inumber
-    if (inode->i_node_type != T_DIRECTORY) {
+    if (inode_get_type(inode) != T_DIRECTORY) {
         return -1; // not a directory
     }
 
-    // Locates the block containing the entries of the directory
-    dir_entry_t *dir_entry = (dir_entry_t *)data_block_get(inode->i_data_block);
-    ALWAYS_ASSERT(dir_entry != NULL,
-                  "find_in_dir: directory inode must have a data block");
+    SCOPED_RWLOCK_R(inode->rwlock);
+    return dir_find_locked(inode, sub_name);
+}
 
-    // Iterates over the directory entries looking for one that has the target
-    // name
-    for (int i = 0; i < MAX_DIR_ENTRIES; i++)
-        if ((dir_entry[i].d_inumber != -1) &&
-            (strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0)) {
+/**
+ * List the entries of a directory, starting at a given slot.
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - cursor: index of the first slot to look at; updated to the slot where
+ *     the next call should resume
+ *   - entries: destination array
+ *   - max_entries: capacity of the entries array
+ *
+ * Returns the number of entries stored in the array (0 if the directory has
+ * no more entries past the cursor, or inode is not a directory inode).
+ */
+size_t dir_read_entries(inode_t *inode, size_t *cursor, tfs_dirent_t *entries,
+                        size_t max_entries) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode_get_type(inode) != T_DIRECTORY) {
+        return 0; // not a directory
+    }
 
-            int sub_inumber = dir_entry[i].d_inumber;
-            return sub_inumber;
+    SCOPED_RWLOCK_R(inode->rwlock);
+
+    // Occupied slots are found through the tag array, so the directory block
+    // is only accessed if there is something to copy
+    uint8_t const *tags = DIR_INDEX(inode->i_inumber).tags;
+    dir_entry_t *dir_entry = NULL;
+    size_t count = 0;
+    size_t i = *cursor;
+    for (; i < MAX_DIR_ENTRIES && count < max_entries; i++) {
+        if (tags[i] == 0) {
+            continue;
         }
 
-    return -1; // entry not found
+        if (dir_entry == NULL) {
+            dir_entry =
+                (dir_entry_t *)data_block_get(inode_get_data_block(inode));
+            ALWAYS_ASSERT(dir_entry != NULL, "dir_read_entries: directory "
+                                             "inode must have a data block");
+        }
+
+        int sub_inumber = dir_entry[i].d_inumber;
+        memcpy(entries[count].d_name, dir_entry[i].d_name, MAX_FILE_NAME);
+        entries[count].d_inumber = sub_inumber;
+        entries[count].d_type = (inode_type)INODE_TYPE(sub_inumber);
+        count++;
+    }
+
+    *cursor = i;
+    return count;
 }
 
 /**
- * Allocate a new data block.
+ * Call a function for every entry of a directory whose name starts with a
+ * given prefix.
  *
- * Returns block number/index if successful, -1 otherwise.
+ * Input:
+ *   - inode: directory inode
+ *   - prefix: name prefix
+ *   - cb: function to call (visiting stops if it returns non-zero)
+ *   - arg: passed as-is to cb
  *
- * Possible errors:
- *   - No free data blocks.
+ * Returns the number of entries visited, -1 if inode is not a directory.
  */
-int data_block_alloc(void) {
-    pthread_rwlock_rdlock(&data_block_alloc_rwlock);
-    for (size_t i = 0; i < DATA_BLOCKS; i++) {
-        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
-            insert_delay(); // simulate storage access delay to free_blocks
-        }
+ssize_t dir_list_prefix(inode_t *inode, char const *prefix,
+                        tfs_dirent_callback_t cb, void *arg) {
+    insert_delay(); // simulate storage access delay to inode with inumber
+    if (inode_get_type(inode) != T_DIRECTORY) {
+        return -1; // not a directory
+    }
 
-        if (free_blocks[i] == FREE) {
-            pthread_rwlock_unlock(&data_block_alloc_rwlock);
-            pthread_rwlock_wrlock(&data_block_alloc_rwlock);
+    SCOPED_RWLOCK_R(inode->rwlock);
 
-            if(free_blocks[i] == TAKEN){
-                pthread_rwlock_unlock(&data_block_alloc_rwlock);
-                pthread_rwlock_rdlock(&data_block_alloc_rwlock);
-                continue;
+    dir_entry_t *dir_entry =
+        (dir_entry_t *)data_block_get(inode_get_data_block(inode));
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "dir_list_prefix: directory inode must have a data block");
+
+    dir_index_t const *index = &DIR_INDEX(inode->i_inumber);
+    size_t prefix_len = strnlen(prefix, MAX_FILE_NAME);
+    tfs_dirent_t entry;
+    ssize_t visited = 0;
+
+    // With the sorted index, matching names form a contiguous range starting
+    // at the prefix's lower bound; otherwise every used slot is checked
+    size_t end = index->sorted != NULL ? index->sorted_count : MAX_DIR_ENTRIES;
+    size_t pos = index->sorted != NULL
+                     ? sorted_lower_bound(index, dir_entry, prefix)
+                     : 0;
+    for (; pos < end; pos++) {
+        size_t slot = index->sorted != NULL ? index->sorted[pos] : pos;
+        if (index->sorted == NULL && index->tags[slot] == 0) {
+            continue;
+        }
+
+        if (strncmp(dir_entry[slot].d_name, prefix, prefix_len) != 0) {
+            if (index->sorted != NULL) {
+                break; // past the matching range
             }
-            free_blocks[i] = TAKEN;
-            pthread_rwlock_unlock(&data_block_alloc_rwlock);
-            return (int)i;
+            continue;
+        }
+
+        memcpy(entry.d_name, dir_entry[slot].d_name, MAX_FILE_NAME);
+        entry.d_inumber = dir_entry[slot].d_inumber;
+        entry.d_type = (inode_type)INODE_TYPE(entry.d_inumber);
+        visited++;
+        if (cb(&entry, arg) != 0) {
+            break;
         }
     }
-    pthread_rwlock_unlock(&data_block_alloc_rwlock);
-    return -1;
+
+    return visited;
 }
 
 /**
- * Free a data block.
+ * Take a snapshot of the whole FS.
  *
- * Input:
- *   - block_number: the block number/index
+ * Takes constant time: inodes are only saved when they change afterwards.
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - There is already a snapshot.
  */
-void data_block_free(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
-                  "data_block_free: invalid block number");
-
-    insert_delay(); // simulate storage access delay to free_blocks
+int snapshot_create(void) {
+    SCOPED_LOCK(fs->snapshot_mutex);
+    if (fs->snapshot_active) {
+        return -1;
+    }
 
-    free_blocks[block_number] = FREE;
+    fs->snapshot_saved_count = 0;
+    __atomic_store_n(&fs->snapshot_epoch, fs->snapshot_epoch + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&fs->snapshot_active, true, __ATOMIC_RELEASE);
+    return 0;
 }
 
 /**
- * Obtain a pointer to the contents of a given block.
+ * Discard the snapshot, releasing the data blocks only it still references.
  *
- * Input:
- *   - block_number: the block number/index
+ * Returns 0 if successful, -1 otherwise.
  *
- * Returns a pointer to the first byte of the block.
+ * Possible errors:
+ *   - There is no snapshot.
+ *   - There are open file handles into the snapshot.
  */
-void *data_block_get(int block_number) {
-    ALWAYS_ASSERT(valid_block_number(block_number),
-                  "data_block_get: invalid block number");
+int snapshot_destroy(void) {
+    SCOPED_LOCK(fs->snapshot_mutex);
+    if (!fs->snapshot_active || fs->snapshot_handles > 0) {
+        return -1;
+    }
 
-    insert_delay(); // simulate storage access delay to block
-    return &fs_data[(size_t)block_number * BLOCK_SIZE];
+    __atomic_store_n(&fs->snapshot_active, false, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < fs->snapshot_saved_count; i++) {
+        inode_snapshot_t const *saved = &SNAPSHOT_INODE(fs->snapshot_saved[i]);
+        if (saved->state == TAKEN && saved->size > 0) {
+            data_block_free(saved->data_block);
+        }
+    }
+    fs->snapshot_saved_count = 0;
+    return 0;
 }
 
 /**
- * Add a new entry to the open file table.
+ * Register (snapshot_acquire) or unregister (snapshot_release) an open file
+ * handle into the snapshot, which can't be discarded while there are any.
  *
- * Input:
- *   - inumber: inode number of the file to open
- *   - offset: initial offset
+ * snapshot_acquire returns 0 if successful, -1 if there is no snapshot.
+ */
+int snapshot_acquire(void) {
+    SCOPED_LOCK(fs->snapshot_mutex);
+    if (!fs->snapshot_active) {
+        return -1;
+    }
+    fs->snapshot_handles++;
+    return 0;
+}
+
+void snapshot_release(void) {
+    SCOPED_LOCK(fs->snapshot_mutex);
+    ALWAYS_ASSERT(fs->snapshot_handles > 0, "snapshot_release: no open handles");
+    fs->snapshot_handles--;
+}
+
+/**
+ * Obtain the state of an inode as of the snapshot.
  *
- * Returns file handle if successful, -1 otherwise.
+ * The caller must hold the inode's lock and a snapshot handle (see
+ * snapshot_acquire). Only inodes reached through the snapshot's namespace are
+ * meaningful: an inode that was free when the snapshot was taken and is being
+ * allocated concurrently may be reported as it is live.
  *
- * Possible errors:
- *   - No space in open file table for a new open file.
+ * Input:
+ *   - inumber: inode's number
+ *   - type, size, data_block: where to store the inode's fields
+ *
+ * Returns 0 if successful, -1 if the inode didn't exist in the snapshot.
  */
-int add_to_open_file_table(int inumber, size_t offset) {
-    pthread_rwlock_rdlock(&file_table_alloc_rwlock);
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-
-        if (free_open_file_entries[i] == FREE) {
-            pthread_rwlock_unlock(&file_table_alloc_rwlock);
-            pthread_rwlock_wrlock(&file_table_alloc_rwlock);
-            if(free_open_file_entries[i] == TAKEN){
-                pthread_rwlock_unlock(&file_table_alloc_rwlock);
-                pthread_rwlock_rdlock(&file_table_alloc_rwlock);
-                continue;
-            }
-            free_open_file_entries[i] = TAKEN;
-            open_file_table[i].of_inumber = inumber;
-            open_file_table[i].of_offset = offset;
-            pthread_rwlock_unlock(&file_table_alloc_rwlock);
-            return i;
+int snapshot_inode_get(int inumber, inode_type *type, size_t *size,
+                       int *data_block) {
+    ALWAYS_ASSERT(valid_inumber(inumber),
+                  "snapshot_inode_get: invalid inumber");
+
+    if (__atomic_load_n(&SNAPSHOT_EPOCH(inumber), __ATOMIC_ACQUIRE) ==
+        __atomic_load_n(&fs->snapshot_epoch, __ATOMIC_RELAXED)) {
+        inode_snapshot_t const *saved = &SNAPSHOT_INODE(inumber);
+        if (saved->state != TAKEN) {
+            return -1;
         }
+        *type = saved->type;
+        *size = saved->size;
+        *data_block = saved->data_block;
+        return 0;
+    }
 
+    // unchanged since the snapshot
+    if (INODE_STATE(inumber) != TAKEN) {
+        return -1;
+    }
+    *type = (inode_type)INODE_TYPE(inumber);
+    *size = INODE_SIZE(inumber);
+    *data_block = INODE_BLOCK(inumber);
+    return 0;
+}
+
+/**
+ * Obtain the inumber for a sub file inside a directory, as of the snapshot.
+ *
+ * The caller must hold a snapshot handle (see snapshot_acquire).
+ *
+ * Input:
+ *   - inode: directory inode
+ *   - sub_name: sub file name
+ *
+ * Returns inumber linked to the target name, -1 if errors occur.
+ *
+ * Possible errors:
+ *   - inode was not a directory inode.
+ *   - Directory did not contain a file named sub_name.
+ */
+int snapshot_find_in_dir(inode_t *inode, char const *sub_name) {
+    SCOPED_RWLOCK_R(inode->rwlock);
+
+    inode_type type;
+    size_t size;
+    int block;
+    if (snapshot_inode_get(inode->i_inumber, &type, &size, &block) == -1 ||
+        type != T_DIRECTORY) {
+        return -1;
+    }
+
+    // The indexes only describe the live directory, so scan its block
+    dir_entry_t const *dir_entry = (dir_entry_t const *)data_block_get(block);
+    ALWAYS_ASSERT(dir_entry != NULL,
+                  "snapshot_find_in_dir: directory must have a data block");
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (dir_entry[i].d_inumber != -1 &&
+            strncmp(dir_entry[i].d_name, sub_name, MAX_FILE_NAME) == 0) {
+            return dir_entry[i].d_inumber;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Marks a block as being written to (its checksum is not valid until
+ * data_block_written).
+ */
+static void data_block_begin_write(int block_number) {
+    uint32_t seq = fs->block_seqs[block_number];
+    if ((seq & 1) == 0) {
+        __atomic_store_n(&fs->block_seqs[block_number], seq + 1,
+                         __ATOMIC_RELAXED);
+        // the sequence number must change before the contents do
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Gives back to the OS the memory of the pages spanned by a block (freed, or
+ * kept compressed) that hold no part of another taken block (they read as
+ * zeros when next written to). The caller must hold data_block_alloc_rwlock
+ * for writing, so that no block sharing those pages is taken meanwhile.
+ */
+static void data_block_release(size_t block_number) {
+    size_t start = block_number * BLOCK_SIZE;
+    size_t end = start + BLOCK_SIZE;
+    size_t first = start / page_size * page_size;
+    size_t last = (end + page_size - 1) / page_size * page_size;
+
+    // Small blocks share pages with their neighbours
+    for (size_t b = first / BLOCK_SIZE; b < block_number; b++) {
+        if (fs->free_blocks[b] == TAKEN) {
+            first += page_size;
+            break;
+        }
+    }
+    for (size_t b = block_number + 1; b * BLOCK_SIZE < last && b < DATA_BLOCKS;
+         b++) {
+        if (fs->free_blocks[b] == TAKEN) {
+            last -= page_size;
+            break;
+        }
+    }
+
+    if (first < last) {
+        ALWAYS_ASSERT(madvise(fs->data + first, last - first, MADV_DONTNEED) ==
+                          0,
+                      "madvise");
+        STAT_ADD(released_bytes, last - first);
+    }
+}
+
+/*
+ * Decompresses a cold block back into its place in the data block area (whose
+ * pages were given back when it was compressed), and checksums it again.
+ */
+static void data_block_thaw(int block_number, char *block) {
+    SCOPED_LOCK(fs->compression_mutex);
+    compressed_block_t *compressed = &fs->compressed_blocks[block_number];
+    if (compressed->data == NULL) {
+        return; // thawed meanwhile
+    }
+
+    double start = now_ns();
+    int result = lz_decompress(compressed->data, compressed->len, block,
+                               compressed->raw_len);
+    ALWAYS_ASSERT(result == 0, "data_block_get: corrupted compressed block");
+    STAT_ADD(decompress_ns, (size_t)(now_ns() - start));
+    STAT_ADD(decompressed_bytes, compressed->raw_len);
+
+    STAT_SUB(cold_raw_bytes, compressed->raw_len);
+    STAT_SUB(cold_stored_bytes, compressed->len);
+    free(compressed->data);
+    data_block_written(block_number);
+    __atomic_store_n(&compressed->data, NULL, __ATOMIC_RELEASE);
+}
+
+/*
+ * Discards the compressed contents of a block that is being freed.
+ */
+static void data_block_drop_compressed(int block_number) {
+    SCOPED_LOCK(fs->compression_mutex);
+    compressed_block_t *compressed = &fs->compressed_blocks[block_number];
+    if (compressed->data != NULL) {
+        STAT_SUB(cold_raw_bytes, compressed->raw_len);
+        STAT_SUB(cold_stored_bytes, compressed->len);
+        free(compressed->data);
+        compressed->data = NULL;
+    }
+}
+
+/**
+ * Compress the contents of a cold data block.
+ *
+ * The compressed contents are kept in a separate pool, and decompressed back
+ * into the block the next time it is accessed with data_block_get. Blocks
+ * shared by several inodes, and contents that don't shrink by at least
+ * 1/COLD_MIN_SAVING, are left as they are. The caller must hold the write
+ * lock of the inode the block belongs to.
+ *
+ * Input:
+ *   - block_number: the block to compress
+ *   - len: length of the block's contents (the rest of it is unused)
+ *
+ * Returns 1 if the block was compressed, 0 if it was left uncompressed, or -1
+ * in case of error.
+ */
+int data_block_compress(int block_number, size_t len) {
+    if (mapped_block_number(block_number)) {
+        return 0; // already out of the data block area
+    }
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_compress: invalid block number");
+    ALWAYS_ASSERT(len <= BLOCK_SIZE, "data_block_compress: invalid length");
+
+    if (__atomic_load_n(&fs->compressed_blocks[block_number].data,
+                        __ATOMIC_ACQUIRE) != NULL) {
+        return 1; // already compressed
+    }
+    if (data_block_refcount(block_number) != 1 || len == 0) {
+        return 0;
+    }
+
+    void *block = data_block_get(block_number);
+    if (block == NULL) {
+        return -1; // corrupted
+    }
+    size_t capacity = len - len / COLD_MIN_SAVING;
+    uint8_t *data = malloc(capacity);
+    if (data == NULL) {
+        return -1;
+    }
+
+    size_t compressed_len = lz_compress(block, len, data, capacity);
+    if (compressed_len == 0) {
+        free(data);
+        return 0; // not worth it
+    }
+    // keep only what is used
+    uint8_t *shrunk = realloc(data, compressed_len);
+    if (shrunk != NULL) {
+        data = shrunk;
+    }
+
+    {
+        SCOPED_LOCK(fs->compression_mutex);
+        compressed_block_t *compressed = &fs->compressed_blocks[block_number];
+        compressed->len = compressed_len;
+        compressed->raw_len = len;
+        __atomic_store_n(&compressed->data, data, __ATOMIC_RELEASE);
+        STAT_ADD(cold_raw_bytes, len);
+        STAT_ADD(cold_stored_bytes, compressed_len);
+    }
+
+    // Only the compressed copy is kept: the block's own pages go back to the
+    // OS (if it doesn't share them with others), and its contents no longer
+    // match the checksum until they are thawed
+    data_block_begin_write(block_number);
+    SCOPED_RWLOCK_W(fs->data_block_alloc_rwlock);
+    data_block_release((size_t)block_number);
+    return 1;
+}
+
+/**
+ * Map (the first len bytes of) a host file into the FS, as a read-only block
+ * that is only copied into the data block area once written to (see
+ * inode_writable_block).
+ *
+ * The host file must not be changed while it is mapped.
+ *
+ * Input:
+ *   - fd: the host file, open for reading
+ *   - len: length of the contents (1 to BLOCK_SIZE bytes)
+ *
+ * Returns the number of the new (mapped) block, or -1 in case of error.
+ *
+ * Possible errors:
+ *   - The file can't be mapped.
+ *   - There are as many mapped files as inodes.
+ */
+int data_block_map(int fd, size_t len) {
+    ALWAYS_ASSERT(len > 0 && len <= BLOCK_SIZE,
+                  "data_block_map: invalid length");
+
+    char *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return -1;
+    }
+
+    SCOPED_LOCK(fs->mapping_mutex);
+    size_t i = fs->mapped_free_head;
+    if (i != NO_MAPPED_SLOT) {
+        fs->mapped_free_head = fs->mapped_blocks[i].next_free;
+    } else if (fs->mapped_high_water < INODE_TABLE_SIZE) {
+        i = fs->mapped_high_water++;
+    } else {
+        ALWAYS_ASSERT(munmap(data, len) == 0, "munmap");
+        return -1;
+    }
+    fs->mapped_blocks[i].data = data;
+    fs->mapped_blocks[i].len = len;
+    fs->mapped_blocks[i].refs = 1;
+    STAT_ADD(mapped_bytes, len);
+    return (int)(DATA_BLOCKS + i);
+}
+
+/*
+ * Drops one reference to a mapped block, unmapping it after the last one.
+ */
+static void data_block_unmap(int block_number) {
+    mapped_block_t *mapped = mapped_block(block_number);
+    char *data;
+    size_t len;
+    {
+        SCOPED_LOCK(fs->mapping_mutex);
+        ALWAYS_ASSERT(mapped->refs > 0, "data_block_free: block already freed");
+        if (--mapped->refs > 0) {
+            return;
+        }
+        data = mapped->data;
+        len = mapped->len;
+        mapped->data = NULL;
+        mapped->next_free = fs->mapped_free_head;
+        fs->mapped_free_head = (size_t)(mapped - fs->mapped_blocks);
+    }
+    ALWAYS_ASSERT(munmap(data, len) == 0, "munmap");
+    STAT_SUB(mapped_bytes, len);
+}
+
+/**
+ * Allocate a new data block.
+ *
+ * Returns block number/index if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No free data blocks.
+ */
+int data_block_alloc(void) {
+    pthread_rwlock_rdlock(&fs->data_block_alloc_rwlock);
+    for (size_t i = 0; i < DATA_BLOCKS; i++) {
+        if (i * sizeof(allocation_state_t) % BLOCK_SIZE == 0) {
+            insert_delay(); // simulate storage access delay to free_blocks
+        }
+
+        if (fs->free_blocks[i] == FREE) {
+            pthread_rwlock_unlock(&fs->data_block_alloc_rwlock);
+            pthread_rwlock_wrlock(&fs->data_block_alloc_rwlock);
+
+            if(fs->free_blocks[i] == TAKEN){
+                pthread_rwlock_unlock(&fs->data_block_alloc_rwlock);
+                pthread_rwlock_rdlock(&fs->data_block_alloc_rwlock);
+                continue;
+            }
+            // no valid checksum until it is first written
+            if ((fs->block_seqs[i] & 1) == 0) {
+                __atomic_store_n(&fs->block_seqs[i], fs->block_seqs[i] + 1,
+                                 __ATOMIC_RELEASE);
+            }
+            __atomic_store_n(&fs->free_blocks[i], TAKEN, __ATOMIC_RELAXED);
+            fs->block_refcounts[i] = 1;
+            if (i >= fs->block_high_water) {
+                fs->block_high_water = i + 1;
+            }
+            pthread_rwlock_unlock(&fs->data_block_alloc_rwlock);
+            return (int)i;
+        }
+    }
+    pthread_rwlock_unlock(&fs->data_block_alloc_rwlock);
+    return -1;
+}
+
+/**
+ * Free a data block.
+ *
+ * Drops one reference to the block; it only becomes free once no inode
+ * references it anymore.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_free(int block_number) {
+    if (mapped_block_number(block_number)) {
+        data_block_unmap(block_number);
+        return;
+    }
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_free: invalid block number");
+
+    insert_delay(); // simulate storage access delay to free_blocks
+
+    uint32_t refs = __atomic_sub_fetch(&fs->block_refcounts[block_number], 1,
+                                       __ATOMIC_ACQ_REL);
+    ALWAYS_ASSERT(refs != UINT32_MAX, "data_block_free: block already freed");
+    if (refs == 0) {
+        if (fs->params.dedup) {
+            dedup_unindex(block_number);
+        }
+        data_block_drop_compressed(block_number);
+        SCOPED_RWLOCK_W(fs->data_block_alloc_rwlock);
+        __atomic_store_n(&fs->free_blocks[block_number], FREE, __ATOMIC_RELAXED);
+        // its pages are about to read as zeros, which must not pass for
+        // corruption with a scrubber that saw the block still taken
+        data_block_begin_write(block_number);
+        data_block_release((size_t)block_number);
+    }
+}
+
+/**
+ * Add a reference to a taken data block, so that it is shared.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_ref(int block_number) {
+    if (mapped_block_number(block_number)) {
+        SCOPED_LOCK(fs->mapping_mutex);
+        mapped_block(block_number)->refs++;
+        return;
+    }
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_ref: invalid block number");
+    ALWAYS_ASSERT(fs->free_blocks[block_number] == TAKEN,
+                  "data_block_ref: block is free");
+
+    __atomic_add_fetch(&fs->block_refcounts[block_number], 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Obtain the number of references to a data block.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+uint32_t data_block_refcount(int block_number) {
+    if (mapped_block_number(block_number)) {
+        SCOPED_LOCK(fs->mapping_mutex);
+        return mapped_block(block_number)->refs;
+    }
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_refcount: invalid block number");
+
+    return __atomic_load_n(&fs->block_refcounts[block_number], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Locates a block, decompressing it first if needed.
+ */
+static char *data_block_locate(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_get: invalid block number");
+
+    insert_delay(); // simulate storage access delay to block
+    char *block = &fs->data[(size_t)block_number * BLOCK_SIZE];
+    if (__atomic_load_n(&fs->compressed_blocks[block_number].data,
+                        __ATOMIC_ACQUIRE) != NULL) {
+        data_block_thaw(block_number, block);
+    }
+    return block;
+}
+
+/**
+ * Obtain a pointer to the contents of a given block.
+ *
+ * If the verify_checksums parameter is set, the contents are checked against
+ * the block's checksum first (except for mapped host files, which have none).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns a pointer to the first byte of the block, or NULL if its contents
+ * don't match the checksum.
+ */
+void *data_block_get(int block_number) {
+    if (mapped_block_number(block_number)) {
+        insert_delay(); // simulate storage access delay to block
+        // the mapping never changes, and outlives every reference
+        return mapped_block(block_number)->data;
+    }
+    char *block = data_block_locate(block_number);
+    if (fs->params.verify_checksums && !data_block_verify(block_number)) {
+        return NULL;
+    }
+    return block;
+}
+
+/**
+ * Obtain a pointer to the contents of a given block, to write to it.
+ *
+ * The block's checksum is not valid (nor checked) until data_block_written
+ * is called. The caller must be the block's only writer (e.g. hold the write
+ * lock of the inode it belongs to).
+ *
+ * Input:
+ *   - block_number: the block number/index
+ *
+ * Returns a pointer to the first byte of the block.
+ */
+void *data_block_get_for_write(int block_number) {
+    char *block = data_block_locate(block_number);
+    data_block_begin_write(block_number);
+    return block;
+}
+
+/**
+ * Finish writing to a block obtained with data_block_get_for_write, updating
+ * its checksum.
+ *
+ * Input:
+ *   - block_number: the block number/index
+ */
+void data_block_written(int block_number) {
+    ALWAYS_ASSERT(valid_block_number(block_number),
+                  "data_block_written: invalid block number");
+
+    uint32_t seq = fs->block_seqs[block_number];
+    if ((seq & 1) == 0) {
+        return; // not being written to
+    }
+
+    double start = now_ns();
+    uint32_t checksum =
+        crc32c(&fs->data[(size_t)block_number * BLOCK_SIZE], BLOCK_SIZE);
+    STAT_ADD(checksum_ns, (size_t)(now_ns() - start));
+    STAT_ADD(checksum_bytes, BLOCK_SIZE);
+
+    __atomic_store_n(&fs->block_checksums[block_number], checksum,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&fs->block_seqs[block_number], seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Consistency checker (see state_fsck). Each worker first checks a range of
+ * the inode table, counting the references it finds to each block and inode
+ * in arrays of its own; then it adds up everyone's counts for a range of
+ * blocks and inodes, and compares them with the tables.
+ */
+typedef struct fsck_worker {
+    tfs_ctx *ctx;
+    struct fsck_worker *workers;
+    size_t worker_count;
+    size_t index;
+    pthread_t thread;
+    // references to each block, and to each inode (from directory entries)
+    uint32_t *block_refs;
+    uint32_t *links;
+    tfs_fsck_report_t report;
+} fsck_worker_t;
+
+static void fsck_range(size_t total, fsck_worker_t const *w, size_t *first,
+                       size_t *last) {
+    *first = total * w->index / w->worker_count;
+    *last = total * (w->index + 1) / w->worker_count;
+}
+
+static void fsck_scan_dir(fsck_worker_t *w, int block_number) {
+    dir_entry_t const *entries =
+        (dir_entry_t const *)&fs->data[(size_t)block_number * BLOCK_SIZE];
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        int sub = entries[i].d_inumber;
+        if (sub == -1) {
+            continue;
+        }
+        if (!valid_inumber(sub) || INODE_STATE(sub) != TAKEN) {
+            w->report.dangling_entries++;
+        } else {
+            w->links[sub]++;
+        }
+    }
+}
+
+static void *fsck_scan(void *arg) {
+    fsck_worker_t *w = arg;
+    fs = w->ctx;
+    size_t first, last;
+    fsck_range(fs->inode_capacity, w, &first, &last);
+
+    bool snapshot = fs->snapshot_active;
+    for (size_t i = first; i < last; i++) {
+        // blocks kept by the snapshot
+        if (snapshot && SNAPSHOT_EPOCH(i) == fs->snapshot_epoch &&
+            SNAPSHOT_INODE(i).state == TAKEN && SNAPSHOT_INODE(i).size > 0 &&
+            valid_block_number(SNAPSHOT_INODE(i).data_block)) {
+            w->block_refs[SNAPSHOT_INODE(i).data_block]++;
+        }
+
+        if (INODE_STATE(i) != TAKEN) {
+            continue;
+        }
+        w->report.inodes_checked++;
+
+        size_t size = INODE_SIZE(i);
+        int block_number = INODE_BLOCK(i);
+        // mapped host files have no regular block to account for
+        bool mapped = size > 0 && mapped_block_number(block_number) &&
+                      INODE_TYPE(i) == T_FILE;
+        if (size > BLOCK_SIZE ||
+            (size > 0 && !mapped && !valid_block_number(block_number))) {
+            w->report.invalid_inodes++;
+            continue;
+        }
+        if (size > 0 && !mapped) {
+            w->block_refs[block_number]++;
+        }
+
+        switch ((inode_type)INODE_TYPE(i)) {
+        case T_DIRECTORY:
+            if (size > 0) {
+                fsck_scan_dir(w, block_number);
+            }
+            break;
+        case T_SYMLINK:
+            if (size == 0) {
+                w->report.empty_symlinks++;
+            }
+            break;
+        case T_FILE:
+            break;
+        default:
+            w->report.invalid_inodes++;
+        }
+    }
+    return NULL;
+}
+
+static void *fsck_compare(void *arg) {
+    fsck_worker_t *w = arg;
+    fs = w->ctx;
+    size_t first, last;
+
+    fsck_range(DATA_BLOCKS, w, &first, &last);
+    for (size_t b = first; b < last; b++) {
+        uint32_t refs = 0;
+        for (size_t k = 0; k < w->worker_count; k++) {
+            refs += w->workers[k].block_refs[b];
+        }
+        w->report.blocks_checked++;
+
+        if (fs->free_blocks[b] != TAKEN) {
+            if (refs > 0) {
+                w->report.free_referenced_blocks++;
+            }
+        } else if (refs == 0) {
+            w->report.leaked_blocks++;
+        } else if (refs != fs->block_refcounts[b]) {
+            w->report.refcount_errors++;
+        }
+    }
+
+    // Directories aren't linked from other directories (there is only the
+    // root directory)
+    fsck_range(fs->inode_capacity, w, &first, &last);
+    for (size_t i = first; i < last; i++) {
+        if (INODE_STATE(i) != TAKEN || INODE_TYPE(i) == T_DIRECTORY) {
+            continue;
+        }
+        uint32_t links = 0;
+        for (size_t k = 0; k < w->worker_count; k++) {
+            links += w->workers[k].links[i];
+        }
+
+        if (links == 0) {
+            w->report.orphan_inodes++;
+        } else if (links != (uint32_t)INODE(i).hard_links) {
+            w->report.link_count_errors++;
+        }
+    }
+    return NULL;
+}
+
+static void fsck_report_merge(tfs_fsck_report_t *dest,
+                              tfs_fsck_report_t const *src) {
+    dest->inodes_checked += src->inodes_checked;
+    dest->blocks_checked += src->blocks_checked;
+    dest->invalid_inodes += src->invalid_inodes;
+    dest->empty_symlinks += src->empty_symlinks;
+    dest->dangling_entries += src->dangling_entries;
+    dest->orphan_inodes += src->orphan_inodes;
+    dest->link_count_errors += src->link_count_errors;
+    dest->leaked_blocks += src->leaked_blocks;
+    dest->free_referenced_blocks += src->free_referenced_blocks;
+    dest->refcount_errors += src->refcount_errors;
+}
+
+/*
+ * Runs one phase of the check on every worker (the first one in the calling
+ * thread). Returns false if a thread could not be created.
+ */
+static bool fsck_run(fsck_worker_t *workers, size_t count,
+                     void *(*phase)(void *)) {
+    size_t started = 1;
+    for (; started < count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, phase,
+                           &workers[started]) != 0) {
+            break;
+        }
+    }
+    phase(&workers[0]);
+    for (size_t i = 1; i < started; i++) {
+        ALWAYS_ASSERT(pthread_join(workers[i].thread, NULL) == 0,
+                      "pthread_join");
+    }
+    return started == count;
+}
+
+/**
+ * Check the consistency of the inode table, the directory and the block
+ * table.
+ *
+ * The FS must not be in use meanwhile.
+ *
+ * Input:
+ *   - report: where to store the results
+ *   - thread_count: number of threads to split the work among
+ *
+ * Returns the number of inconsistencies found, or -1 in case of error.
+ */
+ssize_t state_fsck(tfs_fsck_report_t *report, size_t thread_count) {
+    if (thread_count == 0) {
+        return -1;
+    }
+
+    fsck_worker_t *workers = calloc(thread_count, sizeof(fsck_worker_t));
+    if (workers == NULL) {
+        return -1;
+    }
+
+    bool ok = true;
+    for (size_t i = 0; i < thread_count; i++) {
+        workers[i].ctx = fs;
+        workers[i].workers = workers;
+        workers[i].worker_count = thread_count;
+        workers[i].index = i;
+        workers[i].block_refs = calloc(DATA_BLOCKS, sizeof(uint32_t));
+        workers[i].links = calloc(INODE_TABLE_SIZE, sizeof(uint32_t));
+        ok = ok && workers[i].block_refs != NULL && workers[i].links != NULL;
+    }
+
+    ok = ok && fsck_run(workers, thread_count, fsck_scan) &&
+         fsck_run(workers, thread_count, fsck_compare);
+
+    memset(report, 0, sizeof(*report));
+    for (size_t i = 0; i < thread_count; i++) {
+        fsck_report_merge(report, &workers[i].report);
+        free(workers[i].block_refs);
+        free(workers[i].links);
+    }
+    free(workers);
+
+    if (!ok) {
+        return -1;
+    }
+    return (ssize_t)(report->invalid_inodes + report->empty_symlinks +
+                     report->dangling_entries + report->orphan_inodes +
+                     report->link_count_errors + report->leaked_blocks +
+                     report->free_referenced_blocks + report->refcount_errors);
+}
+
+/*
+ * Packed image of the FS (see state_save_image): a header holding the FS
+ * parameters and a table of contents, followed by the sections it points to.
+ * Free inodes and blocks are left out, and each block only takes as many
+ * bytes as the largest inode using it. Numbers are stored little-endian.
+ *
+ * Header: magic, max_inode_count, max_block_count, max_open_files_count,
+ * block_size, scrub_rate, flags, then the number of inodes, blocks and
+ * directory entries, and the offsets of their sections and of the data.
+ * Inode: inumber (u32), hard links (u32), packed block (u32), type (u32),
+ * size (u64). Block: file offset of its contents (u64), length (u32),
+ * references (u32). Directory entry (of the root directory): inumber (u32),
+ * name.
+ */
+#define IMAGE_MAGIC "TFSIMG01"
+#define IMAGE_HEADER_SIZE (128)
+#define IMAGE_INODE_SIZE (24)
+#define IMAGE_BLOCK_SIZE (16)
+#define IMAGE_DIR_ENTRY_SIZE (4 + MAX_FILE_NAME)
+#define IMAGE_NO_BLOCK (UINT32_MAX)
+// size of the buffer that small sections and blocks are gathered in
+#define IMAGE_WRITE_BUFFER (1 << 20)
+
+enum {
+    IMAGE_DIR_PREFIX_INDEX = 1 << 0,
+    IMAGE_DEDUP = 1 << 1,
+    IMAGE_VERIFY_CHECKSUMS = 1 << 2,
+    IMAGE_HUGE_PAGES = 1 << 3,
+};
+
+// header fields, by position (each one takes 8 bytes, after the magic)
+enum {
+    IMAGE_MAX_INODES = 1,
+    IMAGE_MAX_BLOCKS,
+    IMAGE_MAX_OPEN_FILES,
+    IMAGE_BLOCK_SIZE_FIELD,
+    IMAGE_SCRUB_RATE,
+    IMAGE_FLAGS,
+    IMAGE_INODE_COUNT,
+    IMAGE_BLOCK_COUNT,
+    IMAGE_DIR_COUNT,
+    IMAGE_INODE_OFFSET,
+    IMAGE_BLOCK_OFFSET,
+    IMAGE_DIR_OFFSET,
+    IMAGE_DATA_OFFSET,
+};
+
+static void image_put(uint8_t *p, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; i++) {
+        p[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t image_get(uint8_t const *p, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; i++) {
+        value |= (uint64_t)p[i] << (8 * i);
+    }
+    return value;
+}
+
+static uint64_t image_header_get(uint8_t const *header, int field) {
+    return image_get(header + 8 * field, 8);
+}
+
+static void image_header_put(uint8_t *header, int field, uint64_t value) {
+    image_put(header + 8 * field, value, 8);
+}
+
+/*
+ * Buffered writes to the image file, so that small records and blocks don't
+ * take a system call each.
+ */
+typedef struct {
+    int fd;
+    uint8_t *buffer;
+    size_t used;
+    bool failed;
+} image_writer_t;
+
+static void image_flush(image_writer_t *w) {
+    size_t done = 0;
+    while (!w->failed && done < w->used) {
+        ssize_t n = write(w->fd, w->buffer + done, w->used - done);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            w->failed = true;
+            break;
+        }
+        done += (size_t)n;
+    }
+    w->used = 0;
+}
+
+static void image_write(image_writer_t *w, void const *data, size_t len) {
+    if (w->used + len > IMAGE_WRITE_BUFFER) {
+        image_flush(w);
+    }
+    if (len > IMAGE_WRITE_BUFFER) {
+        // large blocks go straight to the file
+        uint8_t *buffer = w->buffer;
+        w->buffer = (uint8_t *)data;
+        w->used = len;
+        image_flush(w);
+        w->buffer = buffer;
+        return;
+    }
+    memcpy(w->buffer + w->used, data, len);
+    w->used += len;
+}
+
+/*
+ * Contents of a block to save: mapped host files are saved as regular
+ * blocks, and cold blocks are decompressed into scratch (without thawing them
+ * in the FS).
+ * Returns NULL if the block doesn't match its checksum.
+ */
+static char const *image_block_contents(int block_number, char *scratch) {
+    if (mapped_block_number(block_number)) {
+        return mapped_block(block_number)->data;
+    }
+
+    SCOPED_LOCK(fs->compression_mutex);
+    compressed_block_t const *compressed = &fs->compressed_blocks[block_number];
+    if (compressed->data != NULL) {
+        int result = lz_decompress(compressed->data, compressed->len, scratch,
+                                   compressed->raw_len);
+        ALWAYS_ASSERT(result == 0,
+                      "state_save_image: corrupted compressed block");
+        return scratch;
+    }
+    if (fs->params.verify_checksums && !data_block_verify(block_number)) {
+        return NULL;
+    }
+    return &fs->data[(size_t)block_number * BLOCK_SIZE];
+}
+
+/**
+ * Save the files, symlinks and root directory entries of the FS to a packed
+ * image (see state_load_image). Snapshots and open files are not saved.
+ *
+ * The FS must not be in use meanwhile.
+ *
+ * Input:
+ *   - fd: host file to write the image to
+ *
+ * Returns 0 if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - Write error, or allocation failure.
+ *   - A block doesn't match its checksum (if verify_checksums is set).
+ */
+int state_save_image(int fd) {
+    // packed index of each (regular or mapped) block, and the block number,
+    // length and references of each packed block
+    size_t slots = DATA_BLOCKS + INODE_TABLE_SIZE;
+    uint32_t *packed = malloc(slots * sizeof(uint32_t));
+    int *block_numbers = malloc(slots * sizeof(int));
+    size_t *lens = calloc(slots, sizeof(size_t));
+    uint32_t *refs = calloc(slots, sizeof(uint32_t));
+    char *scratch = malloc(BLOCK_SIZE);
+    image_writer_t w = {.fd = fd, .buffer = malloc(IMAGE_WRITE_BUFFER)};
+    int result = -1;
+    if (packed == NULL || block_numbers == NULL || lens == NULL ||
+        refs == NULL || scratch == NULL || w.buffer == NULL) {
+        goto out;
+    }
+    memset(packed, 0xff, slots * sizeof(uint32_t)); // IMAGE_NO_BLOCK
+
+    size_t inode_count = 0;
+    size_t block_count = 0;
+    for (size_t i = 0; i < fs->inode_capacity; i++) {
+        if (i == ROOT_DIR_INUM || INODE_STATE(i) != TAKEN) {
+            continue;
+        }
+        if (INODE_TYPE(i) == T_DIRECTORY) {
+            goto out; // only the root directory is supported
+        }
+        inode_count++;
+
+        int b = INODE_BLOCK(i);
+        if (INODE_SIZE(i) == 0 || b == -1) {
+            continue;
+        }
+        size_t slot = (size_t)b;
+        if (packed[slot] == IMAGE_NO_BLOCK) {
+            packed[slot] = (uint32_t)block_count;
+            block_numbers[block_count++] = b;
+        }
+        uint32_t index = packed[slot];
+        if (INODE_SIZE(i) > lens[index]) {
+            lens[index] = INODE_SIZE(i);
+        }
+        refs[index]++;
+    }
+
+    dir_entry_t const *root_entries = (dir_entry_t const *)&fs->data
+        [(size_t)INODE_BLOCK(ROOT_DIR_INUM) * BLOCK_SIZE];
+    size_t dir_count = 0;
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        dir_count += root_entries[i].d_inumber != -1;
+    }
+
+    uint8_t header[IMAGE_HEADER_SIZE] = {0};
+    memcpy(header, IMAGE_MAGIC, 8);
+    image_header_put(header, IMAGE_MAX_INODES, INODE_TABLE_SIZE);
+    image_header_put(header, IMAGE_MAX_BLOCKS, DATA_BLOCKS);
+    image_header_put(header, IMAGE_MAX_OPEN_FILES, MAX_OPEN_FILES);
+    image_header_put(header, IMAGE_BLOCK_SIZE_FIELD, BLOCK_SIZE);
+    image_header_put(header, IMAGE_SCRUB_RATE, fs->params.scrub_rate);
+    image_header_put(
+        header, IMAGE_FLAGS,
+        (fs->params.dir_prefix_index ? IMAGE_DIR_PREFIX_INDEX : 0) |
+            (fs->params.dedup ? IMAGE_DEDUP : 0) |
+            (fs->params.verify_checksums ? IMAGE_VERIFY_CHECKSUMS : 0) |
+            (fs->params.huge_pages ? IMAGE_HUGE_PAGES : 0));
+    image_header_put(header, IMAGE_INODE_COUNT, inode_count);
+    image_header_put(header, IMAGE_BLOCK_COUNT, block_count);
+    image_header_put(header, IMAGE_DIR_COUNT, dir_count);
+    size_t offset = IMAGE_HEADER_SIZE;
+    image_header_put(header, IMAGE_INODE_OFFSET, offset);
+    offset += inode_count * IMAGE_INODE_SIZE;
+    image_header_put(header, IMAGE_BLOCK_OFFSET, offset);
+    offset += block_count * IMAGE_BLOCK_SIZE;
+    image_header_put(header, IMAGE_DIR_OFFSET, offset);
+    offset += dir_count * IMAGE_DIR_ENTRY_SIZE;
+    image_header_put(header, IMAGE_DATA_OFFSET, offset);
+    image_write(&w, header, sizeof(header));
+
+    for (size_t i = 0; i < fs->inode_capacity; i++) {
+        if (i == ROOT_DIR_INUM || INODE_STATE(i) != TAKEN) {
+            continue;
+        }
+        int b = INODE_BLOCK(i);
+        uint8_t record[IMAGE_INODE_SIZE];
+        image_put(record, i, 4);
+        image_put(record + 4, (uint64_t)INODE(i).hard_links, 4);
+        image_put(record + 8,
+                  INODE_SIZE(i) == 0 || b == -1 ? IMAGE_NO_BLOCK
+                                                 : packed[(size_t)b],
+                  4);
+        image_put(record + 12, INODE_TYPE(i), 4);
+        image_put(record + 16, INODE_SIZE(i), 8);
+        image_write(&w, record, sizeof(record));
+    }
+
+    for (size_t i = 0; i < block_count; i++) {
+        uint8_t record[IMAGE_BLOCK_SIZE];
+        image_put(record, offset, 8);
+        image_put(record + 8, lens[i], 4);
+        image_put(record + 12, refs[i], 4);
+        image_write(&w, record, sizeof(record));
+        offset += lens[i];
+    }
+
+    for (size_t i = 0; i < MAX_DIR_ENTRIES; i++) {
+        if (root_entries[i].d_inumber == -1) {
+            continue;
+        }
+        uint8_t record[IMAGE_DIR_ENTRY_SIZE] = {0};
+        image_put(record, (uint64_t)root_entries[i].d_inumber, 4);
+        memcpy(record + 4, root_entries[i].d_name,
+               strnlen(root_entries[i].d_name, MAX_FILE_NAME - 1));
+        image_write(&w, record, sizeof(record));
+    }
+
+    for (size_t i = 0; i < block_count && !w.failed; i++) {
+        char const *contents = image_block_contents(block_numbers[i], scratch);
+        if (contents == NULL) {
+            goto out; // corrupted
+        }
+        image_write(&w, contents, lens[i]);
+        if (contents == scratch) {
+            image_flush(&w); // scratch is reused by the next block
+        }
+    }
+    image_flush(&w);
+    result = w.failed ? -1 : 0;
+
+out:
+    free(packed);
+    free(block_numbers);
+    free(lens);
+    free(refs);
+    free(scratch);
+    free(w.buffer);
+    return result;
+}
+
+static int image_pread(int fd, void *buffer, size_t len, size_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char *)buffer + done, len - done,
+                          (off_t)(offset + done));
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/**
+ * Read the FS parameters saved in a packed image.
+ *
+ * Input:
+ *   - fd: host file holding the image
+ *   - params: where to store the parameters
+ *
+ * Returns 0 if successful, -1 if the file is not an image.
+ */
+int state_read_image_params(int fd, tfs_params *params) {
+    uint8_t header[IMAGE_HEADER_SIZE];
+    if (image_pread(fd, header, sizeof(header), 0) == -1 ||
+        memcmp(header, IMAGE_MAGIC, 8) != 0) {
+        return -1;
+    }
+
+    uint64_t flags = image_header_get(header, IMAGE_FLAGS);
+    params->max_inode_count = image_header_get(header, IMAGE_MAX_INODES);
+    params->max_block_count = image_header_get(header, IMAGE_MAX_BLOCKS);
+    params->max_open_files_count =
+        image_header_get(header, IMAGE_MAX_OPEN_FILES);
+    params->block_size = image_header_get(header, IMAGE_BLOCK_SIZE_FIELD);
+    params->scrub_rate = image_header_get(header, IMAGE_SCRUB_RATE);
+    params->dir_prefix_index = flags & IMAGE_DIR_PREFIX_INDEX;
+    params->dedup = flags & IMAGE_DEDUP;
+    params->verify_checksums = flags & IMAGE_VERIFY_CHECKSUMS;
+    params->huge_pages = flags & IMAGE_HUGE_PAGES;
+    if (params->max_inode_count == 0 || params->max_inode_count > INT_MAX ||
+        params->max_block_count == 0 || params->max_block_count > INT_MAX ||
+        params->max_open_files_count == 0 ||
+        params->block_size < sizeof(dir_entry_t) ||
+        params->block_size > UINT32_MAX) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Image loader (see state_load_image). Each worker reads a range of the
+ * blocks straight into the data block area, and fills in a range of the
+ * inodes.
+ */
+typedef struct {
+    tfs_ctx *ctx;
+    int fd;
+    size_t index;
+    size_t worker_count;
+    pthread_t thread;
+    uint8_t const *inodes;
+    size_t inode_count;
+    uint8_t const *blocks;
+    size_t block_count;
+    // block number of each packed block
+    int const *block_numbers;
+    bool failed;
+} image_worker_t;
+
+static void *image_load_range(void *arg) {
+    image_worker_t *w = arg;
+    fs = w->ctx;
+
+    size_t first = w->block_count * w->index / w->worker_count;
+    size_t last = w->block_count * (w->index + 1) / w->worker_count;
+    for (size_t i = first; i < last && !w->failed; i++) {
+        uint8_t const *record = w->blocks + i * IMAGE_BLOCK_SIZE;
+        int b = w->block_numbers[i];
+        char *block = data_block_get_for_write(b);
+        w->failed = image_pread(w->fd, block, image_get(record + 8, 4),
+                                image_get(record, 8)) == -1;
+        data_block_written(b);
+    }
+
+    first = w->inode_count * w->index / w->worker_count;
+    last = w->inode_count * (w->index + 1) / w->worker_count;
+    for (size_t i = first; i < last; i++) {
+        uint8_t const *record = w->inodes + i * IMAGE_INODE_SIZE;
+        size_t inumber = image_get(record, 4);
+        uint32_t packed = (uint32_t)image_get(record + 8, 4);
+        inode_init((int)inumber, (inode_type)image_get(record + 12, 4));
+        INODE(inumber).hard_links = (int)image_get(record + 4, 4);
+        INODE_SIZE(inumber) = image_get(record + 16, 8);
+        INODE_BLOCK(inumber) =
+            packed == IMAGE_NO_BLOCK ? -1 : w->block_numbers[packed];
+    }
+    return NULL;
+}
+
+/*
+ * Checks the sections of an image against each other and against the FS's
+ * limits, so that loading it can't corrupt the FS.
+ */
+static bool image_valid(uint8_t const *inodes, size_t inode_count,
+                        uint8_t const *blocks, size_t block_count,
+                        uint8_t const *dir, size_t dir_count,
+                        size_t file_size) {
+    bool *seen = calloc(INODE_TABLE_SIZE, sizeof(bool));
+    uint32_t *refs = calloc(block_count + 1, sizeof(uint32_t));
+    bool valid = seen != NULL && refs != NULL;
+
+    for (size_t i = 0; i < block_count && valid; i++) {
+        uint8_t const *record = blocks + i * IMAGE_BLOCK_SIZE;
+        uint64_t offset = image_get(record, 8);
+        uint64_t len = image_get(record + 8, 4);
+        valid = len <= BLOCK_SIZE && offset <= file_size &&
+                len <= file_size - offset;
+    }
+
+    for (size_t i = 0; i < inode_count && valid; i++) {
+        uint8_t const *record = inodes + i * IMAGE_INODE_SIZE;
+        uint64_t inumber = image_get(record, 4);
+        uint64_t hard_links = image_get(record + 4, 4);
+        uint64_t packed = image_get(record + 8, 4);
+        uint64_t type = image_get(record + 12, 4);
+        uint64_t size = image_get(record + 16, 8);
+        valid = inumber != ROOT_DIR_INUM && inumber < INODE_TABLE_SIZE &&
+                !seen[inumber] && hard_links > 0 && hard_links <= INT_MAX &&
+                (type == T_FILE || type == T_SYMLINK) &&
+                (packed == IMAGE_NO_BLOCK
+                     ? size == 0
+                     : packed < block_count &&
+                           size <= image_get(blocks +
+                                                 packed * IMAGE_BLOCK_SIZE + 8,
+                                             4));
+        if (valid) {
+            seen[inumber] = true;
+            refs[packed == IMAGE_NO_BLOCK ? block_count : packed]++;
+        }
+    }
+
+    for (size_t i = 0; i < block_count && valid; i++) {
+        valid = refs[i] > 0 &&
+                refs[i] == image_get(blocks + i * IMAGE_BLOCK_SIZE + 12, 4);
+    }
+
+    for (size_t i = 0; i < dir_count && valid; i++) {
+        uint8_t const *record = dir + i * IMAGE_DIR_ENTRY_SIZE;
+        uint64_t inumber = image_get(record, 4);
+        size_t len = strnlen((char const *)record + 4, MAX_FILE_NAME);
+        valid = inumber < INODE_TABLE_SIZE && seen[inumber] && len > 0 &&
+                len < MAX_FILE_NAME;
+    }
+
+    free(seen);
+    free(refs);
+    return valid;
+}
+
+/**
+ * Load a packed image (see state_save_image) into a freshly initialized FS,
+ * with the parameters saved in it (see state_read_image_params).
+ *
+ * The blocks and inodes are read in parallel, by thread_count threads.
+ *
+ * Input:
+ *   - fd: host file holding the image
+ *   - thread_count: number of threads to split the work among
+ *
+ * Returns 0 if successful, -1 otherwise (the FS may then hold part of the
+ * image).
+ *
+ * Possible errors:
+ *   - The image is malformed, or doesn't fit in the FS.
+ *   - Read error, or allocation failure.
+ */
+int state_load_image(int fd, size_t thread_count) {
+    uint8_t header[IMAGE_HEADER_SIZE];
+    struct stat st;
+    if (thread_count == 0 || fstat(fd, &st) == -1 ||
+        image_pread(fd, header, sizeof(header), 0) == -1 ||
+        memcmp(header, IMAGE_MAGIC, 8) != 0 ||
+        image_header_get(header, IMAGE_BLOCK_SIZE_FIELD) != BLOCK_SIZE) {
+        return -1;
+    }
+
+    size_t file_size = (size_t)st.st_size;
+    uint64_t inode_count = image_header_get(header, IMAGE_INODE_COUNT);
+    uint64_t block_count = image_header_get(header, IMAGE_BLOCK_COUNT);
+    uint64_t dir_count = image_header_get(header, IMAGE_DIR_COUNT);
+    // the root directory keeps its inode and block
+    if (inode_count >= INODE_TABLE_SIZE || block_count >= DATA_BLOCKS ||
+        dir_count > MAX_DIR_ENTRIES) {
+        return -1;
+    }
+
+    uint8_t *inodes = malloc(inode_count * IMAGE_INODE_SIZE + 1);
+    uint8_t *blocks = malloc(block_count * IMAGE_BLOCK_SIZE + 1);
+    uint8_t *dir = malloc(dir_count * IMAGE_DIR_ENTRY_SIZE + 1);
+    int *block_numbers = malloc(block_count * sizeof(int) + 1);
+    char const **names = malloc(dir_count * sizeof(char *) + 1);
+    int *inumbers = malloc(dir_count * sizeof(int) + 1);
+    bool *added = malloc(dir_count * sizeof(bool) + 1);
+    image_worker_t *workers = calloc(thread_count, sizeof(image_worker_t));
+    int result = -1;
+    if (inodes == NULL || blocks == NULL || dir == NULL ||
+        block_numbers == NULL || names == NULL || inumbers == NULL ||
+        added == NULL || workers == NULL ||
+        image_pread(fd, inodes, inode_count * IMAGE_INODE_SIZE,
+                    image_header_get(header, IMAGE_INODE_OFFSET)) == -1 ||
+        image_pread(fd, blocks, block_count * IMAGE_BLOCK_SIZE,
+                    image_header_get(header, IMAGE_BLOCK_OFFSET)) == -1 ||
+        image_pread(fd, dir, dir_count * IMAGE_DIR_ENTRY_SIZE,
+                    image_header_get(header, IMAGE_DIR_OFFSET)) == -1 ||
+        !image_valid(inodes, inode_count, blocks, block_count, dir, dir_count,
+                     file_size)) {
+        goto out;
+    }
+
+    // Takes the blocks up front, so that the workers only fill them in
+    {
+        SCOPED_RWLOCK_W(fs->data_block_alloc_rwlock);
+        size_t taken = 0;
+        for (size_t b = 0; b < DATA_BLOCKS && taken < block_count; b++) {
+            if (fs->free_blocks[b] == FREE) {
+                __atomic_store_n(&fs->free_blocks[b], TAKEN, __ATOMIC_RELAXED);
+                if (b >= fs->block_high_water) {
+                    fs->block_high_water = b + 1;
+                }
+                fs->block_refcounts[b] = (uint32_t)image_get(
+                    blocks + taken * IMAGE_BLOCK_SIZE + 12, 4);
+                block_numbers[taken++] = (int)b;
+            }
+        }
+        if (taken < block_count) {
+            goto out; // no space
+        }
+    }
+    {
+        SCOPED_RWLOCK_W(fs->inode_alloc_rwlock);
+        for (size_t i = 0; i < inode_count; i++) {
+            size_t inumber = image_get(inodes + i * IMAGE_INODE_SIZE, 4);
+            while (inumber >= fs->inode_capacity) {
+                if (!inode_table_grow()) {
+                    goto out; // allocation failed
+                }
+            }
+            if (INODE_STATE(inumber) != FREE) {
+                goto out; // the FS is not empty
+            }
+            INODE_STATE(inumber) = TAKEN;
+        }
+    }
+
+    size_t started = 1;
+    for (size_t i = 0; i < thread_count; i++) {
+        workers[i] = (image_worker_t){
+            .ctx = fs,
+            .fd = fd,
+            .index = i,
+            .worker_count = thread_count,
+            .inodes = inodes,
+            .inode_count = inode_count,
+            .blocks = blocks,
+            .block_count = block_count,
+            .block_numbers = block_numbers,
+        };
+    }
+    for (; started < thread_count; started++) {
+        if (pthread_create(&workers[started].thread, NULL, image_load_range,
+                           &workers[started]) != 0) {
+            break;
+        }
+    }
+    // the calling thread takes the first range, and those of the threads
+    // that could not be created
+    image_load_range(&workers[0]);
+    for (size_t i = started; i < thread_count; i++) {
+        image_load_range(&workers[i]);
+    }
+    bool failed = false;
+    for (size_t i = 0; i < thread_count; i++) {
+        if (i > 0 && i < started) {
+            ALWAYS_ASSERT(pthread_join(workers[i].thread, NULL) == 0,
+                          "pthread_join");
+        }
+        failed = failed || workers[i].failed;
+    }
+    if (failed) {
+        goto out;
+    }
+
+    for (size_t i = 0; i < dir_count; i++) {
+        uint8_t const *record = dir + i * IMAGE_DIR_ENTRY_SIZE;
+        inumbers[i] = (int)image_get(record, 4);
+        names[i] = (char const *)record + 4;
+    }
+    if (add_dir_entries(&INODE(ROOT_DIR_INUM), names, inumbers, added,
+                        dir_count) == (ssize_t)dir_count) {
+        result = 0;
+    }
+
+out:
+    free(inodes);
+    free(blocks);
+    free(dir);
+    free(block_numbers);
+    free(names);
+    free(inumbers);
+    free(added);
+    free(workers);
+    return result;
+}
+
+/**
+ * Obtain a snapshot of the FS statistics.
+ *
+ * Input:
+ *   - stats: where to store the statistics
+ */
+void state_get_stats(tfs_stats_t *stats) {
+    STAT_LOAD(stats, dir_lookups);
+    STAT_LOAD(stats, dir_bloom_negatives);
+    STAT_LOAD(stats, dir_bloom_false_positives);
+    STAT_LOAD(stats, symlink_cache_hits);
+    STAT_LOAD(stats, cow_copies);
+    STAT_LOAD(stats, cold_raw_bytes);
+    STAT_LOAD(stats, cold_stored_bytes);
+    STAT_LOAD(stats, decompressed_bytes);
+    STAT_LOAD(stats, decompress_ns);
+    STAT_LOAD(stats, dedup_checks);
+    STAT_LOAD(stats, dedup_hits);
+    STAT_LOAD(stats, dedup_hashed_bytes);
+    STAT_LOAD(stats, dedup_hash_ns);
+    STAT_LOAD(stats, checksum_bytes);
+    STAT_LOAD(stats, checksum_ns);
+    STAT_LOAD(stats, checksum_errors);
+    STAT_LOAD(stats, scrubbed_blocks);
+    STAT_LOAD(stats, mapped_bytes);
+    STAT_LOAD(stats, mapped_copies);
+    STAT_LOAD(stats, released_bytes);
+}
+
+/*
+ * Allocates the next chunk of the open file table, unless the table already
+ * holds max_open_files_count entries. The caller must hold
+ * file_table_alloc_rwlock for writing.
+ * Returns false if the table can't grow.
+ */
+static bool open_file_table_grow(void) {
+    size_t capacity = fs->open_file_capacity;
+    if (capacity >= MAX_OPEN_FILES) {
+        return false;
+    }
+    open_file_chunk_t *chunk = calloc(1, sizeof(open_file_chunk_t));
+    if (chunk == NULL) {
+        return false;
+    }
+
+    for (size_t i = 0; i < OPEN_FILE_CHUNK_SIZE; i++) {
+        pthread_mutex_init(&chunk->entries[i].mtx, NULL);
+        chunk->entries[i].of_inumber = -1;
+        chunk->states[i] = FREE;
+    }
+    fs->open_file_chunks[capacity >> OPEN_FILE_CHUNK_SHIFT] = chunk;
+    size_t grown = capacity + OPEN_FILE_CHUNK_SIZE;
+    __atomic_store_n(&fs->open_file_capacity,
+                     grown < MAX_OPEN_FILES ? grown : MAX_OPEN_FILES,
+                     __ATOMIC_RELEASE);
+    return true;
+}
+
+/**
+ * Add a new entry to the open file table.
+ *
+ * Input:
+ *   - inumber: inode number of the file to open
+ *   - offset: initial offset
+ *
+ * Returns file handle if successful, -1 otherwise.
+ *
+ * Possible errors:
+ *   - No space in open file table for a new open file.
+ */
+int add_to_open_file_table(int inumber, size_t offset) {
+    pthread_rwlock_rdlock(&fs->file_table_alloc_rwlock);
+    int i = 0;
+    for (; i < fs->open_file_capacity; i++) {
+
+        if (OPEN_FILE_STATE(i) == FREE) {
+            pthread_rwlock_unlock(&fs->file_table_alloc_rwlock);
+            pthread_rwlock_wrlock(&fs->file_table_alloc_rwlock);
+            if(OPEN_FILE_STATE(i) == TAKEN){
+                pthread_rwlock_unlock(&fs->file_table_alloc_rwlock);
+                pthread_rwlock_rdlock(&fs->file_table_alloc_rwlock);
+                continue;
+            }
+            OPEN_FILE_STATE(i) = TAKEN;
+            OPEN_FILE(i).of_inumber = inumber;
+            OPEN_FILE(i).of_offset = offset;
+            OPEN_FILE(i).of_snapshot = false;
+            pthread_rwlock_unlock(&fs->file_table_alloc_rwlock);
+            return i;
+        }
+
+    }
+    pthread_rwlock_unlock(&fs->file_table_alloc_rwlock);
+
+    // No free entries in the allocated chunks, so the table grows (unless
+    // another thread grew it meanwhile)
+    SCOPED_RWLOCK_W(fs->file_table_alloc_rwlock);
+    for (;; i++) {
+        if (i == fs->open_file_capacity && !open_file_table_grow()) {
+            return -1; // no free entries
+        }
+        if (OPEN_FILE_STATE(i) == FREE) {
+            OPEN_FILE_STATE(i) = TAKEN;
+            OPEN_FILE(i).of_inumber = inumber;
+            OPEN_FILE(i).of_offset = offset;
+            OPEN_FILE(i).of_snapshot = false;
+            return i;
+        }
     }
-    pthread_rwlock_unlock(&file_table_alloc_rwlock);
-    return -1;
 }
 
 /**
@@ -555,10 +3473,10 @@ void remove_from_open_file_table(int fhandle) {
     ALWAYS_ASSERT(valid_file_handle(fhandle),
                   "remove_from_open_file_table: file handle must be valid");
 
-    ALWAYS_ASSERT(free_open_file_entries[fhandle] == TAKEN,
+    ALWAYS_ASSERT(OPEN_FILE_STATE(fhandle) == TAKEN,
                   "remove_from_open_file_table: file handle must be taken");
 
-    free_open_file_entries[fhandle] = FREE;
+    OPEN_FILE_STATE(fhandle) = FREE;
 }
 
 /**
@@ -575,11 +3493,11 @@ open_file_entry_t *get_open_file_entry(int fhandle) {
         return NULL;
     }
 
-    if (free_open_file_entries[fhandle] != TAKEN) {
+    if (OPEN_FILE_STATE(fhandle) != TAKEN) {
         return NULL;
     }
 
-    return &open_file_table[fhandle];
+    return &OPEN_FILE(fhandle);
 }
 
 /**
@@ -591,9 +3509,11 @@ open_file_entry_t *get_open_file_entry(int fhandle) {
  * Returns true if the file is opened and false otherwise
  */
 bool is_file_open(int inumber){
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        if (open_file_table[i].of_inumber == inumber &&
-                free_open_file_entries[i] == TAKEN) {
+    size_t capacity = __atomic_load_n(&fs->open_file_capacity, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < capacity; i++) {
+        if (OPEN_FILE(i).of_inumber == inumber &&
+                !OPEN_FILE(i).of_snapshot &&
+                OPEN_FILE_STATE(i) == TAKEN) {
             return 1;
         }
     }
@@ -611,5 +3531,5 @@ bool is_file_open(int inumber){
 int is_inum_taken(int inum){
     ALWAYS_ASSERT(valid_inumber(inum), 
         "isInumTaken: invalid inumber");
-    return freeinode_ts[inum] == TAKEN;
+    return INODE_STATE(inum) == TAKEN;
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include "operations.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -18,19 +19,29 @@ typedef struct {
     int d_inumber;
 } dir_entry_t;
 
-typedef enum { T_FILE, T_DIRECTORY, T_SYMLINK } inode_type;
-
 /**
- * Inode
+ * Inode handle
+ *
+ * Only the cold per-inode state lives here. The hot fields (type, size and
+ * data block) are kept in dense parallel arrays inside state.c and must be
+ * accessed through the inode_get_* / inode_set_* functions below.
  */
 typedef struct {
-    inode_type i_node_type;
     pthread_rwlock_t rwlock;
-    size_t i_size;
-    int i_data_block;
+    int i_inumber;
     int hard_links;
 } inode_t;
 
+/**
+ * Result of a bulk scan over the inode table
+ */
+typedef struct {
+    size_t files;
+    size_t directories;
+    size_t symlinks;
+    size_t bytes;
+} inode_table_stats_t;
+
 typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
 
 /**
@@ -39,6 +50,8 @@ typedef enum { FREE = 0, TAKEN = 1 } allocation_state_t;
 typedef struct {
     int of_inumber;
     size_t of_offset;
+    // the handle reads the file as of the snapshot (read-only)
+    bool of_snapshot;
     pthread_mutex_t mtx;
 } open_file_entry_t;
 
@@ -71,22 +84,80 @@ void mutex_unlock(pthread_mutex_t** mt);
 
 #define SCOPED_LOCK(mutex) INTERNAL_SCOPED_LOCK(mutex, __COUNTER__)
 
+/*
+ * The state functions operate on the calling thread's current instance (the
+ * default one, unless changed with state_enter). SCOPED_CTX switches to an
+ * instance until the end of the scope.
+ */
+tfs_ctx *state_ctx_new(void);
+void state_ctx_free(tfs_ctx *ctx);
+tfs_ctx *state_current(void);
+tfs_ctx *state_enter(tfs_ctx *ctx);
+void state_leave(tfs_ctx **prev);
+
+#define INTERNAL_SCOPED_CTX(ctx, c)\
+    tfs_ctx* CONCAT(prev_ctx, c) __attribute__((cleanup(state_leave)))=state_enter(ctx)
+
+#define SCOPED_CTX(ctx) INTERNAL_SCOPED_CTX(ctx, __COUNTER__)
+
 int state_init(tfs_params);
 int state_destroy(void);
+int state_reset(void);
 
 size_t state_block_size(void);
 
 int inode_create(inode_type n_type);
+size_t inode_create_batch(inode_type i_type, int *inumbers, size_t count);
 void inode_delete(int inumber);
 inode_t *inode_get(int inumber);
 
+inode_type inode_get_type(inode_t const *inode);
+size_t inode_get_size(inode_t const *inode);
+void inode_set_size(inode_t *inode, size_t size);
+int inode_get_data_block(inode_t const *inode);
+void inode_set_data_block(inode_t *inode, int block_number);
+void *inode_writable_block(inode_t *inode);
+void inode_truncate(inode_t *inode);
+void inode_dedup(inode_t *inode);
+void inode_table_stats(inode_table_stats_t *stats);
+
+int symlink_cache_get(int inumber);
+void symlink_cache_set(int inumber, int target_inumber, uint32_t generation);
+uint32_t namespace_generation(void);
+
 int clear_dir_entry(inode_t *inode, char const *sub_name);
 int add_dir_entry(inode_t *inode, char const *sub_name, int sub_inumber);
-int find_in_dir(inode_t const *inode, char const *sub_name);
+ssize_t add_dir_entries(inode_t *inode, char const *const *sub_names,
+                        int const *sub_inumbers, bool *added, size_t count);
+int find_in_dir(inode_t *inode, char const *sub_name);
+size_t dir_read_entries(inode_t *inode, size_t *cursor, tfs_dirent_t *entries,
+                        size_t max_entries);
+ssize_t dir_list_prefix(inode_t *inode, char const *prefix,
+                        tfs_dirent_callback_t cb, void *arg);
+
+int snapshot_create(void);
+int snapshot_destroy(void);
+int snapshot_acquire(void);
+void snapshot_release(void);
+int snapshot_inode_get(int inumber, inode_type *type, size_t *size,
+                       int *data_block);
+int snapshot_find_in_dir(inode_t *inode, char const *sub_name);
+
+void state_get_stats(tfs_stats_t *stats);
+ssize_t state_fsck(tfs_fsck_report_t *report, size_t thread_count);
+int state_save_image(int fd);
+int state_read_image_params(int fd, tfs_params *params);
+int state_load_image(int fd, size_t thread_count);
 
 int data_block_alloc(void);
+int data_block_map(int fd, size_t len);
 void data_block_free(int block_number);
+void data_block_ref(int block_number);
+int data_block_compress(int block_number, size_t len);
+uint32_t data_block_refcount(int block_number);
 void* data_block_get(int block_number);
+void *data_block_get_for_write(int block_number);
+void data_block_written(int block_number);
 
 int add_to_open_file_table(int inumber, size_t offset);
 void remove_from_open_file_table(int fhandle);
@@ -0,0 +1,95 @@
+#include "fs/crc32c.h"
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+uint8_t const file_contents[] = "AAA!";
+
+void create_file(char const *path) {
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+}
+
+ssize_t read_file(char const *path) {
+    uint8_t buffer[sizeof(file_contents)];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    ssize_t read = tfs_read(f, buffer, sizeof(buffer));
+    assert(tfs_close(f) != -1);
+    return read;
+}
+
+// flips a bit of the file's block behind the FS's back
+void corrupt(int inumber) {
+    char *block = data_block_get(inode_get_data_block(inode_get(inumber)));
+    assert(block != NULL);
+    block[1] ^= 0x10;
+}
+
+int main() {
+    // known answer, and the same result with or without the crc32 instruction
+    assert(crc32c("123456789", 9) == 0xe3069283);
+    assert(crc32c_generic("123456789", 9) == 0xe3069283);
+    char data[1000];
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (char)(i * 7);
+    }
+    for (size_t len = 0; len < sizeof(data); len += 37) {
+        assert(crc32c(data, len) == crc32c_generic(data, len));
+    }
+
+    tfs_params params = tfs_default_params();
+    params.verify_checksums = true;
+    assert(tfs_init(&params) != -1);
+
+    create_file("/f1"); // inumber 1
+    assert(read_file("/f1") == sizeof(file_contents));
+    corrupt(1);
+    assert(read_file("/f1") == -1);
+
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    assert(stats.checksum_errors == 1);
+    assert(stats.checksum_bytes > 0);
+
+    // rewriting the block fixes it
+    int f = tfs_open("/f1", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+    assert(read_file("/f1") == sizeof(file_contents));
+    assert(tfs_destroy() != -1);
+
+    // without verify on read, corruption goes unnoticed...
+    params.verify_checksums = false;
+    params.scrub_rate = 10000;
+    assert(tfs_init(&params) != -1);
+    create_file("/f1");
+    corrupt(1);
+    assert(read_file("/f1") == sizeof(file_contents));
+
+    // ...until the scrubber finds it
+    struct timespec tick = {.tv_sec = 0, .tv_nsec = 10000000};
+    for (int i = 0; i < 500; i++) {
+        tfs_get_stats(&stats);
+        if (stats.checksum_errors > 0) {
+            break;
+        }
+        nanosleep(&tick, NULL);
+    }
+    assert(stats.checksum_errors > 0);
+    assert(stats.scrubbed_blocks > 0);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
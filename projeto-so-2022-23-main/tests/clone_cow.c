@@ -0,0 +1,100 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const file_contents[] = "AAA!";
+uint8_t const new_contents[] = "BBB!";
+
+void assert_contents(char const *path, uint8_t const *expected) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    uint8_t buffer[sizeof(file_contents)];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, expected, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void overwrite(char const *path, uint8_t const *contents, ssize_t expected) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(file_contents)) == expected);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    // room for the root directory and a single file block
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 2;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/src", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+
+    // clones don't need data blocks of their own
+    assert(tfs_clone("/src", "/c1") != -1);
+    assert(tfs_clone("/src", "/c2") != -1);
+    assert_contents("/c1", file_contents);
+    assert_contents("/c2", file_contents);
+
+    assert(tfs_clone("/src", "/c1") == -1);
+    assert(tfs_clone("/nope", "/c4") == -1);
+    assert(tfs_clone("/src", "invalid") == -1);
+
+    // writing to a clone needs a copy of the block, and there is no space
+    tfs_stats_t stats;
+    overwrite("/c1", new_contents, -1);
+    assert_contents("/c1", file_contents);
+
+    // once it's the last reference, the block is written in place
+    assert(tfs_unlink("/src") != -1);
+    assert(tfs_unlink("/c2") != -1);
+    tfs_get_stats(&stats);
+    assert(stats.cow_copies == 0);
+    overwrite("/c1", new_contents, sizeof(file_contents));
+    assert_contents("/c1", new_contents);
+    tfs_get_stats(&stats);
+    assert(stats.cow_copies == 0);
+    assert(tfs_unlink("/c1") != -1);
+    assert(tfs_destroy() != -1);
+
+    // with enough space, writes to either side copy the shared block
+    assert(tfs_init(NULL) != -1);
+    f = tfs_open("/src", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+    assert(tfs_clone("/src", "/c1") != -1);
+
+    overwrite("/c1", new_contents, sizeof(file_contents));
+    assert_contents("/c1", new_contents);
+    assert_contents("/src", file_contents);
+
+    assert(tfs_clone("/src", "/c2") != -1);
+    overwrite("/src", new_contents, sizeof(file_contents));
+    assert_contents("/src", new_contents);
+    assert_contents("/c2", file_contents);
+
+    tfs_get_stats(&stats);
+    assert(stats.cow_copies == 2);
+
+    // symlinks are followed; truncating a clone leaves the other file alone
+    assert(tfs_sym_link("/src", "/link") != -1);
+    assert(tfs_clone("/link", "/c3") != -1);
+    assert_contents("/c3", new_contents);
+    f = tfs_open("/c3", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert_contents("/src", new_contents);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
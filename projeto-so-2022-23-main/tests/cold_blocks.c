@@ -0,0 +1,162 @@
+#include "fs/compress.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 4096
+#define COLD_FILES 64
+
+uint8_t text[BLOCK_SIZE];
+uint8_t noise[BLOCK_SIZE];
+
+void write_file(char const *path, uint8_t const *contents, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, len) == len);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_contents(char const *path, uint8_t const *expected, size_t len) {
+    uint8_t buffer[BLOCK_SIZE];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_roundtrip(uint8_t const *data, size_t len) {
+    uint8_t compressed[2 * BLOCK_SIZE];
+    uint8_t decompressed[BLOCK_SIZE];
+    size_t compressed_len = lz_compress(data, len, compressed, sizeof(compressed));
+    assert(compressed_len > 0);
+    assert(lz_decompress(compressed, compressed_len, decompressed, len) == 0);
+    assert(memcmp(data, decompressed, len) == 0);
+    // the exact length is required
+    assert(lz_decompress(compressed, compressed_len, decompressed, len - 1) ==
+           -1);
+}
+
+int main() {
+    uint32_t seed = 2463534242u;
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        text[i] = (uint8_t)("the quick brown fox jumps over the lazy dog, "
+                            "again and again\n"[i % 61]);
+        // xorshift
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        noise[i] = (uint8_t)seed;
+    }
+    uint8_t zeros[BLOCK_SIZE] = {0};
+
+    // long runs of literals and matches, and tiny inputs
+    for (size_t len = 1; len < 40; len++) {
+        assert_roundtrip(text, len);
+        assert_roundtrip(noise, len);
+    }
+    assert_roundtrip(text, BLOCK_SIZE);
+    assert_roundtrip(noise, BLOCK_SIZE);
+    assert_roundtrip(zeros, BLOCK_SIZE);
+
+    uint8_t small[8];
+    assert(lz_compress(text, BLOCK_SIZE, small, sizeof(small)) == 0);
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    write_file("/text", text, BLOCK_SIZE);
+    write_file("/noise", noise, BLOCK_SIZE);
+    assert(tfs_sym_link("/text", "/link") != -1);
+
+    assert(tfs_mark_cold("/link") != -1);
+    assert(tfs_mark_cold("/noise") != -1);
+    assert(tfs_mark_cold("/nope") == -1);
+
+    // only the text compresses
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    assert(stats.cold_raw_bytes == BLOCK_SIZE);
+    assert(stats.cold_stored_bytes < BLOCK_SIZE / 4);
+    assert(stats.decompressed_bytes == 0);
+
+    // accessing the file decompresses it
+    assert_contents("/text", text, BLOCK_SIZE);
+    assert_contents("/noise", noise, BLOCK_SIZE);
+    tfs_get_stats(&stats);
+    assert(stats.cold_raw_bytes == 0);
+    assert(stats.cold_stored_bytes == 0);
+    assert(stats.decompressed_bytes == BLOCK_SIZE);
+
+    // compressed files can be appended to, and removed
+    assert(tfs_mark_cold("/text") != -1);
+    int f = tfs_open("/text", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, text, 100) == 100);
+    assert(tfs_close(f) != -1);
+    assert(tfs_mark_cold("/text") != -1);
+    f = tfs_open("/text", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, text + 100, 100) == 100);
+    assert(tfs_close(f) != -1);
+    assert_contents("/text", text, 200);
+
+    assert(tfs_mark_cold("/text") != -1);
+    assert(tfs_unlink("/link") != -1);
+    assert(tfs_unlink("/text") != -1);
+    tfs_get_stats(&stats);
+    assert(stats.cold_raw_bytes == 0);
+
+    assert(tfs_destroy() != -1);
+
+    // the memory of cold blocks is given back (for blocks of whole pages),
+    // and only the compressed copies are kept
+    params.block_size = 4 * BLOCK_SIZE;
+    params.max_block_count = COLD_FILES + 1;
+    params.max_inode_count = COLD_FILES + 1;
+    params.verify_checksums = true;
+    assert(tfs_init(&params) != -1);
+    static uint8_t big_text[4 * BLOCK_SIZE];
+    for (size_t i = 0; i < sizeof(big_text); i++) {
+        big_text[i] = text[i % BLOCK_SIZE];
+    }
+    char path[16];
+    for (int i = 0; i < COLD_FILES; i++) {
+        snprintf(path, sizeof(path), "/c%d", i);
+        write_file(path, big_text, sizeof(big_text));
+    }
+    for (int i = 0; i < COLD_FILES; i++) {
+        snprintf(path, sizeof(path), "/c%d", i);
+        assert(tfs_mark_cold(path) != -1);
+    }
+    size_t raw = COLD_FILES * sizeof(big_text);
+    tfs_get_stats(&stats);
+    assert(stats.cold_raw_bytes == raw);
+    assert(stats.cold_stored_bytes < raw / 4);
+    if (sizeof(big_text) % (size_t)sysconf(_SC_PAGESIZE) == 0) {
+        assert(stats.released_bytes == raw);
+    }
+
+    // and comes back when read (with the right checksum)
+    for (int i = 0; i < COLD_FILES; i++) {
+        snprintf(path, sizeof(path), "/c%d", i);
+        int cf = tfs_open(path, 0);
+        assert(cf != -1);
+        static uint8_t buffer[4 * BLOCK_SIZE];
+        assert(tfs_read(cf, buffer, sizeof(buffer)) == sizeof(buffer));
+        assert(memcmp(buffer, big_text, sizeof(buffer)) == 0);
+        assert(tfs_close(cf) != -1);
+    }
+    tfs_get_stats(&stats);
+    assert(stats.cold_raw_bytes == 0);
+    assert(stats.checksum_errors == 0);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
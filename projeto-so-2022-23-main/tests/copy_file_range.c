@@ -0,0 +1,86 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#define COPIES_PER_THREAD 200
+
+char const contents[] = "0123456789";
+int fa, fb;
+
+void assert_contents(char const *path, char const *expected, size_t len) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    char buffer[128];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void *copy_a_to_b(void *arg) {
+    (void)arg;
+    for (int i = 0; i < COPIES_PER_THREAD; i++) {
+        assert(tfs_copy_file_range(fa, 0, fb, 0, 4) == 4);
+    }
+    return NULL;
+}
+
+void *copy_b_to_a(void *arg) {
+    (void)arg;
+    for (int i = 0; i < COPIES_PER_THREAD; i++) {
+        assert(tfs_copy_file_range(fb, 0, fa, 0, 4) == 4);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = 128;
+    assert(tfs_init(&params) != -1);
+
+    fa = tfs_open("/a", TFS_O_CREAT);
+    assert(fa != -1);
+    assert(tfs_write(fa, contents, strlen(contents)) == strlen(contents));
+
+    // copy into an empty file (its block gets allocated)
+    fb = tfs_open("/b", TFS_O_CREAT);
+    assert(fb != -1);
+    assert(tfs_copy_file_range(fa, 2, fb, 0, 5) == 5);
+    assert_contents("/b", "23456", 5);
+
+    // append, then clamp at the end of the source
+    assert(tfs_copy_file_range(fa, 0, fb, 5, 100) == strlen(contents));
+    assert_contents("/b", "234560123456789", 15);
+    assert(tfs_copy_file_range(fa, strlen(contents), fb, 0, 1) == 0);
+
+    // clamp at the maximum file size
+    assert(tfs_copy_file_range(fa, 0, fb, params.block_size - 3, 10) == -1);
+    for (size_t size = 15; size < params.block_size; size += 10) {
+        tfs_copy_file_range(fa, 0, fb, size, 10);
+    }
+    assert(tfs_copy_file_range(fa, 0, fb, params.block_size - 3, 10) == 3);
+
+    // offsets past the end of the files are invalid
+    assert(tfs_copy_file_range(fa, strlen(contents) + 1, fb, 0, 1) == -1);
+    assert(tfs_copy_file_range(-1, 0, fb, 0, 1) == -1);
+
+    // overlapping copy inside the same file
+    assert(tfs_copy_file_range(fa, 0, fa, 2, 8) == 8);
+    assert_contents("/a", "0101234567", 10);
+
+    // copies in opposite directions don't deadlock
+    pthread_t t1, t2;
+    assert(pthread_create(&t1, NULL, copy_a_to_b, NULL) == 0);
+    assert(pthread_create(&t2, NULL, copy_b_to_a, NULL) == 0);
+    assert(pthread_join(t1, NULL) == 0);
+    assert(pthread_join(t2, NULL) == 0);
+
+    assert(tfs_close(fa) != -1);
+    assert(tfs_close(fb) != -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "fs/config.h"
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// several import chunks, and a partial one
+#define FILE_SIZE (3 * IMPORT_CHUNK_SIZE + 12345)
+
+char const *host_path = "tests/pipelined.tmp";
+
+void assert_contents(char const *path, uint8_t const *expected, size_t len) {
+    uint8_t *buffer = malloc(len + 1);
+    assert(buffer != NULL);
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, len + 1) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+    free(buffer);
+}
+
+int main() {
+    uint8_t *contents = malloc(FILE_SIZE);
+    assert(contents != NULL);
+    uint32_t seed = 2463534242u;
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        contents[i] = (uint8_t)seed;
+    }
+    FILE *host = fopen(host_path, "w");
+    assert(host != NULL);
+    assert(fwrite(contents, 1, FILE_SIZE, host) == FILE_SIZE);
+    assert(fclose(host) == 0);
+
+    // the whole file fits in a block
+    tfs_params params = tfs_default_params();
+    params.block_size = 4 * IMPORT_CHUNK_SIZE;
+    params.max_block_count = 4;
+    assert(tfs_init(&params) != -1);
+    assert(tfs_copy_from_external_fs(host_path, "/f1") != -1);
+    assert_contents("/f1", contents, FILE_SIZE);
+
+    // importing over an existing file replaces it
+    assert(tfs_copy_from_external_fs("tests/file_to_copy.txt", "/f1") != -1);
+    assert(tfs_copy_from_external_fs(host_path, "/f1") != -1);
+    assert_contents("/f1", contents, FILE_SIZE);
+
+    // directories can't be imported
+    assert(tfs_copy_from_external_fs("tests", "/f2") == -1);
+    assert(tfs_destroy() != -1);
+
+    // the file is too large: the first block is imported anyway
+    params.block_size = 2 * IMPORT_CHUNK_SIZE + 1;
+    assert(tfs_init(&params) != -1);
+    assert(tfs_copy_from_external_fs(host_path, "/f1") == -1);
+    assert_contents("/f1", contents, params.block_size);
+    assert(tfs_destroy() != -1);
+
+    assert(remove(host_path) == 0);
+    free(contents);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
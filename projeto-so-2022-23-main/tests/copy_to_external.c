@@ -0,0 +1,71 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_SIZE 4000
+
+char const *host_path = "tests/copy_to_external.tmp";
+
+// checks the contents of the host file
+void assert_host_contents(uint8_t const *expected, size_t len) {
+    uint8_t buffer[FILE_SIZE + 1];
+    FILE *host = fopen(host_path, "r");
+    assert(host != NULL);
+    assert(fread(buffer, 1, sizeof(buffer), host) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(fclose(host) == 0);
+}
+
+int main() {
+    uint8_t contents[FILE_SIZE];
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        contents[i] = (uint8_t)(i * 7);
+    }
+
+    tfs_params params = tfs_default_params();
+    params.block_size = FILE_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(contents)) == sizeof(contents));
+    assert(tfs_close(f) != -1);
+    assert(tfs_sym_link("/f1", "/s1") != -1);
+    f = tfs_open("/empty", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_copy_to_external_fs("/f1", host_path) != -1);
+    assert_host_contents(contents, sizeof(contents));
+
+    // overwrites the host file
+    assert(tfs_copy_to_external_fs("/empty", host_path) != -1);
+    assert_host_contents(contents, 0);
+
+    // follows symlinks, and decompresses cold files
+    assert(tfs_mark_cold("/f1") != -1);
+    assert(tfs_copy_to_external_fs("/s1", host_path) != -1);
+    assert_host_contents(contents, sizeof(contents));
+
+    // round trip
+    assert(tfs_copy_from_external_fs(host_path, "/f2") != -1);
+    uint8_t buffer[FILE_SIZE];
+    f = tfs_open("/f2", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, contents, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_copy_to_external_fs("/nope", host_path) == -1);
+    assert(tfs_copy_to_external_fs("f1", host_path) == -1);
+    assert(tfs_copy_to_external_fs("/f1", "tests") == -1);
+
+    assert(tfs_destroy() != -1);
+    assert(remove(host_path) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
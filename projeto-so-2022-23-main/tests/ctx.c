@@ -0,0 +1,128 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define THREAD_COUNT 4
+#define FILE_COUNT 20
+
+void write_file(tfs_ctx *ctx, char const *path, char const *contents) {
+    int f = tfs_ctx_open(ctx, path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_ctx_write(ctx, f, contents, strlen(contents)) ==
+           strlen(contents));
+    assert(tfs_ctx_close(ctx, f) != -1);
+}
+
+void assert_contents(tfs_ctx *ctx, char const *path, char const *expected) {
+    char buffer[64];
+    int f = tfs_ctx_open(ctx, path, 0);
+    assert(f != -1);
+    assert(tfs_ctx_read(ctx, f, buffer, sizeof(buffer)) == strlen(expected));
+    assert(memcmp(buffer, expected, strlen(expected)) == 0);
+    assert(tfs_ctx_close(ctx, f) != -1);
+}
+
+// each thread works on an instance of its own
+void *tenant(void *arg) {
+    tfs_ctx *ctx = arg;
+    char path[16];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        write_file(ctx, path, path);
+    }
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        assert_contents(ctx, path, path);
+    }
+    return NULL;
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.scrub_rate = 10000;
+    tfs_ctx *a = tfs_ctx_create(&params);
+    tfs_ctx *b = tfs_ctx_create(NULL);
+    assert(a != NULL && b != NULL);
+    assert(tfs_init(NULL) != -1); // the default instance
+
+    // the same names, in different instances
+    write_file(a, "/f", "in a");
+    write_file(b, "/f", "in b");
+    write_file(b, "/g", "only in b");
+    int f = tfs_open("/f", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "default", 7) == 7);
+    assert(tfs_close(f) != -1);
+    assert_contents(a, "/f", "in a");
+    assert_contents(b, "/f", "in b");
+    assert(tfs_ctx_open(a, "/g", 0) == -1);
+
+    // handles are per instance
+    int fa = tfs_ctx_open(a, "/f", 0);
+    int fb = tfs_ctx_open(b, "/f", 0);
+    assert(fa == 0 && fb == 0);
+    assert(tfs_ctx_close(a, fa) != -1);
+    assert(tfs_ctx_close(a, fa) == -1);
+    assert(tfs_ctx_close(b, fb) != -1);
+
+    // so are snapshots, stats, and resets
+    assert(tfs_ctx_snapshot_create(a) != -1);
+    assert(tfs_ctx_snapshot_destroy(b) == -1);
+    assert(tfs_ctx_unlink(a, "/f") != -1);
+    f = tfs_ctx_snapshot_open(a, "/f");
+    assert(f != -1);
+    assert(tfs_ctx_close(a, f) != -1);
+    assert(tfs_ctx_snapshot_destroy(a) != -1);
+    assert(tfs_ctx_map_from_external_fs(a, "tests/file_to_copy.txt", "/m") !=
+           -1);
+    tfs_stats_t stats;
+    tfs_ctx_get_stats(a, &stats);
+    assert(stats.mapped_bytes > 0);
+    tfs_ctx_get_stats(b, &stats);
+    assert(stats.mapped_bytes == 0);
+    assert(tfs_ctx_reset(b) != -1);
+    assert(tfs_ctx_open(b, "/g", 0) == -1);
+    f = tfs_open("/f", 0);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    // the helper threads of an operation work on the caller's instance
+    write_file(b, "/f", "in b");
+    tfs_fsck_report_t report;
+    assert(tfs_ctx_fsck(b, &report, 4) == 0);
+    assert(report.inodes_checked == 2);
+    char const *image = "tests/ctx_image.tmp";
+    assert(tfs_ctx_save_image(b, image) != -1);
+    assert(tfs_ctx_load_image(a, image, 4) != -1);
+    assert(unlink(image) == 0);
+    assert_contents(a, "/f", "in b");
+    assert(tfs_ctx_fsck(a, &report, 4) == 0);
+
+    // independent tenants, side by side
+    tfs_ctx *tenants[THREAD_COUNT];
+    pthread_t threads[THREAD_COUNT];
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        tenants[i] = tfs_ctx_create(&params);
+        assert(tenants[i] != NULL);
+        assert(pthread_create(&threads[i], NULL, tenant, tenants[i]) == 0);
+    }
+    for (int i = 0; i < THREAD_COUNT; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+        assert(tfs_ctx_fsck(tenants[i], &report, 1) == 0);
+        assert(report.inodes_checked == FILE_COUNT + 1);
+        assert(tfs_ctx_destroy(tenants[i]) != -1);
+    }
+
+    assert(tfs_ctx_destroy(a) != -1);
+    assert(tfs_ctx_destroy(b) != -1);
+    assert(tfs_ctx_destroy(NULL) == -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
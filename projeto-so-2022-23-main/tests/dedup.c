@@ -0,0 +1,87 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const file_contents[] = "AAA!";
+uint8_t const new_contents[] = "BBB!";
+
+void write_file(char const *path, uint8_t const *contents, ssize_t expected) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(file_contents)) == expected);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_contents(char const *path, void const *expected, size_t len) {
+    char buffer[1024];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    // room for the root directory and two file blocks
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 3;
+    params.dedup = true;
+    assert(tfs_init(&params) != -1);
+
+    // identical files share a single block
+    write_file("/a", file_contents, sizeof(file_contents));
+    write_file("/b", file_contents, sizeof(file_contents));
+    write_file("/c", file_contents, sizeof(file_contents));
+
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    assert(stats.dedup_checks == 3);
+    assert(stats.dedup_hits == 2);
+    assert(stats.dedup_hashed_bytes == 3 * sizeof(file_contents));
+
+    // writing to one of them copies the block
+    write_file("/b", new_contents, sizeof(new_contents));
+    assert_contents("/a", file_contents, sizeof(file_contents));
+    assert_contents("/b", new_contents, sizeof(new_contents));
+    assert_contents("/c", file_contents, sizeof(file_contents));
+
+    // appending to a shared block copies it, unless it is the last reference
+    int f = tfs_open("/a", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "!", 1) == -1); // no space to copy the block
+    assert(tfs_close(f) != -1);
+    assert(tfs_unlink("/c") != -1);
+    f = tfs_open("/a", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "!", 1) == 1);
+    assert(tfs_close(f) != -1);
+    assert_contents("/a", "AAA!\0!", sizeof(file_contents) + 1);
+
+    assert(tfs_destroy() != -1);
+
+    // repeated imports of the same file (each one needs a block of its own
+    // until it is complete)
+    params.max_block_count = 3;
+    assert(tfs_init(&params) != -1);
+    assert(tfs_copy_from_external_fs("tests/file_to_copy.txt", "/x") != -1);
+    assert(tfs_copy_from_external_fs("tests/file_to_copy.txt", "/y") != -1);
+    assert(tfs_copy_from_external_fs("tests/file_to_copy.txt", "/z") != -1);
+    tfs_get_stats(&stats);
+    assert(stats.dedup_checks == 3);
+    assert(stats.dedup_hits == 2);
+    assert(tfs_destroy() != -1);
+
+    // disabled by default
+    assert(tfs_init(NULL) != -1);
+    write_file("/a", file_contents, sizeof(file_contents));
+    write_file("/b", file_contents, sizeof(file_contents));
+    tfs_get_stats(&stats);
+    assert(stats.dedup_checks == 0);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
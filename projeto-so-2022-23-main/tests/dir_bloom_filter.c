@@ -0,0 +1,57 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 20
+#define PATH_FORMAT "/f%d"
+#define MAX_PATH_SIZE 32
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), PATH_FORMAT, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    tfs_stats_t before, after;
+    tfs_get_stats(&before);
+
+    // existing names always go past the filter
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), PATH_FORMAT, i);
+        int f = tfs_open(path, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    tfs_get_stats(&after);
+    assert(after.dir_lookups - before.dir_lookups == FILE_COUNT);
+    assert(after.dir_bloom_negatives == before.dir_bloom_negatives);
+    assert(after.dir_bloom_false_positives ==
+           before.dir_bloom_false_positives);
+
+    // once every name is removed, the counters are back to zero and every
+    // lookup is answered by the filter alone
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), PATH_FORMAT, i);
+        assert(tfs_unlink(path) != -1);
+    }
+    tfs_get_stats(&before);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), PATH_FORMAT, i);
+        assert(tfs_open(path, 0) == -1);
+    }
+    tfs_get_stats(&after);
+    assert(after.dir_bloom_negatives - before.dir_bloom_negatives ==
+           FILE_COUNT);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 600
+#define PATH_FORMAT "/obj-%d"
+#define MAX_PATH_SIZE 32
+
+int open_n(int n, tfs_file_mode_t mode) {
+    char path[MAX_PATH_SIZE];
+    snprintf(path, sizeof(path), PATH_FORMAT, n);
+    return tfs_open(path, mode);
+}
+
+int unlink_n(int n) {
+    char path[MAX_PATH_SIZE];
+    snprintf(path, sizeof(path), PATH_FORMAT, n);
+    return tfs_unlink(path);
+}
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = FILE_COUNT + 1;
+    params.max_open_files_count = 4;
+    params.block_size = 44 * FILE_COUNT;
+    assert(tfs_init(&params) != -1);
+
+    // with this many names, several of them share the same tag
+    for (int i = 0; i < FILE_COUNT; i++) {
+        int f = open_n(i, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    // the directory is now full
+    assert(tfs_open("/one-too-many", TFS_O_CREAT) == -1);
+
+    for (int i = 0; i < FILE_COUNT; i += 2) {
+        assert(unlink_n(i) != -1);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        int f = open_n(i, 0);
+        assert((f != -1) == (i % 2 == 1));
+        if (f != -1) {
+            assert(tfs_close(f) != -1);
+        }
+    }
+
+    // freed slots can be reused
+    for (int i = 0; i < FILE_COUNT; i += 2) {
+        int f = open_n(i, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        int f = open_n(i, 0);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
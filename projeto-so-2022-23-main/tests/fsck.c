@@ -0,0 +1,86 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const file_contents[] = "AAA!";
+
+void write_file(char const *path) {
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+}
+
+// runs the check with a few different thread counts, which must agree
+ssize_t fsck(tfs_fsck_report_t *report) {
+    ssize_t errors = tfs_fsck(report, 1);
+    for (int threads = 2; threads <= 8; threads *= 2) {
+        tfs_fsck_report_t other;
+        assert(tfs_fsck(&other, threads) == errors);
+        assert(memcmp(&other, report, sizeof(other)) == 0);
+    }
+    return errors;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    tfs_fsck_report_t report;
+    assert(tfs_fsck(&report, 0) == -1);
+    assert(fsck(&report) == 0);
+    assert(report.inodes_checked == 1);
+
+    write_file("/f1");
+    write_file("/f2");
+    assert(tfs_link("/f1", "/h1") != -1);
+    assert(tfs_sym_link("/f2", "/s1") != -1);
+    assert(tfs_clone("/f2", "/c1") != -1);
+    assert(tfs_snapshot_create() != -1);
+    assert(tfs_unlink("/f2") != -1);
+
+    assert(fsck(&report) == 0);
+    assert(report.inodes_checked == 4);
+    assert(report.blocks_checked == 1024);
+
+    // now break things behind the FS's back
+    inode_t *root = inode_get(ROOT_DIR_INUM);
+
+    inode_get(1)->hard_links++; // /f1
+    assert(fsck(&report) == 1);
+    assert(report.link_count_errors == 1);
+    inode_get(1)->hard_links--;
+
+    int orphan = inode_create(T_FILE);
+    assert(orphan != -1);
+    assert(fsck(&report) == 1);
+    assert(report.orphan_inodes == 1);
+
+    int empty = inode_create(T_SYMLINK);
+    assert(empty != -1);
+    assert(add_dir_entry(root, "s2", empty) != -1);
+    assert(fsck(&report) == 2);
+    assert(report.empty_symlinks == 1);
+
+    assert(add_dir_entry(root, "ghost", 60) != -1);
+    assert(fsck(&report) == 3);
+    assert(report.dangling_entries == 1);
+
+    data_block_ref(inode_get_data_block(inode_get(1)));
+    assert(fsck(&report) == 4);
+    assert(report.refcount_errors == 1);
+
+    int leaked = data_block_alloc();
+    assert(leaked != -1);
+    assert(fsck(&report) == 5);
+    assert(report.leaked_blocks == 1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE 2048
+
+char const *image_path = "tests/image.tmp";
+
+uint8_t text[BLOCK_SIZE];
+
+void write_file(char const *path, uint8_t const *contents, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, len) == len);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_contents(char const *path, uint8_t const *expected, size_t len) {
+    uint8_t buffer[BLOCK_SIZE + 1];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_loaded(void) {
+    assert_contents("/f1", text, BLOCK_SIZE);
+    assert_contents("/f2", text + 1, 100);
+    assert_contents("/empty", text, 0);
+    assert_contents("/h1", text, BLOCK_SIZE);
+    assert_contents("/s1", text + 1, 100);
+    assert_contents("/clone", text + 1, 100);
+    assert_contents("/cold", text, 1000);
+    assert_contents("/mapped", (uint8_t const *)"BBB!", 4);
+
+    tfs_fsck_report_t report;
+    assert(tfs_fsck(&report, 1) == 0);
+    assert(report.inodes_checked == 8); // the hard link shares /f1's inode
+}
+
+int main() {
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        text[i] = (uint8_t)("all work and no play makes jack a dull boy\n"[i % 43]);
+    }
+
+    tfs_params params = tfs_default_params();
+    params.block_size = BLOCK_SIZE;
+    params.max_inode_count = 32;
+    params.max_block_count = 64;
+    assert(tfs_init(&params) != -1);
+
+    write_file("/f1", text, BLOCK_SIZE);
+    write_file("/f2", text + 1, 100);
+    write_file("/empty", text, 0);
+    assert(tfs_link("/f1", "/h1") != -1);
+    assert(tfs_sym_link("/f2", "/s1") != -1);
+    assert(tfs_clone("/f2", "/clone") != -1); // shares the block
+    write_file("/cold", text, 1000);
+    assert(tfs_mark_cold("/cold") != -1);
+    assert(tfs_map_from_external_fs("tests/file_to_copy.txt", "/mapped") != -1);
+    // not saved, nor is what it keeps
+    assert(tfs_snapshot_create() != -1);
+    write_file("/f2", text + 1, 100);
+
+    assert(tfs_save_image(image_path) != -1);
+    // free blocks are left out, shared ones are saved once, and only the
+    // used part of each block is
+    FILE *image = fopen(image_path, "r");
+    assert(image != NULL);
+    assert(fseek(image, 0, SEEK_END) == 0);
+    long image_size = ftell(image);
+    assert(fclose(image) == 0);
+    assert(image_size < 2 * BLOCK_SIZE);
+    // saving leaves the FS as it was
+    assert_loaded();
+    assert(tfs_destroy() != -1);
+
+    // the image brings its parameters along
+    for (int threads = 1; threads <= 4; threads *= 3) {
+        assert(tfs_init(NULL) != -1);
+        write_file("/other", text, 10);
+        assert(tfs_load_image(image_path, threads) != -1);
+        assert(tfs_open("/other", 0) == -1);
+        assert_loaded();
+
+        assert(tfs_destroy() != -1);
+    }
+
+    // not an image: the FS is left as it was
+    assert(tfs_init(&params) != -1);
+    write_file("/other", text, 10);
+    assert(tfs_load_image("tests/file_to_copy.txt", 1) == -1);
+    assert(tfs_load_image("tests/nope", 1) == -1);
+    assert_contents("/other", text, 10);
+
+    // a truncated image: the FS is left empty
+    assert(truncate(image_path, 1000) == 0);
+    assert(tfs_load_image(image_path, 2) == -1);
+    assert(tfs_open("/other", 0) == -1);
+    assert(tfs_open("/f1", 0) == -1);
+    assert(tfs_destroy() != -1);
+
+    unlink(image_path);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
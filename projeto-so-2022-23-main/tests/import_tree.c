@@ -0,0 +1,112 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define ROOT "tests/import_tree.tmp"
+#define FILE_COUNT 100
+#define MAX_PATH_SIZE 128
+
+char const *long_name =
+    ROOT "/a-name-that-is-much-too-long-for-tecnicofs.txt";
+// the longest name that fits with its leading '/', and one past it
+#define NAME_38 "abcdefghijklmnopqrstuvwxyz0123456789ab"
+#define NAME_39 NAME_38 "c"
+
+void create_host_file(char const *path, char const *contents) {
+    FILE *host = fopen(path, "w");
+    assert(host != NULL);
+    assert(fputs(contents, host) >= 0);
+    assert(fclose(host) == 0);
+}
+
+void assert_contents(char const *path, char const *expected) {
+    char buffer[64];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    ssize_t n = tfs_read(f, buffer, sizeof(buffer));
+    assert(n == strlen(expected));
+    assert(memcmp(buffer, expected, (size_t)n) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    char path[MAX_PATH_SIZE];
+    assert(mkdir(ROOT, 0755) == 0);
+    assert(mkdir(ROOT "/sub", 0755) == 0);
+    assert(mkdir(ROOT "/sub/deep", 0755) == 0);
+    assert(mkdir(ROOT "/x", 0755) == 0);
+    create_host_file(ROOT "/top.txt", "top");
+    create_host_file(ROOT "/sub/deep/c.txt", "deep");
+    create_host_file(ROOT "/x/y", "clash");
+    create_host_file(ROOT "/x_y", "clash");
+    create_host_file(long_name, "too long");
+    create_host_file(ROOT "/" NAME_38, "fits");
+    create_host_file(ROOT "/" NAME_39, "one too long");
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), ROOT "/sub/f%d", i);
+        create_host_file(path, path);
+    }
+
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 2 * FILE_COUNT;
+    params.max_block_count = 2 * FILE_COUNT;
+    params.block_size = 8192;
+    assert(tfs_init(&params) != -1);
+
+    // existing files are overwritten
+    int f = tfs_open("/top.txt", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, "old contents", 12) == 12);
+    assert(tfs_close(f) != -1);
+
+    tfs_import_report_t report;
+    assert(tfs_import_tree(ROOT, "/sub", 4, &report) == -1);
+    assert(tfs_import_tree(ROOT, "/", 0, &report) == -1);
+    assert(tfs_import_tree(ROOT "/top.txt", "/", 4, &report) == -1);
+
+    // one of the clashing files, and the long names, are left out
+    assert(strlen(NAME_38) == 38 && strlen(NAME_39) == 39);
+    assert(tfs_import_tree(ROOT, "/", 4, &report) == FILE_COUNT + 4);
+    assert(report.files == FILE_COUNT + 4);
+    assert(report.failed == 3);
+    assert(report.bytes > 0);
+
+    assert_contents("/top.txt", "top");
+    assert_contents("/sub_deep_c.txt", "deep");
+    assert_contents("/x_y", "clash");
+    assert_contents("/" NAME_38, "fits");
+    assert(tfs_open("/" NAME_39, 0) == -1);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), ROOT "/sub/f%d", i);
+        char name[MAX_PATH_SIZE];
+        snprintf(name, sizeof(name), "/sub_f%d", i);
+        assert_contents(name, path);
+    }
+
+    tfs_fsck_report_t fsck;
+    assert(tfs_fsck(&fsck, 1) == 0);
+    assert(tfs_destroy() != -1);
+
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), ROOT "/sub/f%d", i);
+        assert(unlink(path) == 0);
+    }
+    assert(unlink(long_name) == 0);
+    assert(unlink(ROOT "/" NAME_38) == 0);
+    assert(unlink(ROOT "/" NAME_39) == 0);
+    assert(unlink(ROOT "/x_y") == 0);
+    assert(unlink(ROOT "/x/y") == 0);
+    assert(unlink(ROOT "/sub/deep/c.txt") == 0);
+    assert(unlink(ROOT "/top.txt") == 0);
+    assert(rmdir(ROOT "/x") == 0);
+    assert(rmdir(ROOT "/sub/deep") == 0);
+    assert(rmdir(ROOT "/sub") == 0);
+    assert(rmdir(ROOT) == 0);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const file_contents[] = "AAA!";
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/f2", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_sym_link("/f1", "/l1") != -1);
+
+    inode_table_stats_t stats;
+    inode_table_stats(&stats);
+    assert(stats.files == 2);
+    assert(stats.directories == 1);
+    assert(stats.symlinks == 1);
+    // root directory block + file contents + symlink target
+    assert(stats.bytes ==
+           state_block_size() + sizeof(file_contents) + sizeof("/f1"));
+
+    assert(tfs_unlink("/f1") != -1);
+    inode_table_stats(&stats);
+    assert(stats.files == 1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
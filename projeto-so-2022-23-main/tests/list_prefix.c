@@ -0,0 +1,96 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_PATH_SIZE 32
+#define MAX_SEEN 64
+
+typedef struct {
+    char names[MAX_SEEN][MAX_FILE_NAME];
+    int count;
+    int stop_after;
+} visit_t;
+
+int visit(tfs_dirent_t const *entry, void *arg) {
+    visit_t *v = arg;
+    assert(v->count < MAX_SEEN);
+    strcpy(v->names[v->count++], entry->d_name);
+    return v->count == v->stop_after;
+}
+
+void create(int tenant, int obj) {
+    char path[MAX_PATH_SIZE];
+    snprintf(path, sizeof(path), "/tenant-%d-obj-%d", tenant, obj);
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+}
+
+void run_test(bool indexed) {
+    tfs_params params = tfs_default_params();
+    params.block_size = 4096;
+    params.dir_prefix_index = indexed;
+    assert(tfs_init(&params) != -1);
+
+    // created out of order on purpose
+    for (int obj = 9; obj >= 0; obj--) {
+        create(2, obj);
+        create(1, obj);
+    }
+    for (int obj = 0; obj < 5; obj++) {
+        create(10, obj);
+    }
+    int f = tfs_open("/other", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+
+    visit_t v = {.count = 0, .stop_after = -1};
+    assert(tfs_list_prefix("/", "tenant-1-", visit, &v) == 10);
+    assert(v.count == 10);
+    for (int i = 0; i < v.count; i++) {
+        assert(strncmp(v.names[i], "tenant-1-", 9) == 0);
+        if (indexed && i > 0) {
+            assert(strcmp(v.names[i - 1], v.names[i]) < 0);
+        }
+    }
+
+    v.count = 0;
+    assert(tfs_list_prefix("/", "tenant-1", visit, &v) == 15);
+
+    v.count = 0;
+    assert(tfs_list_prefix("/", "", visit, &v) == 26);
+
+    v.count = 0;
+    assert(tfs_list_prefix("/", "tenant-3", visit, &v) == 0);
+
+    // the callback can stop the listing
+    v.count = 0;
+    v.stop_after = 3;
+    assert(tfs_list_prefix("/", "tenant-2-", visit, &v) == 3);
+    v.stop_after = -1;
+
+    // removed entries are no longer visited
+    assert(tfs_unlink("/tenant-1-obj-0") != -1);
+    assert(tfs_unlink("/tenant-1-obj-9") != -1);
+    v.count = 0;
+    assert(tfs_list_prefix("/", "tenant-1-", visit, &v) == 8);
+    for (int i = 0; i < v.count; i++) {
+        assert(strcmp(v.names[i], "tenant-1-obj-0") != 0);
+        assert(strcmp(v.names[i], "tenant-1-obj-9") != 0);
+    }
+
+    assert(tfs_list_prefix("/nope", "", visit, &v) == -1);
+
+    assert(tfs_destroy() != -1);
+}
+
+int main() {
+    run_test(false);
+    run_test(true);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+char const *host_path = "tests/file_to_copy_over512.txt";
+char host_contents[1024];
+size_t host_size;
+
+void assert_contents(int f, void const *expected, size_t len) {
+    char buffer[1024];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+}
+
+void assert_file_contents(char const *path, void const *expected,
+                          size_t len) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert_contents(f, expected, len);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    FILE *host = fopen(host_path, "r");
+    assert(host != NULL);
+    host_size = fread(host_contents, 1, sizeof(host_contents), host);
+    assert(host_size > 512);
+    assert(fclose(host) == 0);
+
+    assert(tfs_init(NULL) != -1);
+
+    assert(tfs_map_from_external_fs(host_path, "/m1") != -1);
+    assert_file_contents("/m1", host_contents, host_size);
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    assert(stats.mapped_bytes == host_size);
+
+    // clones share the mapping; writing to one copies it
+    assert(tfs_clone("/m1", "/c1") != -1);
+    int f = tfs_open("/c1", TFS_O_APPEND);
+    assert(f != -1);
+    assert(tfs_write(f, "!", 1) == 1);
+    assert(tfs_close(f) != -1);
+    assert_file_contents("/m1", host_contents, host_size);
+    host_contents[host_size] = '!';
+    assert_file_contents("/c1", host_contents, host_size + 1);
+    tfs_get_stats(&stats);
+    assert(stats.mapped_bytes == host_size);
+    assert(stats.mapped_copies == 1);
+
+    // the snapshot keeps the mapping after the file is overwritten
+    assert(tfs_snapshot_create() != -1);
+    f = tfs_open("/m1", TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, "new", 3) == 3);
+    assert(tfs_close(f) != -1);
+    assert_file_contents("/m1", "new", 3);
+    f = tfs_snapshot_open("/m1");
+    assert(f != -1);
+    assert_contents(f, host_contents, host_size);
+    assert(tfs_close(f) != -1);
+    tfs_get_stats(&stats);
+    assert(stats.mapped_bytes == host_size);
+
+    tfs_fsck_report_t report;
+    assert(tfs_fsck(&report, 1) == 0);
+
+    // the mapping goes away with its last reference
+    assert(tfs_snapshot_destroy() != -1);
+    tfs_get_stats(&stats);
+    assert(stats.mapped_bytes == 0);
+
+    assert(tfs_map_from_external_fs(host_path, "/m2") != -1);
+    assert(tfs_unlink("/m2") != -1);
+    tfs_get_stats(&stats);
+    assert(stats.mapped_bytes == 0);
+
+    // copying within a mapped file copies the mapping first, and copying out
+    // of one keeps it alive until the copy is done
+    assert(tfs_map_from_external_fs(host_path, "/m3") != -1);
+    f = tfs_open("/m3", 0);
+    assert(f != -1);
+    assert(tfs_copy_file_range(f, 0, f, 6, 5) == 5);
+    assert(tfs_close(f) != -1);
+    char expected[1024];
+    memcpy(expected, host_contents, host_size);
+    memmove(expected + 6, host_contents, 5);
+    assert_file_contents("/m3", expected, host_size);
+
+    assert(tfs_map_from_external_fs(host_path, "/m4") != -1);
+    assert(tfs_clone("/m4", "/d4") != -1);
+    int src = tfs_open("/m4", 0);
+    int dst = tfs_open("/d4", 0);
+    assert(src != -1 && dst != -1);
+    assert(tfs_copy_file_range(src, 0, dst, 6, 5) == 5);
+    assert(tfs_close(src) != -1);
+    assert(tfs_close(dst) != -1);
+    assert_file_contents("/m4", host_contents, host_size);
+    assert_file_contents("/d4", expected, host_size);
+    assert(tfs_unlink("/m3") != -1);
+    assert(tfs_unlink("/m4") != -1);
+    assert(tfs_unlink("/d4") != -1);
+    tfs_get_stats(&stats);
+    assert(stats.mapped_bytes == 0);
+
+    // empty files work, files larger than a block don't
+    assert(tfs_map_from_external_fs("tests/empty_file.txt", "/e") != -1);
+    assert_file_contents("/e", "", 0);
+    assert(tfs_map_from_external_fs("tests/file_to_copy_over1024.txt",
+                                    "/big") == -1);
+    assert(tfs_open("/big", 0) == -1);
+    assert(tfs_map_from_external_fs("./unexistent", "/m3") == -1);
+    assert(tfs_map_from_external_fs(host_path, "m3") == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
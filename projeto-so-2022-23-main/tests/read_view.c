@@ -0,0 +1,71 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+uint8_t const file_contents[] = "AAAABBBBCCCC";
+uint8_t const new_contents[] = "XXXX";
+
+bool writer_done = false;
+
+void *writer(void *arg) {
+    int f = *(int *)arg;
+    assert(tfs_write(f, new_contents, sizeof(new_contents) - 1) ==
+           sizeof(new_contents) - 1);
+    __atomic_store_n(&writer_done, true, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open("/f1", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+
+    tfs_view_t view;
+    assert(tfs_read_view(f, 4, 4, &view) == 0);
+    assert(view.len == 4);
+    assert(memcmp(view.data, "BBBB", 4) == 0);
+    assert(tfs_release_view(&view) == 0);
+
+    // views are clamped at the end of the file
+    assert(tfs_read_view(f, 8, 100, &view) == 0);
+    assert(view.len == sizeof(file_contents) - 8);
+    assert(tfs_release_view(&view) == 0);
+    assert(tfs_read_view(f, sizeof(file_contents) + 1, 1, &view) == -1);
+    assert(tfs_read_view(-1, 0, 1, &view) == -1);
+
+    // writers wait until the view is released
+    int f2 = tfs_open("/f1", 0);
+    assert(f2 != -1);
+    assert(tfs_read_view(f, 0, 4, &view) == 0);
+
+    pthread_t tid;
+    assert(pthread_create(&tid, NULL, writer, &f2) == 0);
+    struct timespec wait = {.tv_sec = 0, .tv_nsec = 50 * 1000 * 1000};
+    nanosleep(&wait, NULL);
+    assert(!__atomic_load_n(&writer_done, __ATOMIC_SEQ_CST));
+    assert(memcmp(view.data, "AAAA", 4) == 0);
+
+    assert(tfs_release_view(&view) == 0);
+    assert(pthread_join(tid, NULL) == 0);
+    assert(writer_done);
+
+    assert(tfs_read_view(f, 0, 4, &view) == 0);
+    assert(memcmp(view.data, "XXXX", 4) == 0);
+    assert(tfs_release_view(&view) == 0);
+
+    assert(tfs_close(f) != -1);
+    assert(tfs_close(f2) != -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
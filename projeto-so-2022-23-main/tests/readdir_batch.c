@@ -0,0 +1,92 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FILE_COUNT 50
+#define BATCH_SIZE 7
+#define PATH_FORMAT "/f%d"
+#define MAX_PATH_SIZE 32
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = 4096;
+    assert(tfs_init(&params) != -1);
+
+    char path[MAX_PATH_SIZE];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), PATH_FORMAT, i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_sym_link("/f0", "/l0") != -1);
+
+    assert(tfs_opendir("/f0") == -1);
+    assert(tfs_opendir("/nope") == -1);
+
+    int dh = tfs_opendir("/");
+    assert(dh != -1);
+
+    // directory handles can't be used as files
+    char byte;
+    assert(tfs_read(dh, &byte, 1) == -1);
+    assert(tfs_write(dh, &byte, 1) == -1);
+
+    bool seen[FILE_COUNT];
+    memset(seen, 0, sizeof(seen));
+    bool seen_link = false;
+
+    tfs_dirent_t entries[BATCH_SIZE];
+    ssize_t n;
+    while ((n = tfs_readdir_batch(dh, entries, BATCH_SIZE)) > 0) {
+        assert(n <= BATCH_SIZE);
+        for (ssize_t i = 0; i < n; i++) {
+            int idx;
+            if (sscanf(entries[i].d_name, "f%d", &idx) == 1) {
+                assert(idx >= 0 && idx < FILE_COUNT);
+                assert(!seen[idx]);
+                assert(entries[i].d_type == T_FILE);
+                seen[idx] = true;
+            } else {
+                assert(strcmp(entries[i].d_name, "l0") == 0);
+                assert(entries[i].d_type == T_SYMLINK);
+                assert(!seen_link);
+                seen_link = true;
+            }
+        }
+    }
+    assert(n == 0);
+    assert(seen_link);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(seen[i]);
+    }
+
+    // the listing stays at the end
+    assert(tfs_readdir_batch(dh, entries, BATCH_SIZE) == 0);
+    assert(tfs_closedir(dh) != -1);
+    assert(tfs_readdir_batch(dh, entries, BATCH_SIZE) == -1);
+
+    // removing entries while listing is allowed; no entry shows up twice
+    dh = tfs_opendir("/");
+    assert(dh != -1);
+    assert(tfs_readdir_batch(dh, entries, BATCH_SIZE) == BATCH_SIZE);
+    for (int i = 0; i < FILE_COUNT; i += 2) {
+        snprintf(path, sizeof(path), PATH_FORMAT, i);
+        assert(tfs_unlink(path) != -1);
+    }
+    int remaining = 0;
+    while ((n = tfs_readdir_batch(dh, entries, BATCH_SIZE)) > 0) {
+        remaining += (int)n;
+    }
+    // at most the odd files and the symlink are left
+    assert(remaining <= FILE_COUNT / 2 + 1);
+    assert(tfs_closedir(dh) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
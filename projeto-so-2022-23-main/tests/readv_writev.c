@@ -0,0 +1,68 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+char header[] = "HDR:";
+char payload[] = "some payload";
+char trailer[] = ":END";
+
+int main() {
+    tfs_params params = tfs_default_params();
+    params.block_size = 50; // 2.5 records
+    assert(tfs_init(&params) != -1);
+
+    int f = tfs_open("/record", TFS_O_CREAT);
+    assert(f != -1);
+
+    struct iovec out[] = {
+        {.iov_base = header, .iov_len = strlen(header)},
+        {.iov_base = payload, .iov_len = strlen(payload)},
+        {.iov_base = trailer, .iov_len = strlen(trailer)},
+    };
+    size_t record_len = strlen(header) + strlen(payload) + strlen(trailer);
+    assert(tfs_writev(f, out, 3) == record_len);
+
+    // empty vectors do nothing; invalid ones fail
+    assert(tfs_writev(f, out, 0) == 0);
+    assert(tfs_writev(f, NULL, 1) == -1);
+    assert(tfs_writev(f, out, -1) == -1);
+    assert(tfs_writev(-1, out, 3) == -1);
+
+    // partial completion: only the bytes that fit in the block are written
+    assert(tfs_writev(f, out, 3) == record_len);
+    assert(tfs_writev(f, out, 3) == params.block_size - 2 * record_len);
+    assert(tfs_writev(f, out, 3) == 0);
+    assert(tfs_close(f) != -1);
+
+    f = tfs_open("/record", 0);
+    assert(f != -1);
+
+    // scatter the record over differently sized buffers
+    char a[3], b[10], c[100];
+    struct iovec in[] = {
+        {.iov_base = a, .iov_len = sizeof(a)},
+        {.iov_base = b, .iov_len = sizeof(b)},
+        {.iov_base = c, .iov_len = sizeof(c)},
+    };
+    assert(tfs_readv(f, in, 3) == params.block_size);
+
+    char expected[128];
+    snprintf(expected, sizeof(expected), "%s%s%s%s%s%s%s%s%s", header,
+             payload, trailer, header, payload, trailer, header, payload,
+             trailer);
+    assert(memcmp(a, expected, sizeof(a)) == 0);
+    assert(memcmp(b, expected + sizeof(a), sizeof(b)) == 0);
+    assert(memcmp(c, expected + sizeof(a) + sizeof(b),
+                  params.block_size - sizeof(a) - sizeof(b)) == 0);
+
+    // at the end of the file
+    assert(tfs_readv(f, in, 3) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void write_file(char const *path, uint8_t const *contents, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, len) == len);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_contents(char const *path, uint8_t const *expected, size_t len) {
+    uint8_t buffer[8];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+size_t released_bytes(void) {
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    return stats.released_bytes;
+}
+
+int main() {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    char path[16];
+
+    // four blocks per page: the root directory's block keeps the first page
+    tfs_params params = tfs_default_params();
+    params.block_size = page_size / 4;
+    assert(tfs_init(&params) != -1);
+    for (int i = 1; i <= 8; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        write_file(path, (uint8_t const *)"AAA!", 4);
+    }
+    for (int i = 1; i <= 3; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        assert(tfs_unlink(path) != -1);
+    }
+    assert(released_bytes() == 0);
+
+    // the second page is given back once all of its blocks are free
+    for (int i = 4; i <= 6; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        assert(tfs_unlink(path) != -1);
+        assert(released_bytes() == 0);
+    }
+    int f = tfs_open("/f7", TFS_O_TRUNC); // frees its block too
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(released_bytes() == page_size);
+
+    // and can be used again
+    write_file("/f1", (uint8_t const *)"BBB!", 4);
+    write_file("/f7", (uint8_t const *)"CCC!", 4);
+    assert_contents("/f1", (uint8_t const *)"BBB!", 4);
+    assert_contents("/f7", (uint8_t const *)"CCC!", 4);
+    assert_contents("/f8", (uint8_t const *)"AAA!", 4);
+    assert(tfs_destroy() != -1);
+
+    // blocks of several pages are given back as soon as they are freed, and
+    // so are huge pages
+    uint8_t *contents = malloc(2 << 20);
+    assert(contents != NULL);
+    memset(contents, 'x', 2 << 20);
+    for (int huge_pages = 0; huge_pages <= 1; huge_pages++) {
+        params.block_size = 2 << 20;
+        params.max_block_count = 4;
+        params.huge_pages = huge_pages;
+        assert(tfs_init(&params) != -1);
+        write_file("/big", contents, 2 << 20);
+        assert(tfs_unlink("/big") != -1);
+        assert(released_bytes() == 2 << 20);
+        write_file("/big", contents, 4);
+        assert_contents("/big", contents, 4);
+        assert(tfs_destroy() != -1);
+    }
+    free(contents);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const file_contents[] = "AAA!";
+
+void write_file(char const *path) {
+    int f = tfs_open(path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+}
+
+void assert_empty(void) {
+    tfs_fsck_report_t report;
+    assert(tfs_fsck(&report, 1) == 0);
+    assert(report.inodes_checked == 1);
+
+    int d = tfs_opendir("/");
+    assert(d != -1);
+    tfs_dirent_t entries[4];
+    assert(tfs_readdir_batch(d, entries, 4) == 0);
+    assert(tfs_closedir(d) != -1);
+
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    assert(stats.cold_raw_bytes == 0);
+    assert(stats.mapped_bytes == 0);
+}
+
+// uses a bit of everything that keeps state
+void populate(void) {
+    write_file("/f1");
+    write_file("/f2");
+    write_file("/f3");
+    assert(tfs_link("/f1", "/h1") != -1);
+    assert(tfs_sym_link("/f2", "/s1") != -1);
+    assert(tfs_clone("/f2", "/c1") != -1);
+    assert(tfs_map_from_external_fs("tests/file_to_copy.txt", "/m1") != -1);
+    assert(tfs_mark_cold("/f3") != -1);
+    assert(tfs_snapshot_create() != -1);
+    assert(tfs_unlink("/f1") != -1);
+    assert(tfs_snapshot_open("/c1") != -1);
+    assert(tfs_open("/f2", 0) != -1);
+}
+
+int main() {
+    assert(tfs_reset() == -1); // not initialized
+
+    tfs_params params = tfs_default_params();
+    params.dedup = true;
+    params.dir_prefix_index = true;
+    params.scrub_rate = 10000;
+    assert(tfs_init(&params) != -1);
+
+    for (int round = 0; round < 3; round++) {
+        populate();
+        assert(tfs_reset() != -1);
+        assert_empty();
+
+        // open handles are gone, and the snapshot too
+        assert(tfs_close(0) == -1);
+        assert(tfs_close(1) == -1);
+        assert(tfs_snapshot_open("/c1") == -1);
+        assert(tfs_snapshot_destroy() == -1);
+        assert(tfs_open("/f2", 0) == -1);
+    }
+
+    // the instance is as good as new: inodes and blocks are reused from the
+    // start, and the whole capacity is available again
+    write_file("/f1");
+    int f = tfs_open("/f1", 0);
+    assert(f == 0);
+    uint8_t buffer[sizeof(file_contents)];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, file_contents, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+    assert(tfs_reset() != -1);
+
+    char path[16];
+    int files = 0;
+    for (;; files++) {
+        snprintf(path, sizeof(path), "/f%d", files);
+        f = tfs_open(path, TFS_O_CREAT);
+        if (f == -1) {
+            break;
+        }
+        assert(tfs_close(f) != -1);
+    }
+    assert(files > 0);
+    assert(tfs_reset() != -1);
+    for (int i = 0; i < files; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_open("/one-more", TFS_O_CREAT) == -1);
+
+    // the mapped and dedup'd contents are still right after a reset
+    assert(tfs_reset() != -1);
+    write_file("/a");
+    write_file("/b");
+    tfs_stats_t stats;
+    tfs_get_stats(&stats);
+    assert(stats.dedup_hits == 1);
+    assert(tfs_map_from_external_fs("tests/file_to_copy.txt", "/m") != -1);
+    f = tfs_open("/m", 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, 4) == 4);
+    assert(memcmp(buffer, "BBB!", 4) == 0);
+    assert(tfs_close(f) != -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const file_contents[] = "AAA!";
+uint8_t const new_contents[] = "BBB!";
+
+void write_file(char const *path, uint8_t const *contents, ssize_t expected) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, sizeof(file_contents)) == expected);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_contents(int f, uint8_t const *expected) {
+    uint8_t buffer[sizeof(file_contents)];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, expected, sizeof(buffer)) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    write_file("/a", file_contents, sizeof(file_contents));
+    write_file("/b", file_contents, sizeof(file_contents));
+    assert(tfs_sym_link("/a", "/l") != -1);
+
+    assert(tfs_snapshot_open("/a") == -1); // no snapshot yet
+    assert(tfs_snapshot_create() != -1);
+    assert(tfs_snapshot_create() == -1);
+
+    // change the live namespace
+    write_file("/a", new_contents, sizeof(file_contents));
+    assert(tfs_unlink("/b") != -1);
+    write_file("/c", new_contents, sizeof(file_contents));
+
+    assert(tfs_open("/b", 0) == -1);
+    assert_contents(tfs_open("/a", 0), new_contents);
+
+    // the snapshot still shows the old one
+    assert_contents(tfs_snapshot_open("/a"), file_contents);
+    assert_contents(tfs_snapshot_open("/b"), file_contents);
+    assert_contents(tfs_snapshot_open("/l"), file_contents);
+    assert(tfs_snapshot_open("/c") == -1);
+
+    // snapshot handles are read-only, and keep the snapshot alive
+    int f = tfs_snapshot_open("/a");
+    assert(f != -1);
+    assert(tfs_write(f, new_contents, sizeof(new_contents)) == -1);
+    assert(tfs_snapshot_destroy() == -1);
+    assert_contents(f, file_contents);
+
+    // removing a file with an open snapshot handle is fine
+    f = tfs_snapshot_open("/a");
+    assert(f != -1);
+    assert(tfs_unlink("/a") != -1);
+    assert_contents(f, file_contents);
+
+    assert(tfs_snapshot_destroy() != -1);
+    assert(tfs_snapshot_destroy() == -1);
+    assert(tfs_snapshot_open("/b") == -1);
+    assert(tfs_destroy() != -1);
+
+    // room for the root directory, one file, and one copy
+    tfs_params params = tfs_default_params();
+    params.max_block_count = 3;
+    assert(tfs_init(&params) != -1);
+
+    write_file("/a", file_contents, sizeof(file_contents));
+    assert(tfs_snapshot_create() != -1);
+    // adding /b copies the directory, which fills the FS
+    write_file("/b", file_contents, -1);
+    write_file("/a", new_contents, -1);
+
+    // discarding the snapshot releases the old blocks
+    assert(tfs_snapshot_destroy() != -1);
+    write_file("/a", new_contents, sizeof(new_contents));
+    assert_contents(tfs_open("/a", 0), new_contents);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
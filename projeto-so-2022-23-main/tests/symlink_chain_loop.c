@@ -0,0 +1,72 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+uint8_t const file_contents[] = "AAA!";
+char const target_path[] = "/a_much_longer_target_name";
+
+void assert_contents_ok(char const *path) {
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+
+    uint8_t buffer[sizeof(file_contents)];
+    assert(tfs_read(f, buffer, sizeof(buffer)) == sizeof(buffer));
+    assert(memcmp(buffer, file_contents, sizeof(buffer)) == 0);
+
+    assert(tfs_close(f) != -1);
+}
+
+int main() {
+    assert(tfs_init(NULL) != -1);
+
+    int f = tfs_open(target_path, TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+
+    // chain of links, with link names shorter than their targets
+    assert(tfs_sym_link(target_path, "/l1") != -1);
+    assert(tfs_sym_link("/l1", "/l2") != -1);
+    assert(tfs_sym_link("/l2", "/l3") != -1);
+
+    tfs_stats_t before, after;
+    tfs_get_stats(&before);
+    assert_contents_ok("/l3");
+    assert_contents_ok("/l3");
+    tfs_get_stats(&after);
+    // the second open is answered by the cache
+    assert(after.symlink_cache_hits - before.symlink_cache_hits == 1);
+
+    // removing the target invalidates the cached resolution
+    assert(tfs_unlink(target_path) != -1);
+    assert(tfs_open("/l3", 0) == -1);
+
+    // opening a dangling link with TFS_O_CREAT creates its final target
+    f = tfs_open("/l3", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_write(f, file_contents, sizeof(file_contents)) ==
+           sizeof(file_contents));
+    assert(tfs_close(f) != -1);
+    assert_contents_ok(target_path);
+    assert_contents_ok("/l3");
+
+    // a loop of links: /x -> /y -> /x
+    f = tfs_open("/y", TFS_O_CREAT);
+    assert(f != -1);
+    assert(tfs_close(f) != -1);
+    assert(tfs_sym_link("/y", "/x") != -1);
+    assert(tfs_unlink("/y") != -1);
+    assert(tfs_sym_link("/x", "/y") != -1);
+
+    assert(tfs_open("/x", 0) == -1);
+    assert(tfs_open("/y", TFS_O_CREAT) == -1);
+
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
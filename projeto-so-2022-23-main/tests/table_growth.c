@@ -0,0 +1,79 @@
+#include "fs/operations.h"
+#include "fs/state.h"
+#include <assert.h>
+#include <stdio.h>
+
+#define FILE_COUNT 1000
+
+int main() {
+    char path[16];
+
+    // generous limits cost nothing until they are used
+    tfs_params params = tfs_default_params();
+    params.max_inode_count = 1 << 20;
+    params.max_open_files_count = 1 << 16;
+    params.block_size = FILE_COUNT * 64;
+    assert(tfs_init(&params) != -1);
+
+    // inodes don't move as the table grows
+    int first = inode_create(T_FILE);
+    assert(first != -1);
+    inode_t *first_inode = inode_get(first);
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(inode_get(first) == first_inode);
+    assert(first_inode->i_inumber == first);
+    inode_delete(first);
+
+    inode_table_stats_t stats;
+    inode_table_stats(&stats);
+    assert(stats.files == FILE_COUNT);
+    assert(stats.directories == 1);
+
+    // so do open files
+    int handles[FILE_COUNT];
+    for (int i = 0; i < FILE_COUNT; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        handles[i] = tfs_open(path, 0);
+        assert(handles[i] != -1);
+    }
+    open_file_entry_t *first_entry = get_open_file_entry(handles[0]);
+    assert(first_entry != NULL);
+    assert(tfs_open("/f0", 0) != -1);
+    assert(get_open_file_entry(handles[0]) == first_entry);
+    assert(tfs_unlink("/f0") == -1); // still open
+    for (int i = 0; i < FILE_COUNT; i++) {
+        assert(tfs_close(handles[i]) != -1);
+    }
+    assert(tfs_close(1 << 15) == -1); // never allocated
+
+    tfs_fsck_report_t report;
+    assert(tfs_fsck(&report, 2) == 0);
+    assert(report.inodes_checked == FILE_COUNT + 1);
+    assert(tfs_destroy() != -1);
+
+    // the limits still hold, even if they don't fall on a chunk boundary
+    params.max_inode_count = 300;
+    params.max_open_files_count = 100;
+    assert(tfs_init(&params) != -1);
+    for (int i = 0; i < 299; i++) {
+        snprintf(path, sizeof(path), "/f%d", i);
+        int f = tfs_open(path, TFS_O_CREAT);
+        assert(f != -1);
+        assert(tfs_close(f) != -1);
+    }
+    assert(tfs_open("/one-too-many", TFS_O_CREAT) == -1);
+    for (int i = 0; i < 100; i++) {
+        assert(tfs_open("/f1", 0) == i);
+    }
+    assert(tfs_open("/f1", 0) == -1);
+    assert(tfs_destroy() != -1);
+
+    printf("Successful test.\n");
+
+    return 0;
+}
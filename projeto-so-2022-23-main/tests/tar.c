@@ -0,0 +1,130 @@
+#include "fs/operations.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define FILE_SIZE 3000
+
+char const *archive_path = "tests/tar.tmp";
+
+void write_file(char const *path, uint8_t const *contents, size_t len) {
+    int f = tfs_open(path, TFS_O_CREAT | TFS_O_TRUNC);
+    assert(f != -1);
+    assert(tfs_write(f, contents, len) == len);
+    assert(tfs_close(f) != -1);
+}
+
+void assert_contents(char const *path, uint8_t const *expected, size_t len) {
+    uint8_t buffer[FILE_SIZE + 1];
+    int f = tfs_open(path, 0);
+    assert(f != -1);
+    assert(tfs_read(f, buffer, sizeof(buffer)) == len);
+    assert(memcmp(buffer, expected, len) == 0);
+    assert(tfs_close(f) != -1);
+}
+
+ssize_t export_archive(void) {
+    int fd = open(archive_path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    assert(fd != -1);
+    ssize_t written = tfs_export_tar(fd);
+    assert(close(fd) == 0);
+    return written;
+}
+
+ssize_t import_archive(void) {
+    int fd = open(archive_path, O_RDONLY);
+    assert(fd != -1);
+    ssize_t imported = tfs_import_tar(fd);
+    assert(close(fd) == 0);
+    return imported;
+}
+
+int main() {
+    uint8_t contents[FILE_SIZE];
+    for (size_t i = 0; i < FILE_SIZE; i++) {
+        contents[i] = (uint8_t)(i * 7);
+    }
+
+    tfs_params params = tfs_default_params();
+    params.block_size = FILE_SIZE;
+    assert(tfs_init(&params) != -1);
+
+    write_file("/f1", contents, FILE_SIZE);
+    write_file("/f2", contents, 512); // no padding
+    write_file("/empty", contents, 0);
+    assert(tfs_link("/f1", "/h1") != -1);
+    assert(tfs_sym_link("/f2", "/s1") != -1);
+
+    assert(export_archive() == 5);
+    assert(tfs_destroy() != -1);
+
+    // the archive is a regular ustar archive
+    FILE *host = fopen(archive_path, "r");
+    assert(host != NULL);
+    char header[512];
+    assert(fread(header, 1, sizeof(header), host) == sizeof(header));
+    assert(memcmp(header + 257, "ustar", 6) == 0);
+    assert(fclose(host) == 0);
+
+    // and it comes back the same
+    assert(tfs_init(&params) != -1);
+    write_file("/f1", contents + 1, 10); // overwritten
+    assert(import_archive() == 5);
+    assert_contents("/f1", contents, FILE_SIZE);
+    assert_contents("/f2", contents, 512);
+    assert_contents("/empty", contents, 0);
+    assert_contents("/h1", contents, FILE_SIZE);
+    assert_contents("/s1", contents, 512);
+
+    // hard links are still hard links
+    write_file("/h1", contents + 1, 10);
+    assert_contents("/f1", contents + 1, 10);
+
+    // files that don't fit in a block are skipped
+    assert(tfs_destroy() != -1);
+    params.block_size = 1024;
+    assert(tfs_init(&params) != -1);
+    assert(import_archive() == 3); // nor is the hard link to it
+    assert_contents("/f2", contents, 512);
+    assert(tfs_open("/f1", 0) == -1);
+    assert(tfs_destroy() != -1);
+    assert(tfs_init(&params) != -1);
+
+    // files that don't fit in the FS are skipped, and not left empty
+    write_file("/a", contents, 100);
+    write_file("/b", contents, 100);
+    write_file("/c", contents, 100);
+    assert(export_archive() == 3);
+    assert(tfs_destroy() != -1);
+    params.max_block_count = 2; // the root directory's, and one more
+    assert(tfs_init(&params) != -1);
+    assert(import_archive() == 1);
+    assert_contents("/a", contents, 100);
+    assert(tfs_open("/b", 0) == -1);
+    assert(tfs_open("/c", 0) == -1);
+    assert(tfs_destroy() != -1);
+    params = tfs_default_params();
+    params.block_size = 1024;
+
+    // a truncated archive is rejected
+    assert(truncate(archive_path, 2000) == 0);
+    assert(tfs_init(&params) != -1);
+    assert(import_archive() == -1);
+
+    // as is a damaged header
+    int fd = open(archive_path, O_RDWR);
+    assert(fd != -1);
+    assert(pwrite(fd, "x", 1, 0) == 1);
+    assert(close(fd) == 0);
+    assert(import_archive() == -1);
+    assert(tfs_destroy() != -1);
+
+    unlink(archive_path);
+
+    printf("Successful test.\n");
+
+    return 0;
+}